@@ -0,0 +1,34 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cmath>
+
+#include "Adaptive.h"
+
+Adaptive::Adaptive(uint64_t min_ns, uint64_t max_ns, double threshold) {
+	this->min_ns = min_ns;
+	this->max_ns = max_ns > min_ns ? max_ns : min_ns;
+	this->threshold = threshold;
+	period_ns = min_ns;
+	last = 0.0;
+	primed = false;
+}
+
+uint64_t Adaptive::update(double power) {
+	// relative change, with a 1 W floor so an idle domain near 0 W is not always "bursting"
+	double ref = fabs(last) > 1.0 ? fabs(last) : 1.0;
+	if (!primed || fabs(power - last)/ref > threshold) {
+		period_ns = min_ns;
+	} else {
+		period_ns = period_ns*2 < max_ns ? period_ns*2 : max_ns;
+	}
+	primed = true;
+	last = power;
+	return period_ns;
+}
+
+uint64_t Adaptive::period() {
+	return period_ns;
+}
@@ -0,0 +1,33 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+
+#ifndef ADAPTIVE_H_
+#define ADAPTIVE_H_
+
+/*
+Sampling period driven by power variability. While the power moves by more than
+threshold (relative) between ticks the period stays at min_ns, once it is
+stable the period doubles every tick up to max_ns.
+*/
+class Adaptive {
+
+private:
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t period_ns;
+	double threshold;
+	double last;
+	bool primed;
+
+public:
+	Adaptive(uint64_t min_ns, uint64_t max_ns, double threshold);
+	// next period for a tick that measured power Watts
+	uint64_t update(double power);
+	uint64_t period();
+};
+
+#endif /* ADAPTIVE_H_ */
@@ -0,0 +1,76 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <pthread.h>
+
+#include "Affinity.h"
+#include "RaplBackend.h"
+#include "Topology.h"
+
+static std::vector<int> housekeeping;
+static int fifoPriority = 0;
+static char description[MAX_LINE] = "floating";
+
+void affinity_set_cpus(const std::vector<int> &cpus) {
+	housekeeping = cpus;
+	std::string list;
+	for (size_t i = 0; i < cpus.size(); i++) {
+		list += (i > 0 ? "," : "") + std::to_string(cpus[i]);
+	}
+	snprintf(description, sizeof(description), "%s%s%s", cpus.empty() ? "floating" : "cpus ",
+	         list.c_str(), fifoPriority > 0 ? ", SCHED_FIFO" : "");
+}
+
+void affinity_set_fifo(int priority) {
+	fifoPriority = priority;
+	affinity_set_cpus(housekeeping);
+}
+
+int affinity_pick_housekeeping() {
+	cpu_set_t mask;
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+		return -1;
+	}
+	Topology *topo = get_topology();
+	// the last one, workloads usually fill a socket from its first cpu
+	for (int i = topo->get_n_cpus() - 1; i >= 0; i--) {
+		const topology_cpu_t &c = topo->get_cpu(i);
+		if (c.cpu < CPU_SETSIZE && !CPU_ISSET(c.cpu, &mask) && c.socket == 0) {
+			return c.cpu;
+		}
+	}
+	return -1;
+}
+
+void affinity_apply(bool realtime) {
+	if (!housekeeping.empty()) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : housekeeping) {
+			if (cpu >= 0 && cpu < CPU_SETSIZE) {
+				CPU_SET(cpu, &set);
+			}
+		}
+		int code = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (code) {
+			fprintf(stderr, "Could not pin powermon thread to %s: %s\n", description, strerror(code));
+		}
+	}
+	if (realtime && fifoPriority > 0) {
+		struct sched_param param;
+		param.sched_priority = fifoPriority;
+		int code = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (code) {
+			fprintf(stderr, "Could not set SCHED_FIFO priority %d: %s\n", fifoPriority, strerror(code));
+		}
+	}
+}
+
+const char *affinity_describe() {
+	return description;
+}
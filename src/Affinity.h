@@ -0,0 +1,31 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <sched.h>
+#include <vector>
+
+#ifndef AFFINITY_H_
+#define AFFINITY_H_
+
+/*
+Placement of powermon's own threads. The sampler and writer threads pin
+themselves to the housekeeping cpus when they start, and the samplers can also
+switch to SCHED_FIFO so the workload does not delay their deadlines. The
+MsrPool workers the sampler waits on are placed like the samplers. The writer
+does file I/O and is only pinned, never made real-time.
+*/
+
+// Housekeeping cpus for the sampler and writer threads, empty leaves them floating
+void affinity_set_cpus(const std::vector<int> &cpus);
+// SCHED_FIFO priority of the sampler threads, 0 keeps the normal scheduler
+void affinity_set_fifo(int priority);
+// Pick a cpu of socket 0 outside the current affinity mask (what a wrapped command inherits), -1 if none
+int affinity_pick_housekeeping();
+// Apply the settings to the calling thread, realtime is true for sampler threads
+void affinity_apply(bool realtime);
+// Text description of the settings for the summary
+const char *affinity_describe();
+
+#endif /* AFFINITY_H_ */
@@ -0,0 +1,571 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Analyze.h"
+
+AnalyzeSource::AnalyzeSource(const char *path) {
+	this->path = path;
+	fd = -1;
+	map = NULL;
+	size = 0;
+	pos = 0;
+	layout = ANALYZE_TEXT;
+	n_fields = 0;
+	start_ns = 0;
+	chunk_records = 0;
+	chunk_row = 0;
+	time_col = -1;
+	split_col = -1;
+	offset = 0.0;
+	pending = false;
+	next_t = 0.0;
+	next_key = 0;
+	// power-cpu.dat -> cpu
+	std::string base = this->path.substr(this->path.find_last_of('/') + 1);
+	base = base.substr(0, base.find_last_of('.'));
+	stem = base.compare(0, 6, "power-") == 0 && base.size() > 6 ? base.substr(6) : base;
+}
+
+AnalyzeSource::~AnalyzeSource() {
+	if (map != NULL) {
+		munmap((void*)map, size);
+	}
+	if (fd >= 0) {
+		::close(fd);
+	}
+}
+
+bool AnalyzeSource::open() {
+	struct stat st;
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror("analyze:open");
+		fprintf(stderr, "Trying to open %s\n", path.c_str());
+		return false;
+	}
+	size = st.st_size;
+	if (size == 0) {
+		fprintf(stderr, "%s is empty\n", path.c_str());
+		return false;
+	}
+	map = (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		perror("analyze:mmap");
+		return false;
+	}
+	// one front to back pass, let the kernel read ahead and drop pages behind
+	madvise((void*)map, size, MADV_SEQUENTIAL);
+	if (!parse_header()) {
+		return false;
+	}
+	for (uint32_t i = 0; i < n_fields; i++) {
+		if (names[i] == "time" || (time_col < 0 && names[i] == "acc-time")) {
+			time_col = i;
+		}
+		if (names[i] == "gpu") {
+			split_col = i;
+		}
+	}
+	if (time_col < 0) {
+		fprintf(stderr, "%s has no time or acc-time column\n", path.c_str());
+		return false;
+	}
+	row.assign(n_fields, 0.0);
+	return true;
+}
+
+bool AnalyzeSource::parse_header() {
+	trace_header_t header;
+	if (size >= sizeof(header) && (memcmp(map, TRACE_MAGIC, sizeof(header.magic)) == 0 ||
+	                               memcmp(map, COLUMNAR_MAGIC, sizeof(header.magic)) == 0)) {
+		memcpy(&header, map, sizeof(header));
+		layout = memcmp(map, COLUMNAR_MAGIC, sizeof(header.magic)) == 0 ? ANALYZE_COLUMNAR : ANALYZE_BINARY;
+		pos = sizeof(header) + header.n_fields * sizeof(trace_field_t);
+		if (header.version != TRACE_VERSION || header.record_size != header.n_fields * sizeof(double) || pos > size) {
+			fprintf(stderr, "%s: unsupported or truncated trace\n", path.c_str());
+			return false;
+		}
+		n_fields = header.n_fields;
+		start_ns = header.start_realtime_ns;
+		const trace_field_t *fields = (const trace_field_t*)(map + sizeof(header));
+		for (uint32_t i = 0; i < n_fields; i++) {
+			names.push_back(std::string(fields[i].name, strnlen(fields[i].name, TRACE_NAME_LEN)));
+		}
+		return true;
+	}
+	if (map[0] != '#') {
+		fprintf(stderr, "%s is not a powermon trace\n", path.c_str());
+		return false;
+	}
+	layout = ANALYZE_TEXT;
+	const uint8_t *eol = (const uint8_t*)memchr(map, '\n', size);
+	size_t len = eol != NULL ? eol - map : size;
+	std::string line((const char*)map + 1, len - 1);
+	size_t p = 0;
+	while ((p = line.find_first_not_of(" \t\r", p)) != std::string::npos) {
+		size_t e = line.find_first_of(" \t\r", p);
+		names.push_back(line.substr(p, e == std::string::npos ? std::string::npos : e - p));
+		p = e;
+	}
+	n_fields = names.size();
+	pos = eol != NULL ? len + 1 : size;
+	return n_fields > 0;
+}
+
+// Default selection: every power column except the running averages and the per-core breakdown
+void AnalyzeSource::select(const std::vector<std::string> &filter) {
+	cols.clear();
+	for (uint32_t i = 0; i < n_fields; i++) {
+		const std::string &n = names[i];
+		if ((int)i == time_col || (int)i == split_col) {
+			continue;
+		}
+		bool pick = false;
+		if (filter.empty()) {
+			pick = n.size() >= 5 && n.compare(n.size() - 5, 5, "power") == 0 &&
+			       n != "avg-power" && n.compare(0, 4, "core") != 0;
+		} else {
+			for (size_t k = 0; k < filter.size(); k++) {
+				pick = pick || filter[k] == n;
+			}
+		}
+		if (pick) {
+			cols.push_back(i);
+		}
+	}
+	needed = cols;
+	needed.push_back(time_col);
+	if (split_col >= 0) {
+		needed.push_back(split_col);
+	}
+	next_values.assign(cols.size(), 0.0);
+}
+
+int64_t AnalyzeSource::get_start_ns() {
+	return start_ns;
+}
+
+// Parse the needed columns of the next data line, comment and malformed lines are skipped
+bool AnalyzeSource::next_text() {
+	int last = 0;
+	for (size_t k = 0; k < needed.size(); k++) {
+		last = needed[k] > last ? needed[k] : last;
+	}
+	std::string tail;
+	while (pos < size) {
+		const char *line = (const char*)map + pos;
+		const uint8_t *eol = (const uint8_t*)memchr(map + pos, '\n', size - pos);
+		size_t len = eol != NULL ? eol - (map + pos) : size - pos;
+		pos += len + 1;
+		if (len == 0 || line[0] == '#') {
+			continue;
+		}
+		if (eol == NULL) {
+			// strtod needs a terminator the mapping may not have
+			tail.assign(line, len);
+			line = tail.c_str();
+		}
+		const char *p = line;
+		int i = 0;
+		for (; i <= last; i++) {
+			char *end;
+			double v = strtod(p, &end);
+			if (end == p) {
+				break;
+			}
+			row[i] = v;
+			p = end;
+		}
+		if (i > last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+Decode the needed columns of the next chunk straight from the mapping, the
+others are skipped using the column table. CRCs are only checked on the last
+chunk of the file, the one a crash can leave half written.
+*/
+bool AnalyzeSource::next_chunk() {
+	columnar_chunk_t c;
+	if (pos + sizeof(c) > size) {
+		return false;
+	}
+	memcpy(&c, map + pos, sizeof(c));
+	const uint8_t *payload = map + pos + sizeof(c);
+	if (c.magic != COLUMNAR_CHUNK_MAGIC || c.n_columns != n_fields || c.payload > size - pos - sizeof(c) ||
+	    c.payload < n_fields * sizeof(columnar_column_t) ||
+	    (pos + sizeof(c) + c.payload == size && columnar_crc32(payload, c.payload) != c.crc)) {
+		fprintf(stderr, "%s: damaged chunk at byte %zu ignored\n", path.c_str(), pos);
+		pos = size;
+		return false;
+	}
+	std::vector<columnar_column_t> table(n_fields);
+	memcpy(table.data(), payload, n_fields * sizeof(columnar_column_t));
+	std::vector<uint64_t> offsets(n_fields);
+	uint64_t off = n_fields * sizeof(columnar_column_t);
+	for (uint32_t k = 0; k < n_fields; k++) {
+		offsets[k] = off;
+		off += table[k].bytes;
+	}
+	if (off != c.payload) {
+		fprintf(stderr, "%s: damaged chunk at byte %zu ignored\n", path.c_str(), pos);
+		pos = size;
+		return false;
+	}
+	chunk.resize((size_t)needed.size() * c.n_records);
+	for (size_t j = 0; j < needed.size(); j++) {
+		if (!columnar_decode(payload + offsets[needed[j]], &table[needed[j]], c.n_records, &chunk[j * c.n_records])) {
+			fprintf(stderr, "%s: damaged column %s at byte %zu\n", path.c_str(), names[needed[j]].c_str(), pos);
+			pos = size;
+			return false;
+		}
+	}
+	pos += sizeof(c) + c.payload;
+	chunk_records = c.n_records;
+	chunk_row = 0;
+	return true;
+}
+
+bool AnalyzeSource::next(double *t, int *key, double *values) {
+	if (layout == ANALYZE_TEXT) {
+		if (!next_text()) {
+			return false;
+		}
+	} else if (layout == ANALYZE_BINARY) {
+		size_t record_size = n_fields * sizeof(double);
+		if (pos + record_size > size) {
+			return false;
+		}
+		for (size_t j = 0; j < needed.size(); j++) {
+			memcpy(&row[needed[j]], map + pos + needed[j] * sizeof(double), sizeof(double));
+		}
+		pos += record_size;
+	} else {
+		while (chunk_row >= chunk_records) {
+			if (!next_chunk()) {
+				return false;
+			}
+		}
+		for (size_t j = 0; j < needed.size(); j++) {
+			row[needed[j]] = chunk[j * chunk_records + chunk_row];
+		}
+		chunk_row++;
+	}
+	*t = row[time_col] + offset;
+	*key = split_col >= 0 ? (int)row[split_col] : 0;
+	for (size_t i = 0; i < cols.size(); i++) {
+		values[i] = row[cols[i]];
+	}
+	return true;
+}
+
+Analyzer::Analyzer() {
+	width = 0.0;
+}
+
+Analyzer::~Analyzer() {
+	for (size_t i = 0; i < sources.size(); i++) {
+		delete sources[i];
+	}
+}
+
+void Analyzer::set_columns(const char *list) {
+	std::string s(list);
+	size_t pos = 0;
+	filter.clear();
+	while (pos <= s.size()) {
+		size_t end = s.find(',', pos);
+		if (end == std::string::npos) {
+			end = s.size();
+		}
+		if (end > pos) {
+			filter.push_back(s.substr(pos, end - pos));
+		}
+		pos = end + 1;
+	}
+}
+
+// Also integrate over consecutive windows of this many seconds from the start of the traces
+void Analyzer::set_width(double seconds) {
+	width = seconds;
+}
+
+void Analyzer::add_window(const char *name, double start, double end) {
+	analyze_window_t w;
+	w.name = name;
+	w.start = start;
+	w.end = end;
+	windows.push_back(w);
+}
+
+bool Analyzer::load_regions(const char *path) {
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror("analyze:fopen");
+		fprintf(stderr, "Trying to open %s\n", path);
+		return false;
+	}
+	char line[512];
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		// the last two fields are the times, the name may contain spaces
+		std::vector<std::string> tok;
+		for (char *t = strtok(line, " \t\r\n"); t != NULL; t = strtok(NULL, " \t\r\n")) {
+			tok.push_back(t);
+		}
+		if (tok.size() < 3 || tok[0][0] == '#') {
+			continue;
+		}
+		std::string name = tok[0];
+		for (size_t i = 1; i + 2 < tok.size(); i++) {
+			name += " " + tok[i];
+		}
+		add_window(name.c_str(), atof(tok[tok.size() - 2].c_str()), atof(tok[tok.size() - 1].c_str()));
+	}
+	fclose(fp);
+	return true;
+}
+
+bool Analyzer::add_trace(const char *path) {
+	AnalyzeSource *s = new AnalyzeSource(path);
+	if (!s->open()) {
+		delete s;
+		return false;
+	}
+	sources.push_back(s);
+	return true;
+}
+
+analyze_stream_t *Analyzer::stream_for(AnalyzeSource *s, int key) {
+	for (size_t i = 0; i < s->streams.size(); i++) {
+		if (s->streams[i].key == key) {
+			return &s->streams[i];
+		}
+	}
+	analyze_stream_t st;
+	st.key = key;
+	st.have_prev = false;
+	st.t_prev = 0.0;
+	st.first = 0.0;
+	st.last = 0.0;
+	st.energy.assign((windows.size() + 1) * s->cols.size(), 0.0);
+	st.time.assign(windows.size() + 1, 0.0);
+	s->streams.push_back(st);
+	return &s->streams.back();
+}
+
+void Analyzer::accumulate(double *energy, double *time, uint32_t nc, double t0, const double *v0,
+                          double t1, const double *v1, double a, double b) {
+	double fa = (a - t0) / (t1 - t0), fb = (b - t0) / (t1 - t0);
+	for (uint32_t c = 0; c < nc; c++) {
+		double pa = v0[c] + (v1[c] - v0[c]) * fa;
+		double pb = v0[c] + (v1[c] - v0[c]) * fb;
+		energy[c] += (b - a) * (pa + pb) / 2.0;
+	}
+	*time += b - a;
+}
+
+// Add the segment between two samples to every window it overlaps
+void Analyzer::integrate(analyze_stream_t *st, uint32_t nc, double t0, const double *v0, double t1, const double *v1) {
+	if (t1 <= t0) {
+		return;
+	}
+	accumulate(&st->energy[0], &st->time[0], nc, t0, v0, t1, v1, t0, t1);
+	for (size_t w = 0; w < windows.size(); w++) {
+		double a = t0 > windows[w].start ? t0 : windows[w].start;
+		double b = t1 < windows[w].end ? t1 : windows[w].end;
+		if (b > a) {
+			accumulate(&st->energy[(w + 1) * nc], &st->time[w + 1], nc, t0, v0, t1, v1, a, b);
+		}
+	}
+	if (width > 0.0) {
+		for (size_t i = (size_t)((t0 > 0.0 ? t0 : 0.0) / width); i * width < t1; i++) {
+			if (st->fixed_time.size() <= i) {
+				st->fixed_time.resize(i + 1, 0.0);
+				st->fixed_energy.resize((i + 1) * nc, 0.0);
+			}
+			double a = t0 > i * width ? t0 : i * width;
+			double b = t1 < (i + 1) * width ? t1 : (i + 1) * width;
+			if (b > a) {
+				accumulate(&st->fixed_energy[i * nc], &st->fixed_time[i], nc, t0, v0, t1, v1, a, b);
+			}
+		}
+	}
+}
+
+// Integrate up to the lookahead record of a trace and read the next one
+void Analyzer::consume(AnalyzeSource *s) {
+	analyze_stream_t *st = stream_for(s, s->next_key);
+	if (st->have_prev) {
+		integrate(st, s->cols.size(), st->t_prev, st->prev.data(), s->next_t, s->next_values.data());
+	} else {
+		st->first = s->next_t;
+		st->have_prev = true;
+	}
+	st->t_prev = s->next_t;
+	st->prev = s->next_values;
+	st->last = s->next_t;
+	s->pending = s->next(&s->next_t, &s->next_key, s->next_values.data());
+}
+
+/*
+Traces written by the same run share the sampler start, binary headers also
+carry the wall clock time they were opened and are aligned on it. The grid
+spans the time every resampled trace covers, values are linearly interpolated.
+*/
+void Analyzer::run(double dt, FILE *grid) {
+	bool stamped = true;
+	int64_t t0 = 0;
+	for (size_t i = 0; i < sources.size(); i++) {
+		int64_t s = sources[i]->get_start_ns();
+		stamped = stamped && s != 0;
+		t0 = i == 0 || s < t0 ? s : t0;
+	}
+	std::vector<AnalyzeSource*> resampled;
+	for (size_t i = 0; i < sources.size(); i++) {
+		AnalyzeSource *s = sources[i];
+		s->offset = stamped ? (double)(s->get_start_ns() - t0) / 1e9 : 0.0;
+		s->select(filter);
+		s->pending = s->next(&s->next_t, &s->next_key, s->next_values.data());
+		if (grid != NULL && s->split_col >= 0) {
+			fprintf(stderr, "%s: buffered samples of several GPUs are integrated but not resampled\n", s->stem.c_str());
+		} else if (grid != NULL && s->pending && !s->cols.empty()) {
+			resampled.push_back(s);
+		}
+	}
+	if (grid != NULL && dt > 0.0 && !resampled.empty()) {
+		double g0 = resampled[0]->next_t;
+		fprintf(grid, "%-15s", "#time");
+		for (size_t i = 0; i < resampled.size(); i++) {
+			AnalyzeSource *s = resampled[i];
+			g0 = s->next_t > g0 ? s->next_t : g0;
+			for (size_t c = 0; c < s->cols.size(); c++) {
+				std::string name = sources.size() > 1 ? s->stem + "." + s->names[s->cols[c]] : s->names[s->cols[c]];
+				fprintf(grid, " %-15s", name.c_str());
+			}
+		}
+		fprintf(grid, "\n");
+		for (uint64_t k = 0; ; k++) {
+			double g = g0 + k * dt;
+			bool covered = true;
+			for (size_t i = 0; i < resampled.size(); i++) {
+				AnalyzeSource *s = resampled[i];
+				while (s->pending && s->next_t <= g) {
+					consume(s);
+				}
+				covered = covered && (s->pending || s->streams[0].last >= g);
+			}
+			if (!covered) {
+				break;
+			}
+			fprintf(grid, "%-15f", g);
+			for (size_t i = 0; i < resampled.size(); i++) {
+				AnalyzeSource *s = resampled[i];
+				analyze_stream_t *st = &s->streams[0];
+				double f = s->pending ? (g - st->t_prev) / (s->next_t - st->t_prev) : 0.0;
+				for (size_t c = 0; c < s->cols.size(); c++) {
+					double v = s->pending ? st->prev[c] + (s->next_values[c] - st->prev[c]) * f : st->prev[c];
+					fprintf(grid, " %-15f", v);
+				}
+			}
+			fprintf(grid, "\n");
+		}
+	}
+	for (size_t i = 0; i < sources.size(); i++) {
+		while (sources[i]->pending) {
+			consume(sources[i]);
+		}
+	}
+}
+
+/*
+One line per window and signal. Windows sharing a name (the instances of a
+region) are added together, fixed width windows follow as w0, w1...
+*/
+void Analyzer::summary(FILE *fp) {
+	std::vector<std::string> names;
+	std::vector<std::vector<size_t> > groups;
+	for (size_t w = 0; w < windows.size(); w++) {
+		size_t g = 0;
+		while (g < names.size() && names[g] != windows[w].name) {
+			g++;
+		}
+		if (g == names.size()) {
+			names.push_back(windows[w].name);
+			groups.push_back(std::vector<size_t>());
+		}
+		groups[g].push_back(w);
+	}
+	size_t n_fixed = 0;
+	for (size_t i = 0; i < sources.size(); i++) {
+		for (size_t j = 0; j < sources[i]->streams.size(); j++) {
+			n_fixed = sources[i]->streams[j].fixed_time.size() > n_fixed ? sources[i]->streams[j].fixed_time.size() : n_fixed;
+		}
+	}
+	fprintf(fp, "%-24s %12s %12s %-28s %12s %14s %12s\n", "#window", "start(s)", "end(s)", "signal",
+	        "time(s)", "energy(J)", "avg-power(W)");
+	for (size_t row = 0; row < 1 + names.size() + n_fixed; row++) {
+		char fixed[32];
+		for (size_t i = 0; i < sources.size(); i++) {
+			AnalyzeSource *s = sources[i];
+			size_t nc = s->cols.size();
+			for (size_t j = 0; j < s->streams.size(); j++) {
+				analyze_stream_t *st = &s->streams[j];
+				std::string label = s->stem;
+				if (s->split_col >= 0) {
+					label += ".gpu" + std::to_string(st->key);
+				}
+				const char *name;
+				double start, end, time = 0.0;
+				std::vector<double> energy(nc, 0.0);
+				if (row == 0) {
+					name = "all";
+					start = st->first;
+					end = st->last;
+					time = st->time[0];
+					energy.assign(st->energy.begin(), st->energy.begin() + nc);
+				} else if (row <= names.size()) {
+					const std::vector<size_t> &g = groups[row - 1];
+					name = names[row - 1].c_str();
+					start = windows[g[0]].start;
+					end = windows[g[0]].end;
+					for (size_t k = 0; k < g.size(); k++) {
+						start = windows[g[k]].start < start ? windows[g[k]].start : start;
+						end = windows[g[k]].end > end ? windows[g[k]].end : end;
+						time += st->time[g[k] + 1];
+						for (size_t c = 0; c < nc; c++) {
+							energy[c] += st->energy[(g[k] + 1) * nc + c];
+						}
+					}
+				} else {
+					size_t f = row - 1 - names.size();
+					snprintf(fixed, sizeof(fixed), "w%zu", f);
+					name = fixed;
+					start = f * width;
+					end = (f + 1) * width;
+					if (f < st->fixed_time.size()) {
+						time = st->fixed_time[f];
+						energy.assign(st->fixed_energy.begin() + f * nc, st->fixed_energy.begin() + (f + 1) * nc);
+					}
+				}
+				for (size_t c = 0; c < nc; c++) {
+					std::string signal = label + "." + s->names[s->cols[c]];
+					fprintf(fp, "%-24s %12.6f %12.6f %-28s %12.6f %14.6f %12.4f\n", name, start, end, signal.c_str(),
+					        time, energy[c], time > 0.0 ? energy[c] / time : 0.0);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Trace.h"
+
+#ifndef ANALYZE_H_
+#define ANALYZE_H_
+
+#define ANALYZE_TEXT   0
+#define ANALYZE_BINARY 1
+#define ANALYZE_COLUMNAR 2
+
+struct analyze_window_t {
+	std::string name;
+	double start;
+	double end;
+};
+
+/*
+Integration state of one power signal: a trace, or one GPU of a buffered
+sample trace. Every column is treated as piecewise linear between samples, the
+energy of a window is the trapezoid of the samples inside it plus the
+interpolated parts of the segments crossing its edges.
+*/
+struct analyze_stream_t {
+	int key;
+	bool have_prev;
+	double t_prev;
+	std::vector<double> prev;
+	double first;
+	double last;
+	// [window][column] energy and [window] covered time, window 0 is the whole trace
+	std::vector<double> energy;
+	std::vector<double> time;
+	std::vector<double> fixed_energy;
+	std::vector<double> fixed_time;
+};
+
+/*
+Sequential reader of one memory mapped trace, text .dat, binary .bin or
+columnar .pmc. Only the time, split and selected columns are parsed or decoded.
+*/
+class AnalyzeSource {
+
+private:
+	std::string path;
+	int fd;
+	const uint8_t *map;
+	size_t size;
+	size_t pos;
+	int layout;
+	uint32_t n_fields;
+	int64_t start_ns;
+
+	// record being read, columnar chunks are decoded column by column
+	std::vector<double> row;
+	std::vector<double> chunk;
+	std::vector<int> needed;
+	uint32_t chunk_records;
+	uint32_t chunk_row;
+
+	bool parse_header();
+	bool next_text();
+	bool next_chunk();
+
+public:
+	std::string stem;
+	std::vector<std::string> names;
+	int time_col;
+	// column that tells interleaved devices apart (gpu of a buffered -b trace), -1 if none
+	int split_col;
+	std::vector<int> cols;
+	double offset;
+	std::vector<analyze_stream_t> streams;
+
+	// lookahead record of the merge
+	bool pending;
+	double next_t;
+	int next_key;
+	std::vector<double> next_values;
+
+	AnalyzeSource(const char *path);
+	~AnalyzeSource();
+	// Map the file and read its header, false with a message if it is not a powermon trace
+	bool open();
+	void select(const std::vector<std::string> &filter);
+	int64_t get_start_ns();
+	// Read the next record, false at the end of the trace
+	bool next(double *t, int *key, double *values);
+};
+
+class Analyzer {
+
+private:
+	std::vector<AnalyzeSource*> sources;
+	std::vector<analyze_window_t> windows;
+	std::vector<std::string> filter;
+	double width;
+
+	analyze_stream_t *stream_for(AnalyzeSource *s, int key);
+	void consume(AnalyzeSource *s);
+	void integrate(analyze_stream_t *st, uint32_t nc, double t0, const double *v0, double t1, const double *v1);
+	static void accumulate(double *energy, double *time, uint32_t nc, double t0, const double *v0,
+	                       double t1, const double *v1, double a, double b);
+
+public:
+	Analyzer();
+	~Analyzer();
+	void set_columns(const char *list);
+	void set_width(double seconds);
+	void add_window(const char *name, double start, double end);
+	// Windows from a regions file, "name start end" per line as written by powermon_finalize
+	bool load_regions(const char *path);
+	bool add_trace(const char *path);
+	// One pass over every trace, also writing the signals resampled every dt seconds to grid if given
+	void run(double dt, FILE *grid);
+	void summary(FILE *fp);
+};
+
+#endif /* ANALYZE_H_ */
@@ -0,0 +1,196 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstring>
+#include <sys/resource.h>
+
+#include "Bench.h"
+#include "nvmlPower.hpp"
+
+LatencyHist::LatencyHist(const char *name) {
+	snprintf(this->name, sizeof(this->name), "%s", name);
+	memset(buckets, 0, sizeof(buckets));
+}
+
+void LatencyHist::add(uint64_t ns) {
+	stats.add(ns/1000.0);
+	int b = 0;
+	while (ns > 1 && b < BENCH_BUCKETS - 1) {
+		ns >>= 1;
+		b++;
+	}
+	buckets[b]++;
+}
+
+// One table row in microseconds, then the non-empty histogram buckets
+void LatencyHist::print(FILE *fp) {
+	fprintf(fp, "  %-22s %8lu %9.2f %9.2f %9.2f %9.2f %9.2f\n", name, (unsigned long)stats.get_n(),
+	        stats.mean(), stats.p50(), stats.p95(), stats.p99(), stats.max());
+	fprintf(fp, "  %-22s", "");
+	for (int b = 0; b < BENCH_BUCKETS; b++) {
+		if (buckets[b] > 0) {
+			fprintf(fp, " [%.3g,%.3g)us:%lu", (1ULL << b)/1000.0, (2ULL << b)/1000.0, (unsigned long)buckets[b]);
+		}
+	}
+	fprintf(fp, "\n");
+}
+
+static double process_cpu_time() {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec)/1e6;
+}
+
+// Cost of each sampling primitive in isolation
+static void bench_primitives() {
+	char name[32];
+	std::vector<uint64_t> raw(rapl->get_n_sockets() * RAPL_DOMAINS);
+	uint64_t t0;
+	RaplBackend *backend = rapl->get_backend();
+
+	printf("\nPrimitive latency (us):          n      mean       p50       p95       p99       max\n");
+	for (int s = 0; s < rapl->get_n_sockets(); s++) {
+		snprintf(name, sizeof(name), "%s read socket%d", backend->name(), s);
+		LatencyHist h(name);
+		for (int i = 0; i < BENCH_ITERATIONS; i++) {
+			t0 = Deadline::now_ns();
+			backend->read(s, raw.data());
+			h.add(Deadline::now_ns() - t0);
+		}
+		h.print(stdout);
+	}
+	LatencyHist all("rapl sample (all)");
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		t0 = Deadline::now_ns();
+		rapl->sample();
+		all.add(Deadline::now_ns() - t0);
+	}
+	all.print(stdout);
+
+	for (unsigned int d = 0; d < gpuCount; d++) {
+		unsigned int power;
+		unsigned long long energy;
+		snprintf(name, sizeof(name), "gpu%u power usage", gpuIndex[d]);
+		LatencyHist hp(name);
+		snprintf(name, sizeof(name), "gpu%u energy counter", gpuIndex[d]);
+		LatencyHist he(name);
+		for (int i = 0; i < BENCH_ITERATIONS; i++) {
+			t0 = Deadline::now_ns();
+			nvmlDeviceGetPowerUsage(gpuDevices[d], &power);
+			hp.add(Deadline::now_ns() - t0);
+			t0 = Deadline::now_ns();
+			nvmlDeviceGetTotalEnergyConsumption(gpuDevices[d], &energy);
+			he.add(Deadline::now_ns() - t0);
+		}
+		hp.print(stdout);
+		he.print(stdout);
+	}
+
+	// a unified record as the writer thread formats it, to /dev/null so only formatting is timed
+	Trace trace("/dev/null", TRACE_TEXT, TRACE_KIND_NODE);
+	trace.add_field("timestep", "", 'i');
+	for (int c = 0; c < 10 + (int)gpuCount; c++) {
+		trace.add_field("col", "W");
+	}
+	std::vector<trace_field_t> fields(trace.n_fields());
+	for (uint32_t i = 0; i < trace.n_fields(); i++) {
+		memset(&fields[i], 0, sizeof(trace_field_t));
+		fields[i].type = i == 0 ? 'i' : 'f';
+	}
+	std::vector<double> rec(trace.n_fields(), 123.456789);
+	FILE *null = fopen("/dev/null", "w");
+	LatencyHist text("record text format");
+	LatencyHist bin("record binary write");
+	for (int i = 0; i < BENCH_ITERATIONS && null != NULL; i++) {
+		t0 = Deadline::now_ns();
+		Trace::write_text_record(null, fields.data(), fields.size(), rec.data());
+		text.add(Deadline::now_ns() - t0);
+		t0 = Deadline::now_ns();
+		fwrite(rec.data(), sizeof(double), rec.size(), null);
+		bin.add(Deadline::now_ns() - t0);
+	}
+	if (null != NULL) {
+		fclose(null);
+	}
+	text.print(stdout);
+	bin.print(stdout);
+
+	// what the sampler itself pays to hand a record to the writer
+	trace.open();
+	LatencyHist ring("ring record+commit");
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		t0 = Deadline::now_ns();
+		double *r = trace.record();
+		if (r != NULL) {
+			memcpy(r, rec.data(), rec.size() * sizeof(double));
+			trace.commit();
+		}
+		ring.add(Deadline::now_ns() - t0);
+	}
+	trace.close();
+	ring.print(stdout);
+}
+
+int PowerBench(const double *ms, int n, const char *devices) {
+	// the sweep runs in this thread, placed like a sampler would be
+	affinity_apply(true);
+	printf("Sampler placement: %s\n", affinity_describe());
+	PowerInit(devices);
+	bench_primitives();
+
+	printf("\nInterval sweep (%.1f secs each, unified sampler tick):\n", BENCH_SECS);
+	printf("  interval ms   requested Hz  achieved Hz   missed   sampler cpu%%  process cpu%%  tick p99 us  jitter p99 us\n");
+	double sane = -1.0;
+	for (int k = 0; k < n; k++) {
+		uint64_t period = (uint64_t)(ms[k]*1000000.0);
+		uint64_t ticks = (uint64_t)(BENCH_SECS*NS_PER_SEC/period);
+		Stats tick;
+		Trace trace("/dev/null", TRACE_TEXT, TRACE_KIND_NODE);
+		for (int c = 0; c < 11 + (int)gpuCount; c++) {
+			trace.add_field("col", "W");
+		}
+		trace.open();
+
+		Deadline deadline(period);
+		double cpu0 = ThreadCpuTime(), proc0 = process_cpu_time();
+		uint64_t t0 = Deadline::now_ns(), t1 = t0, t2;
+		for (uint64_t i = 0; i < ticks; i++) {
+			t2 = deadline.wait();
+			rapl->sample();
+			double gpu = GPUSample((double)(t2 - t1)/NS_PER_SEC);
+			double *r = trace.record();
+			if (r != NULL) {
+				r[0] = i; r[1] = rapl->pkg_current_power(); r[2] = rapl->dram_current_power(); r[3] = gpu;
+				trace.commit();
+			}
+			tick.add((Deadline::now_ns() - t2)/1000.0);
+			t1 = t2;
+		}
+		double wall = (double)(Deadline::now_ns() - t0)/NS_PER_SEC;
+		double cpu = (ThreadCpuTime() - cpu0)/wall;
+		trace.close();
+		double proc = (process_cpu_time() - proc0)/wall;
+
+		double requested = 1000.0/ms[k];
+		double achieved = deadline.get_ticks()/wall;
+		double missed = (double)deadline.get_missed()/(deadline.get_ticks() + deadline.get_missed());
+		bool ok = achieved >= BENCH_MIN_RATE*requested && missed <= BENCH_MAX_MISSED && proc <= BENCH_MAX_CPU;
+		if (ok && (sane < 0.0 || ms[k] < sane)) {
+			sane = ms[k];
+		}
+		printf("  %11.3f %13.1f %12.1f %8lu %12.2f%% %12.2f%% %12.2f %14.2f %s\n", ms[k], requested, achieved,
+		       deadline.get_missed(), 100.0*cpu, 100.0*proc, tick.p99(), deadline.get_jitter().p99(),
+		       ok ? "" : "  <- too fast");
+	}
+	GPUShutdown();
+
+	if (sane > 0.0) {
+		printf("\nMinimum sane interval: %.3f ms (>= %.0f%% of the rate, <= %.0f%% missed, <= %.0f%% CPU)\n",
+		       sane, 100.0*BENCH_MIN_RATE, 100.0*BENCH_MAX_MISSED, 100.0*BENCH_MAX_CPU);
+	} else {
+		printf("\nNo interval of the sweep kept up, try longer intervals\n");
+	}
+	return 0;
+}
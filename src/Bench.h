@@ -0,0 +1,50 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdint>
+
+#include "Stats.h"
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#define BENCH_ITERATIONS   2000
+#define BENCH_SECS         2.0
+#define BENCH_BUCKETS      32
+#define BENCH_MAX_INTERVALS 32
+
+// a sampling interval is sane when it keeps up, rarely misses and costs little CPU
+#define BENCH_MIN_RATE     0.99
+#define BENCH_MAX_MISSED   0.01
+#define BENCH_MAX_CPU      0.05
+
+/*
+Latency distribution of one primitive: streaming percentiles plus a log2
+histogram of nanoseconds, both constant memory.
+*/
+class LatencyHist {
+
+private:
+	// own copy, callers build labels in one reused buffer
+	char name[32];
+	Stats stats;
+	uint64_t buckets[BENCH_BUCKETS];
+
+public:
+	LatencyHist(const char *name);
+	void add(uint64_t ns);
+	void print(FILE *fp);
+};
+
+/*
+Measure what powermon costs: latency of every sampling primitive and, for each
+interval of the sweep, the achieved rate, missed deadlines and CPU time of a
+unified sampler tick. Prints the smallest interval that stays within the
+BENCH_* limits. ms lists the intervals in milliseconds, n of them.
+*/
+int PowerBench(const double *ms, int n, const char *devices);
+
+#endif /* BENCH_H_ */
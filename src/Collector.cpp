@@ -0,0 +1,522 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Collector.h"
+#include "nvmlPower.hpp"
+
+static bool write_all(int fd, const void *buf, size_t len) {
+	const char *p = (const char*)buf;
+	while (len > 0) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+	char *p = (char*)buf;
+	while (len > 0) {
+		ssize_t n = recv(fd, p, len, 0);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+CollectorClient::CollectorClient(const char *host, int port, const char *node, uint64_t interval_ns) {
+	char service[16];
+	struct addrinfo hints, *res = NULL;
+	offset_ns = 0;
+	rtt_ns = 0;
+	batch.reserve(COLLECT_BATCH_RECORDS);
+	batch_ns = Deadline::now_ns();
+
+	fd = -1;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(host, service, &hints, &res) != 0 || res == NULL) {
+		fprintf(stderr, "Collector: cannot resolve %s, not streaming\n", host);
+		return;
+	}
+	// the aggregator may still be starting up, retry for a while
+	uint64_t deadline = Deadline::now_ns() + COLLECT_CONNECT_SECS * NS_PER_SEC;
+	while (fd < 0 && Deadline::now_ns() < deadline) {
+		fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+			::close(fd);
+			fd = -1;
+			usleep(500000);
+		}
+	}
+	freeaddrinfo(res);
+	if (fd < 0) {
+		fprintf(stderr, "Collector: cannot connect to %s:%d, not streaming\n", host, port);
+		return;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	collect_hello_t hello;
+	memset(&hello, 0, sizeof(hello));
+	hello.version = COLLECT_VERSION;
+	hello.interval_ns = interval_ns;
+	strncpy(hello.node, node, COLLECT_NAME_LEN - 1);
+	send_msg(COLLECT_HELLO, &hello, sizeof(hello));
+	sync();
+	printf("Collector: streaming to %s:%d, clock offset %.3f ms (rtt %.3f ms)\n", host, port,
+	       offset_ns/1e6, rtt_ns/1e6);
+}
+
+CollectorClient::~CollectorClient() {
+	close();
+}
+
+bool CollectorClient::send_msg(uint32_t type, const void *payload, uint32_t length) {
+	collect_msg_t msg;
+	msg.type = type;
+	msg.length = length;
+	if (!write_all(fd, &msg, sizeof(msg)) || (length > 0 && !write_all(fd, payload, length))) {
+		fprintf(stderr, "Collector: connection lost, not streaming\n");
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	return true;
+}
+
+// Cristian's algorithm: offset from the round trip with the least delay
+void CollectorClient::sync() {
+	collect_msg_t msg;
+	collect_sync_t s;
+	rtt_ns = ~0ULL;
+	for (int i = 0; i < COLLECT_SYNC_ROUNDS && fd >= 0; i++) {
+		s.node_ns = Deadline::now_ns();
+		s.aggregator_ns = 0;
+		if (!send_msg(COLLECT_SYNC, &s, sizeof(s))) {
+			return;
+		}
+		if (!read_all(fd, &msg, sizeof(msg)) || msg.type != COLLECT_SYNC || msg.length != sizeof(s) ||
+		    !read_all(fd, &s, sizeof(s))) {
+			fprintf(stderr, "Collector: clock sync failed\n");
+			return;
+		}
+		uint64_t t1 = Deadline::now_ns();
+		if (t1 - s.node_ns < rtt_ns) {
+			rtt_ns = t1 - s.node_ns;
+			offset_ns = (int64_t)s.aggregator_ns - (int64_t)(s.node_ns + rtt_ns/2);
+		}
+	}
+}
+
+void CollectorClient::flush() {
+	if (fd >= 0 && !batch.empty()) {
+		send_msg(COLLECT_BATCH, batch.data(), batch.size() * sizeof(collect_record_t));
+	}
+	batch.clear();
+	batch_ns = Deadline::now_ns();
+}
+
+// Convert one unified sampler record (see PowerPollingFunc) and batch it
+void CollectorClient::add(const double *r) {
+	if (fd < 0) {
+		return;
+	}
+	collect_record_t rec;
+	rec.t_ns = (uint64_t)((int64_t)samplerStartNs + (int64_t)(r[1] * NS_PER_SEC) + offset_ns);
+	rec.dt = r[2];
+	rec.cpu_power = r[3];
+	rec.dram_power = r[4];
+	rec.gpu_power = r[5];
+	rec.cpu_energy = r[7];
+	rec.dram_energy = r[8];
+	rec.gpu_energy = r[9];
+	batch.push_back(rec);
+	if (batch.size() >= COLLECT_BATCH_RECORDS || Deadline::now_ns() - batch_ns >= COLLECT_BATCH_MS * 1000000ULL) {
+		flush();
+	}
+}
+
+void CollectorClient::close() {
+	if (fd < 0) {
+		return;
+	}
+	flush();
+	send_msg(COLLECT_BYE, NULL, 0);
+	if (fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+}
+
+int64_t CollectorClient::get_offset_ns() {
+	return offset_ns;
+}
+
+void CollectorClient::sink(const double *record, void *arg) {
+	((CollectorClient*)arg)->add(record);
+}
+
+Aggregator::Aggregator(int port, uint64_t interval_ns, int format) {
+	this->port = port;
+	this->interval_ns = interval_ns > 0 ? interval_ns : 1;
+	listen_fd = -1;
+	start_ns = Deadline::now_ns();
+	next_bin_ns = 0;
+	cluster_energy = 0.0;
+	running = false;
+	complete = false;
+	const char *ext = TraceExtension(format);
+	cluster = new Trace(std::string("power-cluster") + ext, format, TRACE_KIND_NODE);
+	cluster->add_field("time", "s");
+	cluster->add_field("nodes", "", 'i');
+	cluster->add_field("cpu-power", "W");
+	cluster->add_field("dram-power", "W");
+	cluster->add_field("gpu-power", "W");
+	cluster->add_field("total-power", "W");
+	cluster->add_field("total-energy", "J");
+	per_node = new Trace(std::string("power-cluster-nodes") + ext, format, TRACE_KIND_NODE);
+	per_node->add_field("time", "s");
+	per_node->add_field("node", "", 'i');
+	per_node->add_field("cpu-power", "W");
+	per_node->add_field("dram-power", "W");
+	per_node->add_field("gpu-power", "W");
+	per_node->add_field("total-power", "W");
+}
+
+Aggregator::~Aggregator() {
+	finish(0.0);
+	for (node_t *node : nodes) {
+		if (node->fd >= 0) {
+			::close(node->fd);
+		}
+		delete node;
+	}
+	delete cluster;
+	delete per_node;
+}
+
+// Listen on the port and start the aggregator thread, exits if the port is taken
+void Aggregator::start() {
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("Aggregator:socket");
+		exit(EXIT_FAILURE);
+	}
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, COLLECT_MAX_NODES) != 0) {
+		perror("Aggregator:bind");
+		fprintf(stderr, "Trying to listen on port %d\n", port);
+		exit(EXIT_FAILURE);
+	}
+	cluster->set_info(0, 0, interval_ns);
+	per_node->set_info(0, 0, interval_ns);
+	cluster->open();
+	per_node->open();
+	running = true;
+	int code = pthread_create(&thread, NULL, aggregator_func, (void*)this);
+	if (code) {
+		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+		exit(0);
+	}
+	printf("Aggregating node records on port %d\n", port);
+}
+
+void Aggregator::finish(double linger) {
+	if (!running) {
+		return;
+	}
+	uint64_t deadline = Deadline::now_ns() + (uint64_t)(linger * NS_PER_SEC);
+	while (!done() && Deadline::now_ns() < deadline) {
+		usleep(100000);
+	}
+	running = false;
+	pthread_join(thread, NULL);
+	::close(listen_fd);
+	listen_fd = -1;
+	cluster->close();
+	per_node->close();
+}
+
+void Aggregator::accept_node() {
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0) {
+		return;
+	}
+	if (nodes.size() >= COLLECT_MAX_NODES) {
+		::close(fd);
+		return;
+	}
+	node_t *node = new node_t();
+	node->fd = fd;
+	node->ended = false;
+	node->interval_ns = 0;
+	node->last_ns = 0;
+	node->seen_ns = Deadline::now_ns();
+	node->records = 0;
+	memset(&node->last, 0, sizeof(node->last));
+	node->name = "node" + std::to_string(nodes.size());
+	nodes.push_back(node);
+}
+
+// Read what arrived on a node connection and handle every complete message
+bool Aggregator::receive(node_t *node) {
+	char buf[64 * 1024];
+	ssize_t n = recv(node->fd, buf, sizeof(buf), 0);
+	if (n <= 0) {
+		if (n < 0 && errno == EINTR) {
+			return true;
+		}
+		return false;
+	}
+	node->inbuf.insert(node->inbuf.end(), buf, buf + n);
+	size_t off = 0;
+	while (node->inbuf.size() - off >= sizeof(collect_msg_t)) {
+		collect_msg_t msg;
+		memcpy(&msg, node->inbuf.data() + off, sizeof(msg));
+		// a corrupt header would grow inbuf without bound waiting for the rest
+		if (msg.length > COLLECT_MAX_MESSAGE) {
+			fprintf(stderr, "Aggregator: node %s sent a %u byte message, ending the node\n", node->name.c_str(), msg.length);
+			return false;
+		}
+		if (node->inbuf.size() - off - sizeof(msg) < msg.length) {
+			break;
+		}
+		handle(node, msg.type, node->inbuf.data() + off + sizeof(msg), msg.length);
+		off += sizeof(msg) + msg.length;
+	}
+	node->inbuf.erase(node->inbuf.begin(), node->inbuf.begin() + off);
+	return true;
+}
+
+void Aggregator::handle(node_t *node, uint32_t type, const char *payload, uint32_t length) {
+	node->seen_ns = Deadline::now_ns();
+	if (type == COLLECT_HELLO && length == sizeof(collect_hello_t)) {
+		collect_hello_t hello;
+		memcpy(&hello, payload, sizeof(hello));
+		hello.node[COLLECT_NAME_LEN - 1] = '\0';
+		node->name = hello.node;
+		node->interval_ns = hello.interval_ns;
+		printf("Aggregator: node %s connected\n", node->name.c_str());
+	} else if (type == COLLECT_SYNC && length == sizeof(collect_sync_t)) {
+		collect_sync_t s;
+		memcpy(&s, payload, sizeof(s));
+		s.aggregator_ns = Deadline::now_ns();
+		collect_msg_t msg = {COLLECT_SYNC, sizeof(s)};
+		if (!write_all(node->fd, &msg, sizeof(msg)) || !write_all(node->fd, &s, sizeof(s))) {
+			node->ended = true;
+		}
+	} else if (type == COLLECT_BATCH && length % sizeof(collect_record_t) == 0) {
+		size_t count = length / sizeof(collect_record_t);
+		for (size_t i = 0; i < count; i++) {
+			collect_record_t rec;
+			memcpy(&rec, payload + i * sizeof(rec), sizeof(rec));
+			node->queue.push_back(rec);
+			node->last = rec;
+			node->last_ns = rec.t_ns;
+		}
+		node->records += count;
+	} else if (type == COLLECT_BYE) {
+		node->ended = true;
+	}
+}
+
+/*
+Write every bin whose end is covered by all the live nodes. The power of a node
+in a bin is the dt-weighted mean of its records ending in the bin, or the record
+that spans the whole bin when it samples slower than the bin interval.
+*/
+void Aggregator::emit_bins(bool flush) {
+	uint64_t now = Deadline::now_ns();
+	uint64_t watermark = ~0ULL, newest = 0;
+	bool live = false;
+	for (node_t *node : nodes) {
+		newest = node->last_ns > newest ? node->last_ns : newest;
+		// nodes still waiting for their first batch hold the bins back too, a silent node does not
+		if (!node->ended && now - node->seen_ns < COLLECT_STALL_SECS * NS_PER_SEC) {
+			watermark = node->last_ns < watermark ? node->last_ns : watermark;
+			live = true;
+		}
+	}
+	if (newest == 0) {
+		return;
+	}
+	if (flush || !live) {
+		watermark = newest;
+	}
+	if (next_bin_ns == 0) {
+		uint64_t first = ~0ULL;
+		for (node_t *node : nodes) {
+			if (!node->queue.empty() && node->queue.front().t_ns < first) {
+				first = node->queue.front().t_ns;
+			}
+		}
+		uint64_t since = first > start_ns ? first - start_ns : 0;
+		next_bin_ns = start_ns + (since / interval_ns + 1) * interval_ns;
+	}
+	while (next_bin_ns <= watermark) {
+		uint64_t t = next_bin_ns;
+		double cpu = 0.0, dram = 0.0, gpu = 0.0;
+		int active = 0;
+		for (size_t k = 0; k < nodes.size(); k++) {
+			node_t *node = nodes[k];
+			double e[3] = {0.0, 0.0, 0.0}, secs = 0.0, p[3] = {0.0, 0.0, 0.0};
+			while (!node->queue.empty() && node->queue.front().t_ns <= t) {
+				const collect_record_t &rec = node->queue.front();
+				e[0] += rec.cpu_power * rec.dt;
+				e[1] += rec.dram_power * rec.dt;
+				e[2] += rec.gpu_power * rec.dt;
+				secs += rec.dt;
+				node->queue.pop_front();
+			}
+			if (secs > 0.0) {
+				p[0] = e[0]/secs; p[1] = e[1]/secs; p[2] = e[2]/secs;
+			} else if (!node->queue.empty() &&
+			           node->queue.front().t_ns - (uint64_t)(node->queue.front().dt * NS_PER_SEC) <= t) {
+				const collect_record_t &rec = node->queue.front();
+				p[0] = rec.cpu_power; p[1] = rec.dram_power; p[2] = rec.gpu_power;
+			} else {
+				// not started yet or already gone
+				continue;
+			}
+			active++;
+			cpu += p[0]; dram += p[1]; gpu += p[2];
+			double *r = per_node->record();
+			if (r != NULL) {
+				r[0] = (t - start_ns)/1e9; r[1] = k; r[2] = p[0]; r[3] = p[1]; r[4] = p[2];
+				r[5] = p[0] + p[1] + p[2];
+				per_node->commit();
+			}
+		}
+		cluster_energy += (cpu + dram + gpu) * interval_ns/1e9;
+		double *r = cluster->record();
+		if (r != NULL) {
+			r[0] = (t - start_ns)/1e9; r[1] = active; r[2] = cpu; r[3] = dram; r[4] = gpu;
+			r[5] = cpu + dram + gpu; r[6] = cluster_energy;
+			cluster->commit();
+		}
+		next_bin_ns += interval_ns;
+	}
+}
+
+bool Aggregator::all_ended() {
+	for (node_t *node : nodes) {
+		if (!node->ended) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// True once at least one node connected and all of them said goodbye
+bool Aggregator::done() {
+	return complete.load(std::memory_order_acquire);
+}
+
+void *Aggregator::aggregator_func(void *ptr) {
+	Aggregator *agg = (Aggregator*)ptr;
+	std::vector<struct pollfd> fds;
+	std::vector<node_t*> polled;
+	affinity_apply(false);
+	while (agg->running.load(std::memory_order_acquire)) {
+		fds.clear();
+		polled.clear();
+		fds.push_back({agg->listen_fd, POLLIN, 0});
+		for (node_t *node : agg->nodes) {
+			if (!node->ended && node->fd >= 0) {
+				fds.push_back({node->fd, POLLIN, 0});
+				polled.push_back(node);
+			}
+		}
+		if (poll(fds.data(), fds.size(), 100) > 0) {
+			for (size_t i = 1; i < fds.size(); i++) {
+				if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) && !agg->receive(polled[i-1])) {
+					polled[i-1]->ended = true;
+				}
+			}
+			if (fds[0].revents & POLLIN) {
+				agg->accept_node();
+			}
+		}
+		agg->emit_bins(false);
+		if (!agg->nodes.empty() && agg->all_ended()) {
+			agg->complete.store(true, std::memory_order_release);
+		}
+	}
+	agg->emit_bins(true);
+	pthread_exit(0);
+}
+
+// Energy of every node over its own sampling run, from its cumulative counters
+void Aggregator::summary(FILE *fp) {
+	double cpu = 0.0, dram = 0.0, gpu = 0.0;
+	fprintf(fp, "\nCluster summary (%zu nodes):\n", nodes.size());
+	fprintf(fp, "  %-24s %10s %14s %14s %14s %14s\n", "node", "records", "cpu J", "dram J", "gpu J", "total J");
+	for (node_t *node : nodes) {
+		const collect_record_t &l = node->last;
+		fprintf(fp, "  %-24s %10lu %14.3f %14.3f %14.3f %14.3f%s\n", node->name.c_str(), node->records,
+		        l.cpu_energy, l.dram_energy, l.gpu_energy, l.cpu_energy + l.dram_energy + l.gpu_energy,
+		        node->ended ? "" : "   (did not finish)");
+		cpu += l.cpu_energy;
+		dram += l.dram_energy;
+		gpu += l.gpu_energy;
+	}
+	fprintf(fp, "  %-24s %10s %14.3f %14.3f %14.3f %14.3f\n", "total", "", cpu, dram, gpu, cpu + dram + gpu);
+	fprintf(fp, "Cluster trace energy: %f J (binned every %.3f ms)\n", cluster_energy, interval_ns/1e6);
+}
+
+int collect_mpi_rank(int *local_rank) {
+	const char *ranks[] = {"OMPI_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK", "SLURM_PROCID", NULL};
+	const char *locals[] = {"OMPI_COMM_WORLD_LOCAL_RANK", "MPI_LOCALRANKID", "PMI_LOCAL_RANK", "SLURM_LOCALID", NULL};
+	int rank = -1;
+	*local_rank = -1;
+	for (int i = 0; ranks[i] != NULL && rank < 0; i++) {
+		if (getenv(ranks[i]) != NULL) {
+			rank = atoi(getenv(ranks[i]));
+		}
+	}
+	for (int i = 0; locals[i] != NULL && *local_rank < 0; i++) {
+		if (getenv(locals[i]) != NULL) {
+			*local_rank = atoi(getenv(locals[i]));
+		}
+	}
+	if (rank >= 0 && *local_rank < 0) {
+		// no local rank exported, assume one rank per node
+		*local_rank = 0;
+	}
+	return rank;
+}
@@ -0,0 +1,153 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "Trace.h"
+
+#ifndef COLLECTOR_H_
+#define COLLECTOR_H_
+
+#define COLLECT_VERSION        1
+#define COLLECT_NAME_LEN       64
+#define COLLECT_MAX_NODES      1024
+#define COLLECT_BATCH_RECORDS  256
+#define COLLECT_BATCH_MS       1000
+#define COLLECT_SYNC_ROUNDS    8
+#define COLLECT_CONNECT_SECS   30
+#define COLLECT_STALL_SECS     5
+#define COLLECT_LINGER_SECS    10
+
+// message types, every message is a collect_msg_t followed by length bytes
+#define COLLECT_HELLO          1
+#define COLLECT_SYNC           2
+#define COLLECT_BATCH          3
+#define COLLECT_BYE            4
+// largest message length a node sends, a full BATCH
+#define COLLECT_MAX_MESSAGE    (COLLECT_BATCH_RECORDS * sizeof(collect_record_t))
+
+struct collect_msg_t {
+	uint32_t type;
+	uint32_t length;
+};
+
+struct collect_hello_t {
+	uint32_t version;
+	uint32_t pad;
+	uint64_t interval_ns;
+	char node[COLLECT_NAME_LEN];
+};
+
+// node send time and, in the reply, the aggregator time (CLOCK_MONOTONIC ns)
+struct collect_sync_t {
+	uint64_t node_ns;
+	uint64_t aggregator_ns;
+};
+
+// One unified sample, already on the aggregator time base; a BATCH is n of these
+struct collect_record_t {
+	uint64_t t_ns;
+	float dt;
+	float cpu_power;
+	float dram_power;
+	float gpu_power;
+	double cpu_energy;
+	double dram_energy;
+	double gpu_energy;
+};
+
+/*
+Node side. Connects to the aggregator, estimates the clock offset with a few
+request/reply rounds (the reply with the shortest round trip wins) and then
+streams the unified sampler records in binary batches from the trace writer
+thread, so the sampler never touches the network.
+*/
+class CollectorClient {
+
+private:
+	int fd;
+	int64_t offset_ns;
+	uint64_t rtt_ns;
+	std::vector<collect_record_t> batch;
+	uint64_t batch_ns;
+
+	bool send_msg(uint32_t type, const void *payload, uint32_t length);
+	void sync();
+	void flush();
+
+public:
+	CollectorClient(const char *host, int port, const char *node, uint64_t interval_ns);
+	~CollectorClient();
+	void add(const double *record);
+	void close();
+	int64_t get_offset_ns();
+
+	// Trace sink of the unified sampler records
+	static void sink(const double *record, void *arg);
+};
+
+/*
+Rank 0 side. Receives the records of every node and emits, on its own clock,
+power-cluster.* (cluster totals per bin of interval_ns) and
+power-cluster-nodes.* (one row per node per bin), then a per-node energy
+summary. A bin is written once every live node has sent data past its end.
+*/
+class Aggregator {
+
+private:
+	struct node_t {
+		std::string name;
+		int fd;
+		bool ended;
+		uint64_t interval_ns;
+		uint64_t last_ns;
+		uint64_t seen_ns;
+		unsigned long records;
+		collect_record_t last;
+		std::deque<collect_record_t> queue;
+		std::vector<char> inbuf;
+	};
+
+	int port;
+	int listen_fd;
+	uint64_t interval_ns;
+	uint64_t start_ns;
+	uint64_t next_bin_ns;
+	double cluster_energy;
+	std::vector<node_t*> nodes;
+	Trace *cluster;
+	Trace *per_node;
+	std::atomic<bool> running;
+	// every node that connected has said goodbye
+	std::atomic<bool> complete;
+	pthread_t thread;
+
+	void accept_node();
+	bool receive(node_t *node);
+	void handle(node_t *node, uint32_t type, const char *payload, uint32_t length);
+	void emit_bins(bool flush);
+	bool all_ended();
+	static void *aggregator_func(void *ptr);
+
+public:
+	Aggregator(int port, uint64_t interval_ns, int format);
+	~Aggregator();
+	void start();
+	// wait up to linger seconds for the nodes to finish, then write the last bins
+	void finish(double linger);
+	bool done();
+	// only after finish()
+	void summary(FILE *fp);
+};
+
+// Global and node-local rank from the mpirun/srun environment, -1 when not launched by one
+int collect_mpi_rank(int *local_rank);
+
+#endif /* COLLECTOR_H_ */
@@ -0,0 +1,287 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cmath>
+#include <cstring>
+#include <time.h>
+
+#include "Columnar.h"
+
+// 10^k for decimal quantities, 2^14/2^16 for the Intel/AMD RAPL energy units
+const double columnar_scales[] = {1.0, 1e3, 1e6, 1e9, 16384.0, 65536.0};
+const int columnar_n_scales = sizeof(columnar_scales)/sizeof(columnar_scales[0]);
+
+static inline uint64_t zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+	uint64_t r = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		r |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static inline uint64_t bits_of(double v) {
+	uint64_t b;
+	memcpy(&b, &v, sizeof(b));
+	return b;
+}
+
+static inline double double_of(uint64_t b) {
+	double v;
+	memcpy(&v, &b, sizeof(v));
+	return v;
+}
+
+// Smallest scale that represents every value exactly as an integer, -1 if none does
+static int find_scale(const double *values, uint32_t n) {
+	for (int s = 0; s < columnar_n_scales; s++) {
+		double scale = columnar_scales[s];
+		uint32_t i = 0;
+		for (; i < n; i++) {
+			double q = values[i] * scale;
+			// compared as bits, so -0.0 does not pass as the integer 0
+			if (!(fabs(q) < 9007199254740992.0) || bits_of((double)llround(q) / scale) != bits_of(values[i])) {
+				break;
+			}
+		}
+		if (i == n) {
+			return s;
+		}
+	}
+	return -1;
+}
+
+uint32_t columnar_encode(const double *values, uint32_t n, columnar_column_t *col, uint8_t *out) {
+	uint8_t *p = out;
+	memset(col, 0, sizeof(*col));
+	// range of the values that are not NaN, NaN when there are none
+	col->min = n > 0 ? NAN : 0.0;
+	col->max = col->min;
+	for (uint32_t i = 0; i < n; i++) {
+		col->min = values[i] < col->min || std::isnan(col->min) ? values[i] : col->min;
+		col->max = values[i] > col->max || std::isnan(col->max) ? values[i] : col->max;
+	}
+	int s = find_scale(values, n);
+	if (s >= 0) {
+		double scale = columnar_scales[s];
+		int64_t prev = 0, delta = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			int64_t q = llround(values[i] * scale);
+			int64_t d = q - prev;
+			p = put_varint(p, zigzag(i == 0 ? q : d - delta));
+			delta = i == 0 ? 0 : d;
+			prev = q;
+		}
+		col->encoding = COLUMNAR_SCALED;
+		col->scale = s;
+	} else {
+		uint64_t prev = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			uint64_t b = bits_of(values[i]);
+			p = put_varint(p, b ^ prev);
+			prev = b;
+		}
+		col->encoding = COLUMNAR_XOR;
+		if ((size_t)(p - out) > n * sizeof(double)) {
+			memcpy(out, values, n * sizeof(double));
+			p = out + n * sizeof(double);
+			col->encoding = COLUMNAR_RAW;
+		}
+	}
+	col->bytes = p - out;
+	return col->bytes;
+}
+
+bool columnar_decode(const uint8_t *data, const columnar_column_t *col, uint32_t n, double *out) {
+	const uint8_t *p = data, *end = data + col->bytes;
+	uint64_t v;
+	if (col->encoding == COLUMNAR_RAW) {
+		if (col->bytes != n * sizeof(double)) {
+			return false;
+		}
+		memcpy(out, data, col->bytes);
+		return true;
+	}
+	if (col->encoding == COLUMNAR_SCALED) {
+		if (col->scale >= columnar_n_scales) {
+			return false;
+		}
+		double scale = columnar_scales[col->scale];
+		int64_t q = 0, delta = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			if ((p = get_varint(p, end, &v)) == NULL) {
+				return false;
+			}
+			if (i == 0) {
+				q = unzigzag(v);
+			} else {
+				delta += unzigzag(v);
+				q += delta;
+			}
+			out[i] = (double)q / scale;
+		}
+		return p == end;
+	}
+	if (col->encoding == COLUMNAR_XOR) {
+		uint64_t prev = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			if ((p = get_varint(p, end, &v)) == NULL) {
+				return false;
+			}
+			prev ^= v;
+			out[i] = double_of(prev);
+		}
+		return p == end;
+	}
+	return false;
+}
+
+struct crc32_table_t {
+	uint32_t entry[256];
+
+	crc32_table_t() {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			entry[i] = c;
+		}
+	}
+};
+
+uint32_t columnar_crc32(const uint8_t *data, size_t len, uint32_t crc) {
+	// a function-local static is built once even when the CPU and GPU writers start together
+	static const crc32_table_t table;
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) {
+		crc = table.entry[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+ColumnarWriter::ColumnarWriter(FILE *fp, uint32_t n_fields) {
+	this->fp = fp;
+	this->n_fields = n_fields;
+	count = 0;
+	chunk_ns = now_ns();
+	columns.resize((size_t)n_fields * COLUMNAR_CHUNK_RECORDS);
+	out.resize(sizeof(columnar_chunk_t) + n_fields * (sizeof(columnar_column_t) + 10 * COLUMNAR_CHUNK_RECORDS + 10));
+	// the CRC table is built before the first chunk, not in the middle of a run
+	columnar_crc32(NULL, 0);
+}
+
+uint64_t ColumnarWriter::now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void ColumnarWriter::add(const double *record) {
+	for (uint32_t k = 0; k < n_fields; k++) {
+		columns[(size_t)k * COLUMNAR_CHUNK_RECORDS + count] = record[k];
+	}
+	count++;
+	if (count == COLUMNAR_CHUNK_RECORDS || now_ns() - chunk_ns >= COLUMNAR_CHUNK_SECS * 1000000000ULL) {
+		flush();
+	}
+}
+
+void ColumnarWriter::flush() {
+	if (count > 0) {
+		columnar_chunk_t *chunk = (columnar_chunk_t*)out.data();
+		columnar_column_t *table = (columnar_column_t*)(out.data() + sizeof(columnar_chunk_t));
+		uint8_t *p = (uint8_t*)(table + n_fields);
+		for (uint32_t k = 0; k < n_fields; k++) {
+			p += columnar_encode(&columns[(size_t)k * COLUMNAR_CHUNK_RECORDS], count, &table[k], p);
+		}
+		chunk->magic = COLUMNAR_CHUNK_MAGIC;
+		chunk->n_records = count;
+		chunk->n_columns = n_fields;
+		chunk->payload = p - (uint8_t*)table;
+		chunk->crc = columnar_crc32((uint8_t*)table, chunk->payload);
+		fwrite(out.data(), 1, p - out.data(), fp);
+		fflush(fp);
+	}
+	count = 0;
+	chunk_ns = now_ns();
+}
+
+ColumnarReader::ColumnarReader(FILE *fp, uint32_t n_fields) {
+	this->fp = fp;
+	this->n_fields = n_fields;
+	memset(&chunk, 0, sizeof(chunk));
+	damaged = false;
+	offsets.resize(n_fields);
+}
+
+bool ColumnarReader::next() {
+	memset(&chunk, 0, sizeof(chunk));
+	damaged = false;
+	size_t got = fread(&chunk, 1, sizeof(chunk), fp);
+	// only a read that gets nothing is the end of the file, a partial header is a torn chunk
+	if (got != sizeof(chunk)) {
+		damaged = got > 0;
+		return false;
+	}
+	damaged = true;
+	if (chunk.magic != COLUMNAR_CHUNK_MAGIC || chunk.n_columns != n_fields ||
+	    chunk.payload < n_fields * sizeof(columnar_column_t) || chunk.payload > (1ULL << 32)) {
+		return false;
+	}
+	payload.resize(chunk.payload);
+	if (fread(payload.data(), 1, chunk.payload, fp) != chunk.payload ||
+	    columnar_crc32(payload.data(), chunk.payload) != chunk.crc) {
+		return false;
+	}
+	uint64_t off = n_fields * sizeof(columnar_column_t);
+	for (uint32_t k = 0; k < n_fields; k++) {
+		offsets[k] = off;
+		off += column_info(k)->bytes;
+	}
+	if (off != chunk.payload) {
+		return false;
+	}
+	damaged = false;
+	return true;
+}
+
+// True when the last next() stopped at a damaged chunk rather than at the end of the file
+bool ColumnarReader::torn() {
+	return damaged;
+}
+
+uint32_t ColumnarReader::records() {
+	return chunk.n_records;
+}
+
+const columnar_column_t *ColumnarReader::column_info(uint32_t k) {
+	return (const columnar_column_t*)payload.data() + k;
+}
+
+bool ColumnarReader::column(uint32_t k, double *out) {
+	return k < n_fields && columnar_decode(payload.data() + offsets[k], column_info(k), chunk.n_records, out);
+}
@@ -0,0 +1,120 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#ifndef COLUMNAR_H_
+#define COLUMNAR_H_
+
+#define COLUMNAR_MAGIC          "PWRMONC\1"
+#define COLUMNAR_CHUNK_MAGIC    0x4b4e4843u
+#define COLUMNAR_CHUNK_RECORDS  4096
+// a chunk is also closed after this long, so slow intervals still reach the disk
+#define COLUMNAR_CHUNK_SECS     10
+
+// column encodings
+#define COLUMNAR_XOR            0
+#define COLUMNAR_SCALED         1
+#define COLUMNAR_RAW            2
+
+/*
+Columnar trace layout: a trace_header_t with COLUMNAR_MAGIC and the field
+descriptors, as in the binary layout, then self-contained chunks of up to
+COLUMNAR_CHUNK_RECORDS records:
+
+    columnar_chunk_t | n_columns columnar_column_t | column 0 bytes | column 1 bytes | ...
+
+Every column is encoded on its own and the table gives its size, so a reader
+can decode only the columns it needs (powermon analyze does), and min/max give
+the range of every column in the chunk. A chunk is written with one fwrite and
+flushed, the CRC makes a chunk torn by a crash detectable; everything before it
+stays readable.
+
+COLUMNAR_SCALED: all values are exact multiples of 1/scale (timestamps in ns,
+step and work counters, RAPL energy in 2^-14 J units...), stored as the
+zigzag varint of the first integer and then of the delta of the deltas, about
+a byte per value for a counter at a steady rate. COLUMNAR_XOR: IEEE bits XOR
+the previous value as a varint, small when neighbours share sign, exponent and
+the high mantissa bits. COLUMNAR_RAW when neither is smaller than 8 bytes.
+*/
+struct columnar_chunk_t {
+	uint32_t magic;
+	uint32_t n_records;
+	uint32_t n_columns;
+	// CRC-32 of everything after this header
+	uint32_t crc;
+	uint64_t payload;
+};
+
+struct columnar_column_t {
+	uint32_t bytes;
+	uint8_t encoding;
+	uint8_t scale;
+	uint16_t pad;
+	double min;
+	double max;
+};
+
+extern const double columnar_scales[];
+extern const int columnar_n_scales;
+
+// Encode n values into out (at least 10*n + 10 bytes), fills col and returns the bytes written
+uint32_t columnar_encode(const double *values, uint32_t n, columnar_column_t *col, uint8_t *out);
+// Decode one column of n values, false if the data is inconsistent with col
+bool columnar_decode(const uint8_t *data, const columnar_column_t *col, uint32_t n, double *out);
+uint32_t columnar_crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+/*
+Chunk builder used by the Trace writer thread: records are transposed into
+preallocated column buffers and written as a chunk when it is full or old.
+*/
+class ColumnarWriter {
+
+private:
+	FILE *fp;
+	uint32_t n_fields;
+	uint32_t count;
+	uint64_t chunk_ns;
+	std::vector<double> columns;
+	std::vector<uint8_t> out;
+
+	static uint64_t now_ns();
+
+public:
+	ColumnarWriter(FILE *fp, uint32_t n_fields);
+	void add(const double *record);
+	// write the buffered records as one chunk
+	void flush();
+};
+
+/*
+Sequential reader of the chunks after the header, used by powermon dump.
+next() reads and CRC checks a whole chunk, all columns included, and column()
+decodes a column from it into doubles.
+*/
+class ColumnarReader {
+
+private:
+	FILE *fp;
+	uint32_t n_fields;
+	columnar_chunk_t chunk;
+	std::vector<uint8_t> payload;
+	std::vector<uint32_t> offsets;
+	// the last next() failed on a short or corrupt chunk
+	bool damaged;
+
+public:
+	ColumnarReader(FILE *fp, uint32_t n_fields);
+	// false at the end of the file or at a torn/corrupt chunk (torn() tells which)
+	bool next();
+	bool torn();
+	uint32_t records();
+	const columnar_column_t *column_info(uint32_t k);
+	bool column(uint32_t k, double *out);
+};
+
+#endif /* COLUMNAR_H_ */
@@ -0,0 +1,72 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cerrno>
+
+#include "Deadline.h"
+
+Deadline::Deadline(uint64_t period_ns) {
+	this->period_ns = period_ns > 0 ? period_ns : 1;
+	start();
+}
+
+// (Re)start the schedule, the first deadline is one period from now
+void Deadline::start() {
+	last_ns = now_ns();
+	next_ns = last_ns + period_ns;
+	ticks = 0;
+	missed = 0;
+	jitter.reset();
+}
+
+// Sleep until the next absolute deadline, returns the wake up time in ns
+uint64_t Deadline::wait() {
+	struct timespec ts;
+	ts.tv_sec = next_ns / NS_PER_SEC;
+	ts.tv_nsec = next_ns % NS_PER_SEC;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	last_ns = now_ns();
+	jitter.add((double)(int64_t)(last_ns - next_ns)/1000.0);
+	ticks++;
+	next_ns += period_ns;
+	// we woke up after one or more of the following deadlines already passed
+	if (last_ns >= next_ns) {
+		uint64_t late = (last_ns - next_ns) / period_ns + 1;
+		missed += late;
+		next_ns += late * period_ns;
+	}
+	return last_ns;
+}
+
+uint64_t Deadline::period() {
+	return period_ns;
+}
+
+void Deadline::set_period(uint64_t period_ns) {
+	if (period_ns == 0 || period_ns == this->period_ns) {
+		return;
+	}
+	this->period_ns = period_ns;
+	next_ns = last_ns + period_ns;
+}
+
+unsigned long Deadline::get_ticks() {
+	return ticks;
+}
+
+unsigned long Deadline::get_missed() {
+	return missed;
+}
+
+Stats Deadline::get_jitter() {
+	return jitter;
+}
+
+uint64_t Deadline::now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
@@ -0,0 +1,50 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <time.h>
+
+#include "Stats.h"
+
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+#define NS_PER_SEC 1000000000ULL
+
+/*
+Periodic scheduler driven by absolute deadlines on CLOCK_MONOTONIC.
+Each deadline is computed from the start time, never from the time the
+previous sample finished, so the sampling work does not make the period drift.
+When a tick overruns one or more whole periods the skipped deadlines are
+counted as missed and the schedule continues at the next future deadline.
+The lateness of every wake up is kept as the timing jitter of the sampler.
+*/
+class Deadline {
+
+private:
+	uint64_t period_ns;
+	uint64_t next_ns;
+	uint64_t last_ns;
+	unsigned long ticks;
+	unsigned long missed;
+	// how late each wake up was, in microseconds
+	Stats jitter;
+
+public:
+	Deadline(uint64_t period_ns);
+	void start();
+	uint64_t wait();
+
+	uint64_t period();
+	// change the period, the next deadline is one new period after the last wake up
+	void set_period(uint64_t period_ns);
+	unsigned long get_ticks();
+	unsigned long get_missed();
+	Stats get_jitter();
+
+	static uint64_t now_ns();
+};
+
+#endif /* DEADLINE_H_ */
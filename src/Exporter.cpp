@@ -0,0 +1,202 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "Exporter.h"
+#include "GpuMetrics.h"
+
+static const char *domain_names[SNAPSHOT_DOMAINS] = {"package", "core", "uncore", "dram"};
+
+// printf into buf at off, never past cap; returns the new offset, cap once truncated
+static int emit(char *buf, int off, int cap, const char *fmt, ...) {
+	if (off >= cap) {
+		return cap;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf + off, cap - off, fmt, args);
+	va_end(args);
+	return n < 0 ? off : (off + n < cap ? off + n : cap);
+}
+
+Exporter::Exporter(int port, const power_snapshot_t *snap) {
+	this->port = port;
+	this->snap = snap;
+	listen_fd = -1;
+	running = false;
+	buffer.resize(EXPORTER_BUFFER);
+}
+
+Exporter::~Exporter() {
+	stop();
+}
+
+// Bind the port and start serving, exits if the port is not available
+void Exporter::start() {
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("Exporter:socket");
+		exit(EXIT_FAILURE);
+	}
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, EXPORTER_BACKLOG) != 0) {
+		perror("Exporter:bind");
+		fprintf(stderr, "Trying to listen on port %d\n", port);
+		exit(EXIT_FAILURE);
+	}
+	running = true;
+	int code = pthread_create(&thread, NULL, server_func, (void*)this);
+	if (code) {
+		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+		exit(0);
+	}
+	printf("Serving metrics on http://0.0.0.0:%d/metrics\n", port);
+}
+
+void Exporter::stop() {
+	if (listen_fd < 0) {
+		return;
+	}
+	running = false;
+	// wakes the server thread up from accept()
+	shutdown(listen_fd, SHUT_RDWR);
+	pthread_join(thread, NULL);
+	close(listen_fd);
+	listen_fd = -1;
+}
+
+// Render the metrics page into buffer, returns its length or -1 if it did not fit
+int Exporter::render() {
+	snapshot_values_t v;
+	snapshot_read(snap, &v);
+	const snapshot_info_t *info = &snap->info;
+	char *buf = buffer.data();
+	int cap = buffer.size();
+	int n = 0;
+
+	n = emit(buf, n, cap, "# HELP powermon_cpu_power_watts Current RAPL power of each domain, summed over sockets.\n"
+	                      "# TYPE powermon_cpu_power_watts gauge\n");
+	for (int d = 0; d < SNAPSHOT_DOMAINS; d++) {
+		if (info->domain_mask & (1u << d)) {
+			n = emit(buf, n, cap, "powermon_cpu_power_watts{domain=\"%s\"} %.6f\n", domain_names[d], v.cpu_power[d]);
+		}
+	}
+	n = emit(buf, n, cap, "# HELP powermon_cpu_energy_joules_total RAPL energy of each domain since powermon started.\n"
+	                      "# TYPE powermon_cpu_energy_joules_total counter\n");
+	for (int d = 0; d < SNAPSHOT_DOMAINS; d++) {
+		if (info->domain_mask & (1u << d)) {
+			n = emit(buf, n, cap, "powermon_cpu_energy_joules_total{domain=\"%s\"} %.6f\n", domain_names[d], v.cpu_energy[d]);
+		}
+	}
+	n = emit(buf, n, cap, "# HELP powermon_gpu_power_watts Current power of each GPU.\n"
+	                      "# TYPE powermon_gpu_power_watts gauge\n");
+	for (uint32_t g = 0; g < info->n_gpus; g++) {
+		n = emit(buf, n, cap, "powermon_gpu_power_watts{gpu=\"%u\",name=\"%s\"} %.6f\n",
+		         info->gpu_index[g], info->gpu_name[g], v.gpu_power[g]);
+	}
+	n = emit(buf, n, cap, "# HELP powermon_gpu_energy_joules_total Energy of each GPU since powermon started.\n"
+	                      "# TYPE powermon_gpu_energy_joules_total counter\n");
+	for (uint32_t g = 0; g < info->n_gpus; g++) {
+		n = emit(buf, n, cap, "powermon_gpu_energy_joules_total{gpu=\"%u\",name=\"%s\"} %.6f\n",
+		         info->gpu_index[g], info->gpu_name[g], v.gpu_energy[g]);
+	}
+	for (uint32_t k = 0; k < info->n_metrics; k++) {
+		const gpu_metric_t *m = &gpu_metric_table[info->metric_id[k]];
+		n = emit(buf, n, cap, "# HELP powermon_gpu_%s %s\n# TYPE powermon_gpu_%s gauge\n", m->prom, m->help, m->prom);
+		for (uint32_t g = 0; g < info->n_gpus; g++) {
+			n = emit(buf, n, cap, "powermon_gpu_%s{gpu=\"%u\",name=\"%s\"} %.6f\n",
+			         m->prom, info->gpu_index[g], info->gpu_name[g], v.gpu_metric[g][k]);
+		}
+	}
+	if (v.n_procs > 0) {
+		n = emit(buf, n, cap, "# HELP powermon_gpu_process_energy_joules_total GPU energy billed to each process by its SM utilization share.\n"
+		                      "# TYPE powermon_gpu_process_energy_joules_total counter\n");
+	}
+	for (uint32_t k = 0; k < v.n_procs; k++) {
+		uint32_t g = v.proc_gpu[k];
+		n = emit(buf, n, cap, "powermon_gpu_process_energy_joules_total{gpu=\"%u\",pid=\"%u\",comm=\"%.*s\"} %.6f\n",
+		         info->gpu_index[g], v.proc_pid[k], SNAPSHOT_PROC_NAME, v.proc_name[k], v.proc_energy[k]);
+	}
+	n = emit(buf, n, cap, "# HELP powermon_samples_total Samples taken.\n"
+	                      "# TYPE powermon_samples_total counter\n"
+	                      "powermon_samples_total %llu\n"
+	                      "# HELP powermon_missed_deadlines_total Sampling deadlines that were overrun.\n"
+	                      "# TYPE powermon_missed_deadlines_total counter\n"
+	                      "powermon_missed_deadlines_total %llu\n"
+	                      "# HELP powermon_sample_interval_seconds Configured sampling interval.\n"
+	                      "# TYPE powermon_sample_interval_seconds gauge\n"
+	                      "powermon_sample_interval_seconds %.9f\n"
+	                      "# HELP powermon_last_sample_timestamp_seconds Wall clock time of the newest sample.\n"
+	                      "# TYPE powermon_last_sample_timestamp_seconds gauge\n"
+	                      "powermon_last_sample_timestamp_seconds %.6f\n",
+	         (unsigned long long)v.samples, (unsigned long long)v.missed, info->interval_ns/1e9, v.realtime_ns/1e9);
+	return n < cap ? n : -1;
+}
+
+// Answer one request and close the connection
+void Exporter::serve(int fd) {
+	char request[1024];
+	char header[256];
+	// a client that connects and says nothing must not hold up the next scrape
+	struct timeval tv;
+	tv.tv_sec = EXPORTER_TIMEOUT_MS / 1000;
+	tv.tv_usec = (EXPORTER_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	ssize_t len = recv(fd, request, sizeof(request) - 1, 0);
+	if (len <= 0) {
+		return;
+	}
+	request[len] = '\0';
+	if (strncmp(request, "GET /metrics", 12) != 0) {
+		const char *notfound = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		send(fd, notfound, strlen(notfound), MSG_NOSIGNAL);
+		return;
+	}
+	int body = render();
+	if (body < 0) {
+		const char *overflow = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		fprintf(stderr, "Exporter: metrics page larger than %d bytes\n", EXPORTER_BUFFER);
+		send(fd, overflow, strlen(overflow), MSG_NOSIGNAL);
+		return;
+	}
+	int hlen = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+	                    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+	                    "Content-Length: %d\r\nConnection: close\r\n\r\n", body);
+	send(fd, header, hlen, MSG_NOSIGNAL | MSG_MORE);
+	send(fd, buffer.data(), body, MSG_NOSIGNAL);
+}
+
+void *Exporter::server_func(void *ptr) {
+	Exporter *exporter = (Exporter*)ptr;
+	while (exporter->running.load(std::memory_order_acquire)) {
+		int fd = accept(exporter->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			break;
+		}
+		exporter->serve(fd);
+		close(fd);
+	}
+	pthread_exit(0);
+}
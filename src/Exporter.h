@@ -0,0 +1,51 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+#include "Snapshot.h"
+
+#ifndef EXPORTER_H_
+#define EXPORTER_H_
+
+// longest series line: metric and label names, a full GPU name and the value
+#define EXPORTER_LINE       (SNAPSHOT_NAME_LEN + 128)
+// every series the snapshot can hold (power, energy and metrics per GPU, processes) plus HELP/TYPE text
+#define EXPORTER_BUFFER     (EXPORTER_LINE * (SNAPSHOT_MAX_GPUS * (SNAPSHOT_MAX_METRICS + 2) + SNAPSHOT_MAX_PROCS) + 16*1024)
+#define EXPORTER_BACKLOG    16
+#define EXPORTER_TIMEOUT_MS 1000
+
+/*
+Minimal HTTP server for Prometheus/OpenMetrics scrapes. GET /metrics renders the
+current snapshot into a preallocated buffer: one seqlock read, O(domains) text
+formatting and no disk I/O. A page that still does not fit (values of absurd
+magnitude) is answered with a 500 rather than cut mid-line. Connections are
+served one at a time by a single thread, which is plenty for a scrape every
+few seconds.
+*/
+class Exporter {
+
+private:
+	int port;
+	int listen_fd;
+	const power_snapshot_t *snap;
+	std::vector<char> buffer;
+	std::atomic<bool> running;
+	pthread_t thread;
+
+	int render();
+	void serve(int fd);
+	static void *server_func(void *ptr);
+
+public:
+	Exporter(int port, const power_snapshot_t *snap);
+	~Exporter();
+	void start();
+	void stop();
+};
+
+#endif /* EXPORTER_H_ */
@@ -0,0 +1,220 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "GpuMetrics.h"
+#include "nvmlPower.hpp"
+
+// metrics whose field id is missing from the installed nvml.h are left out
+const gpu_metric_t gpu_metric_table[] = {
+	{"sm-clock", "MHz", "sm_clock_mhz", "Current SM clock.", 'f', -1, GPU_QUERY_SM_CLOCK, 1.0, false},
+	{"mem-clock", "MHz", "memory_clock_mhz", "Current memory clock.", 'f', -1, GPU_QUERY_MEM_CLOCK, 1.0, false},
+	{"util", "%", "utilization_percent", "Percent of the driver sample period a kernel was running.", 'f', -1, GPU_QUERY_UTIL, 1.0, false},
+	{"mem-util", "%", "memory_utilization_percent", "Percent of the driver sample period device memory was read or written.", 'f', -1, GPU_QUERY_MEM_UTIL, 1.0, false},
+	{"temp", "C", "temperature_celsius", "GPU die temperature.", 'f', -1, GPU_QUERY_TEMP, 1.0, false},
+	{"throttle", "", "clocks_throttle_reasons", "Active clock throttle reasons, nvmlClocksThrottleReason bitmask.", 'i', -1, GPU_QUERY_THROTTLE, 1.0, false},
+	{"mem-temp", "C", "memory_temperature_celsius", "HBM temperature.", 'f', NVML_FI_DEV_MEMORY_TEMP, GPU_QUERY_NONE, 1.0, false},
+#ifdef NVML_FI_DEV_POWER_AVERAGE
+	{"power-avg", "W", "power_average_watts", "Power averaged by the driver over its last second.", 'f', NVML_FI_DEV_POWER_AVERAGE, GPU_QUERY_NONE, 1e-3, false},
+#endif
+#ifdef NVML_FI_DEV_POWER_INSTANT
+	{"power-now", "W", "power_instant_watts", "Instantaneous power.", 'f', NVML_FI_DEV_POWER_INSTANT, GPU_QUERY_NONE, 1e-3, false},
+#endif
+#ifdef NVML_FI_DEV_PERF_POLICY_POWER
+	{"pcap-time", "frac", "power_cap_throttle_ratio", "Fraction of the interval the clocks were held back by the power cap.", 'f', NVML_FI_DEV_PERF_POLICY_POWER, GPU_QUERY_NONE, 1.0, true},
+#endif
+#ifdef NVML_FI_DEV_PERF_POLICY_THERMAL
+	{"thrm-time", "frac", "thermal_throttle_ratio", "Fraction of the interval the clocks were held back by temperature.", 'f', NVML_FI_DEV_PERF_POLICY_THERMAL, GPU_QUERY_NONE, 1.0, true},
+#endif
+};
+
+const int gpu_metric_count = sizeof(gpu_metric_table)/sizeof(gpu_metric_table[0]);
+
+GpuMetrics::GpuMetrics(const std::vector<int> &metrics) {
+	this->metrics = metrics;
+	n_devices = 0;
+	calls = 0;
+}
+
+bool GpuMetrics::parse(const char *list, std::vector<int> &metrics) {
+	std::string s(list);
+	size_t pos = 0;
+	metrics.clear();
+	if (s == "all") {
+		for (int k = 0; k < gpu_metric_count && k < GPU_MAX_METRICS; k++) {
+			metrics.push_back(k);
+		}
+		return true;
+	}
+	while (pos <= s.size()) {
+		size_t end = s.find(',', pos);
+		if (end == std::string::npos) {
+			end = s.size();
+		}
+		std::string name = s.substr(pos, end - pos);
+		int k = 0;
+		while (k < gpu_metric_count && name != gpu_metric_table[k].name) {
+			k++;
+		}
+		if (k == gpu_metric_count || metrics.size() >= GPU_MAX_METRICS) {
+			return false;
+		}
+		metrics.push_back(k);
+		pos = end + 1;
+	}
+	return !metrics.empty();
+}
+
+/*
+Build the batched field request of every device and check which metrics it
+supports: a field that fails falls back to the dedicated call when there is one,
+a metric with neither stays at 0 for that device.
+*/
+void GpuMetrics::init(const nvmlDevice_t *devices, unsigned int n, const unsigned int *index) {
+	int nm = metrics.size();
+	n_devices = n;
+	this->devices.assign(devices, devices + n);
+	fields.assign(n, std::vector<nvmlFieldValue_t>());
+	field_metric.assign(n, std::vector<int>());
+	via_query.assign(n * nm, 0);
+	supported.assign(n * nm, 0);
+	values.assign(n * nm, 0.0);
+	last_raw.assign(n * nm, -1.0);
+	for (unsigned int d = 0; d < n; d++) {
+		std::vector<nvmlFieldValue_t> probe;
+		std::vector<int> probe_metric;
+		for (int k = 0; k < nm; k++) {
+			const gpu_metric_t *m = &gpu_metric_table[metrics[k]];
+			if (m->field >= 0) {
+				nvmlFieldValue_t f;
+				memset(&f, 0, sizeof(f));
+				f.fieldId = m->field;
+				probe.push_back(f);
+				probe_metric.push_back(k);
+			}
+		}
+		if (!probe.empty() && nvmlDeviceGetFieldValues(devices[d], probe.size(), probe.data()) != NVML_SUCCESS) {
+			for (size_t i = 0; i < probe.size(); i++) {
+				probe[i].nvmlReturn = NVML_ERROR_NOT_SUPPORTED;
+			}
+		}
+		for (size_t i = 0; i < probe.size(); i++) {
+			if (probe[i].nvmlReturn == NVML_SUCCESS) {
+				nvmlFieldValue_t f;
+				memset(&f, 0, sizeof(f));
+				f.fieldId = probe[i].fieldId;
+				fields[d].push_back(f);
+				field_metric[d].push_back(probe_metric[i]);
+				supported[d * nm + probe_metric[i]] = 1;
+			}
+		}
+		nvmlUtilization_t util;
+		bool have_util = false;
+		int missing = 0;
+		for (int k = 0; k < nm; k++) {
+			const gpu_metric_t *m = &gpu_metric_table[metrics[k]];
+			double raw;
+			if (!supported[d * nm + k] && m->query != GPU_QUERY_NONE && query(devices[d], m->query, &raw, &util, &have_util)) {
+				via_query[d * nm + k] = 1;
+				supported[d * nm + k] = 1;
+			}
+			missing += !supported[d * nm + k];
+		}
+		int batched = fields[d].size();
+		printf("GPU %u metrics: %d in one field query, %d by dedicated calls, %d not supported\n",
+		       index[d], batched, nm - batched - missing, missing);
+	}
+}
+
+// One dedicated NVML call, utilization is read once per device and tick for both of its metrics
+bool GpuMetrics::query(nvmlDevice_t dev, int query, double *raw, nvmlUtilization_t *util, bool *have_util) {
+	unsigned int v = 0;
+	unsigned long long mask = 0;
+	nvmlReturn_t res = NVML_ERROR_NOT_SUPPORTED;
+	switch (query) {
+		case GPU_QUERY_SM_CLOCK: res = nvmlDeviceGetClockInfo(dev, NVML_CLOCK_SM, &v); break;
+		case GPU_QUERY_MEM_CLOCK: res = nvmlDeviceGetClockInfo(dev, NVML_CLOCK_MEM, &v); break;
+		case GPU_QUERY_TEMP: res = nvmlDeviceGetTemperature(dev, NVML_TEMPERATURE_GPU, &v); break;
+		case GPU_QUERY_THROTTLE:
+			res = nvmlDeviceGetCurrentClocksThrottleReasons(dev, &mask);
+			*raw = (double)mask;
+			calls++;
+			return res == NVML_SUCCESS;
+		case GPU_QUERY_UTIL:
+		case GPU_QUERY_MEM_UTIL:
+			if (!*have_util) {
+				if (nvmlDeviceGetUtilizationRates(dev, util) != NVML_SUCCESS) {
+					return false;
+				}
+				*have_util = true;
+				calls++;
+			}
+			*raw = query == GPU_QUERY_UTIL ? util->gpu : util->memory;
+			return true;
+	}
+	calls++;
+	*raw = v;
+	return res == NVML_SUCCESS;
+}
+
+void GpuMetrics::store(unsigned int d, int k, double raw, double dt) {
+	int i = d * metrics.size() + k;
+	const gpu_metric_t *m = &gpu_metric_table[metrics[k]];
+	if (!m->delta) {
+		values[i] = raw * m->scale;
+		return;
+	}
+	// counter in ns, the first reading only sets the origin
+	if (last_raw[i] >= 0.0 && dt > 0.0 && raw >= last_raw[i]) {
+		values[i] = (raw - last_raw[i]) / 1e9 / dt;
+	}
+	last_raw[i] = raw;
+}
+
+// Read every selected metric of every device; a failed read keeps the previous value
+void GpuMetrics::sample(double dt) {
+	int nm = metrics.size();
+	calls = 0;
+	for (unsigned int d = 0; d < n_devices; d++) {
+		std::vector<nvmlFieldValue_t> &f = fields[d];
+		if (!f.empty()) {
+			calls++;
+			if (nvmlDeviceGetFieldValues(devices[d], f.size(), f.data()) == NVML_SUCCESS) {
+				for (size_t i = 0; i < f.size(); i++) {
+					if (f[i].nvmlReturn == NVML_SUCCESS) {
+						store(d, field_metric[d][i], nvmlValueToDouble(f[i].valueType, f[i].value), dt);
+					}
+				}
+			}
+		}
+		nvmlUtilization_t util;
+		bool have_util = false;
+		for (int k = 0; k < nm; k++) {
+			double raw;
+			if (via_query[d * nm + k] && query(devices[d], gpu_metric_table[metrics[k]].query, &raw, &util, &have_util)) {
+				store(d, k, raw, dt);
+			}
+		}
+	}
+}
+
+int GpuMetrics::count() {
+	return metrics.size();
+}
+
+const gpu_metric_t *GpuMetrics::metric(int k) {
+	return &gpu_metric_table[metrics[k]];
+}
+
+double GpuMetrics::value(unsigned int d, int k) {
+	return values[d * metrics.size() + k];
+}
+
+unsigned long GpuMetrics::get_calls() {
+	return calls;
+}
@@ -0,0 +1,88 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <vector>
+
+#include "Nvml.h"
+#include "Snapshot.h"
+
+#ifndef GPUMETRICS_H_
+#define GPUMETRICS_H_
+
+// every selected metric also fits the live snapshot
+#define GPU_MAX_METRICS      SNAPSHOT_MAX_METRICS
+
+// dedicated NVML call of a metric, used when it has no field id or the field is not supported
+#define GPU_QUERY_NONE       0
+#define GPU_QUERY_SM_CLOCK   1
+#define GPU_QUERY_MEM_CLOCK  2
+#define GPU_QUERY_UTIL       3
+#define GPU_QUERY_MEM_UTIL   4
+#define GPU_QUERY_TEMP       5
+#define GPU_QUERY_THROTTLE   6
+
+struct gpu_metric_t {
+	// -m name and trace column suffix (gpuN-name)
+	const char *name;
+	const char *unit;
+	// Prometheus name after powermon_gpu_, and its help text
+	const char *prom;
+	const char *help;
+	char type;
+	// NVML field id, -1 when the metric only has a dedicated call
+	int field;
+	int query;
+	// raw value to unit
+	double scale;
+	// cumulative nanosecond counter, reported as the fraction of the interval spent
+	bool delta;
+};
+
+extern const gpu_metric_t gpu_metric_table[];
+extern const int gpu_metric_count;
+
+/*
+Extra per-device GPU metrics sampled next to power. Every selected metric with
+an NVML field id is requested in a single nvmlDeviceGetFieldValues call per
+device and tick; metrics without one (clocks, utilization, GPU temperature and
+throttle reasons have none) use their dedicated call, utilization once for both
+of its metrics. init() probes what every device supports so sample() does not
+allocate or retry.
+*/
+class GpuMetrics {
+
+private:
+	std::vector<int> metrics;
+	unsigned int n_devices;
+	std::vector<nvmlDevice_t> devices;
+	// per device: the batched field request and the metric of each entry
+	std::vector<std::vector<nvmlFieldValue_t>> fields;
+	std::vector<std::vector<int>> field_metric;
+	// per device and metric
+	std::vector<char> via_query;
+	std::vector<char> supported;
+	std::vector<double> values;
+	std::vector<double> last_raw;
+	unsigned long calls;
+
+	bool query(nvmlDevice_t dev, int query, double *raw, nvmlUtilization_t *util, bool *have_util);
+	void store(unsigned int d, int k, double raw, double dt);
+
+public:
+	GpuMetrics(const std::vector<int> &metrics);
+	void init(const nvmlDevice_t *devices, unsigned int n, const unsigned int *index);
+	void sample(double dt);
+
+	int count();
+	const gpu_metric_t *metric(int k);
+	double value(unsigned int d, int k);
+	// driver calls of the last sample(), over all devices
+	unsigned long get_calls();
+
+	// Metric indices of a comma separated list of names, "all" selects every metric; false on an unknown name
+	static bool parse(const char *list, std::vector<int> &metrics);
+};
+
+#endif /* GPUMETRICS_H_ */
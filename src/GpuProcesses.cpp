@@ -0,0 +1,170 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstring>
+
+#include "GpuProcesses.h"
+
+GpuProcesses::GpuProcesses() {
+	n_devices = 0;
+	overflows = 0;
+}
+
+/*
+Size the sample buffer of every device to what the driver keeps, asking with a
+NULL buffer, and at least GPU_MAX_PROCESSES entries. A device that rejects the
+query bills all its energy as unattributed.
+*/
+void GpuProcesses::init(const nvmlDevice_t *devices, unsigned int n, const unsigned int *index) {
+	n_devices = n;
+	this->devices.assign(devices, devices + n);
+	this->index.assign(index, index + n);
+	supported.assign(n, 0);
+	buffers.resize(n);
+	last_ts.assign(n, 0);
+	last_energy.assign(n, 0.0);
+	unattributed.assign(n, 0.0);
+	procs.resize(n);
+	n_procs.assign(n, 0);
+	overflows = 0;
+	for (unsigned int d = 0; d < n; d++) {
+		unsigned int size = 0;
+		nvmlReturn_t res = nvmlDeviceGetProcessUtilization(devices[d], NULL, &size, 0);
+		supported[d] = res == NVML_SUCCESS || res == NVML_ERROR_INSUFFICIENT_SIZE || res == NVML_ERROR_NOT_FOUND;
+		if (!supported[d]) {
+			printf("GPU %u has no per-process utilization, its energy stays unattributed: %s\n", index[d], nvmlErrorString(res));
+		}
+		buffers[d].resize(size > GPU_MAX_PROCESSES ? size : GPU_MAX_PROCESSES);
+		procs[d].resize(GPU_MAX_PROCESSES + 1);
+		memset(procs[d].data(), 0, sizeof(gpu_process_t) * procs[d].size());
+		gpu_process_t *other = &procs[d][GPU_MAX_PROCESSES];
+		strncpy(other->name, "other", GPU_PROCESS_NAME - 1);
+	}
+}
+
+// Account of a pid, created on first sight; the extra entry collects pids past GPU_MAX_PROCESSES
+gpu_process_t *GpuProcesses::account(unsigned int d, unsigned int pid) {
+	std::vector<gpu_process_t> &p = procs[d];
+	for (unsigned int k = 0; k < n_procs[d]; k++) {
+		if (p[k].pid == pid) {
+			return &p[k];
+		}
+	}
+	if (n_procs[d] == GPU_MAX_PROCESSES) {
+		return &p[GPU_MAX_PROCESSES];
+	}
+	gpu_process_t *a = &p[n_procs[d]++];
+	char path[64];
+	a->pid = pid;
+	snprintf(path, sizeof(path), "/proc/%u/comm", pid);
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL || fgets(a->name, sizeof(a->name), fp) == NULL) {
+		strncpy(a->name, "?", GPU_PROCESS_NAME - 1);
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	a->name[strcspn(a->name, "\n")] = '\0';
+	// the name ends up in exporter labels
+	for (char *c = a->name; *c != '\0'; c++) {
+		*c = (*c == '"' || *c == '\\') ? '_' : *c;
+	}
+	return a;
+}
+
+// New shares from the samples since the last call, the old ones stay when there are none
+void GpuProcesses::read_samples(unsigned int d) {
+	unsigned int count = buffers[d].size();
+	nvmlReturn_t res = nvmlDeviceGetProcessUtilization(devices[d], buffers[d].data(), &count, last_ts[d]);
+	if (res == NVML_ERROR_INSUFFICIENT_SIZE) {
+		overflows++;
+		return;
+	}
+	// NOT_FOUND only means nothing new since last_ts
+	if (res != NVML_SUCCESS || count == 0) {
+		return;
+	}
+	std::vector<gpu_process_t> &p = procs[d];
+	for (unsigned int k = 0; k <= GPU_MAX_PROCESSES; k++) {
+		p[k].tick_sm = 0.0;
+	}
+	double total = 0.0;
+	unsigned long long newest = last_ts[d];
+	for (unsigned int i = 0; i < count; i++) {
+		nvmlProcessUtilizationSample_t *s = &buffers[d][i];
+		if (s->timeStamp <= last_ts[d]) {
+			continue;
+		}
+		newest = s->timeStamp > newest ? s->timeStamp : newest;
+		gpu_process_t *a = account(d, s->pid);
+		a->tick_sm += s->smUtil;
+		a->sm += s->smUtil;
+		a->samples++;
+		total += s->smUtil;
+	}
+	if (newest == last_ts[d]) {
+		return;
+	}
+	last_ts[d] = newest;
+	for (unsigned int k = 0; k <= GPU_MAX_PROCESSES; k++) {
+		p[k].share = total > 0.0 ? p[k].tick_sm / total : 0.0;
+	}
+}
+
+void GpuProcesses::sample(const double *energy) {
+	for (unsigned int d = 0; d < n_devices; d++) {
+		double de = energy[d] - last_energy[d];
+		last_energy[d] = energy[d];
+		if (supported[d]) {
+			read_samples(d);
+		}
+		double billed = 0.0;
+		std::vector<gpu_process_t> &p = procs[d];
+		for (unsigned int k = 0; k < n_procs[d]; k++) {
+			p[k].energy += de * p[k].share;
+			billed += p[k].share;
+		}
+		p[GPU_MAX_PROCESSES].energy += de * p[GPU_MAX_PROCESSES].share;
+		billed += p[GPU_MAX_PROCESSES].share;
+		unattributed[d] += de * (billed < 1.0 ? 1.0 - billed : 0.0);
+	}
+}
+
+unsigned int GpuProcesses::count(unsigned int d) {
+	return n_procs[d];
+}
+
+const gpu_process_t *GpuProcesses::process(unsigned int d, unsigned int k) {
+	return &procs[d][k];
+}
+
+double GpuProcesses::get_unattributed(unsigned int d) {
+	return unattributed[d];
+}
+
+void GpuProcesses::summary(FILE *fp) {
+	fprintf(fp, "GPU energy per process (by SM utilization share):\n");
+	fprintf(fp, "  %4s %8s %-16s %10s %14s %8s\n", "gpu", "pid", "name", "sm-util(%)", "energy(J)", "share");
+	for (unsigned int d = 0; d < n_devices; d++) {
+		double total = unattributed[d];
+		for (unsigned int k = 0; k <= GPU_MAX_PROCESSES; k++) {
+			total += procs[d][k].energy;
+		}
+		for (unsigned int k = 0; k <= GPU_MAX_PROCESSES; k++) {
+			const gpu_process_t *p = &procs[d][k];
+			if (k >= n_procs[d] && (k < GPU_MAX_PROCESSES || p->samples == 0)) {
+				continue;
+			}
+			fprintf(fp, "  %4u %8u %-16s %10.2f %14.6f %7.2f%%\n", index[d], p->pid, p->name,
+			        p->samples > 0 ? p->sm / p->samples : 0.0, p->energy, total > 0.0 ? 100.0 * p->energy / total : 0.0);
+		}
+		fprintf(fp, "  %4u %8s %-16s %10s %14.6f %7.2f%%\n", index[d], "-", "unattributed", "-", unattributed[d],
+		        total > 0.0 ? 100.0 * unattributed[d] / total : 0.0);
+	}
+	if (overflows > 0) {
+		fprintf(fp, "  %lu utilization reads did not fit the sample buffer, their ticks kept the previous shares\n", overflows);
+	}
+	fprintf(fp, "\n");
+}
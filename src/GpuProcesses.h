@@ -0,0 +1,75 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <vector>
+
+#include "Nvml.h"
+
+#ifndef GPUPROCESSES_H_
+#define GPUPROCESSES_H_
+
+// accounts per device, processes past this are billed to one "other" entry
+#define GPU_MAX_PROCESSES    256
+#define GPU_PROCESS_NAME     16
+
+// energy billed to one process on one device
+struct gpu_process_t {
+	unsigned int pid;
+	// /proc/pid/comm when the process was first seen
+	char name[GPU_PROCESS_NAME];
+	double energy;
+	// share of the device in the latest utilization samples, 0..1
+	double share;
+	// smUtil summed over its samples, for the mean utilization
+	double sm;
+	unsigned long samples;
+	// smUtil of the samples of the current tick
+	double tick_sm;
+};
+
+/*
+Per-process GPU energy for shared devices (MPS, several jobs per GPU). Every
+tick reads the process utilization samples the driver recorded since the last
+one (nvmlDeviceGetProcessUtilization) and splits the energy the device used in
+that tick between the processes by their SM utilization share. The driver only
+refreshes its samples every few tens of ms, ticks without new samples reuse the
+last shares. Energy with no busy process to bill (idle device, or utilization
+not supported) stays unattributed. The sample buffers and accounts are
+allocated by init(), sample() does not allocate.
+*/
+class GpuProcesses {
+
+private:
+	unsigned int n_devices;
+	std::vector<nvmlDevice_t> devices;
+	std::vector<unsigned int> index;
+	std::vector<char> supported;
+	// per device: driver sample buffer, newest timestamp seen (us) and energy already billed
+	std::vector<std::vector<nvmlProcessUtilizationSample_t>> buffers;
+	std::vector<unsigned long long> last_ts;
+	std::vector<double> last_energy;
+	std::vector<double> unattributed;
+	// per device: GPU_MAX_PROCESSES accounts plus the "other" entry, n_procs in use
+	std::vector<std::vector<gpu_process_t>> procs;
+	std::vector<unsigned int> n_procs;
+	unsigned long overflows;
+
+	gpu_process_t *account(unsigned int d, unsigned int pid);
+	void read_samples(unsigned int d);
+
+public:
+	GpuProcesses();
+	void init(const nvmlDevice_t *devices, unsigned int n, const unsigned int *index);
+	// energy[d] is the total Joules of device d since init
+	void sample(const double *energy);
+
+	unsigned int count(unsigned int d);
+	const gpu_process_t *process(unsigned int d, unsigned int k);
+	double get_unattributed(unsigned int d);
+	void summary(FILE *fp);
+};
+
+#endif /* GPUPROCESSES_H_ */
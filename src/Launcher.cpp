@@ -0,0 +1,106 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "Launcher.h"
+#include "Deadline.h"
+
+Launcher::Launcher(char **argv) {
+	this->argv = argv;
+	exec_ns = exit_ns = 0;
+	// exec_pipe is close-on-exec: EOF tells the parent the exec went through
+	if (pipe(go_pipe) != 0 || pipe2(exec_pipe, O_CLOEXEC) != 0) {
+		perror("Launcher:pipe");
+		exit(EXIT_FAILURE);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		perror("Launcher:fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		char go;
+		close(go_pipe[1]);
+		close(exec_pipe[0]);
+		if (read(go_pipe[0], &go, 1) != 1) {
+			// powermon died before starting us
+			_exit(127);
+		}
+		close(go_pipe[0]);
+		execvp(argv[0], argv);
+		int err = errno;
+		if (write(exec_pipe[1], &err, sizeof(err)) < 0) {}
+		_exit(127);
+	}
+	fork_ns = Deadline::now_ns();
+	close(go_pipe[0]);
+	close(exec_pipe[1]);
+}
+
+// Let the child exec, returns once it is running the command
+void Launcher::start() {
+	int err = 0;
+	// ^C goes to the whole process group, let the child decide and keep sampling until it exits
+	signal(SIGINT, SIG_IGN);
+	signal(SIGQUIT, SIG_IGN);
+	if (write(go_pipe[1], "g", 1) != 1) {
+		perror("Launcher:write");
+		exit(EXIT_FAILURE);
+	}
+	close(go_pipe[1]);
+	ssize_t n = read(exec_pipe[0], &err, sizeof(err));
+	exec_ns = Deadline::now_ns();
+	close(exec_pipe[0]);
+	if (n == sizeof(err)) {
+		fprintf(stderr, "powermon: cannot execute %s: %s\n", argv[0], strerror(err));
+	}
+}
+
+// Block until the child exits, returns its exit code (128+signal if killed)
+int Launcher::wait() {
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			perror("Launcher:waitpid");
+			return 127;
+		}
+	}
+	exit_ns = Deadline::now_ns();
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	if (WIFSIGNALED(status)) {
+		return 128 + WTERMSIG(status);
+	}
+	return 127;
+}
+
+pid_t Launcher::get_pid() {
+	return pid;
+}
+
+uint64_t Launcher::get_fork_ns() {
+	return fork_ns;
+}
+
+uint64_t Launcher::get_exec_ns() {
+	return exec_ns;
+}
+
+uint64_t Launcher::get_exit_ns() {
+	return exit_ns;
+}
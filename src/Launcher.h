@@ -0,0 +1,40 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <sys/types.h>
+
+#ifndef LAUNCHER_H_
+#define LAUNCHER_H_
+
+/*
+Runs a wrapped command. The constructor forks right away, while powermon is
+still small, and the child blocks on a pipe; start() releases it to exec once
+sampling is running and returns as soon as the exec succeeded. wait() blocks in
+waitpid until the child exits, so the measurement stops the moment it ends.
+*/
+class Launcher {
+
+private:
+	char **argv;
+	pid_t pid;
+	int go_pipe[2];
+	int exec_pipe[2];
+	uint64_t fork_ns;
+	uint64_t exec_ns;
+	uint64_t exit_ns;
+
+public:
+	Launcher(char **argv);
+	void start();
+	int wait();
+
+	pid_t get_pid();
+	uint64_t get_fork_ns();
+	uint64_t get_exec_ns();
+	uint64_t get_exit_ns();
+};
+
+#endif /* LAUNCHER_H_ */
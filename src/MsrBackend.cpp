@@ -0,0 +1,534 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cmath>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+
+#include <cerrno>
+#include <cstdlib>
+#include "RaplBackend.h"
+#include "Topology.h"
+
+#define MSR_RAPL_POWER_UNIT            0x606
+
+/*
+ * Platform specific RAPL Domains.
+ * Note that PP1 RAPL Domain is supported on 062A only
+ * And DRAM RAPL Domain is supported on 062D only
+ */
+/* Package RAPL Domain */
+#define MSR_PKG_RAPL_POWER_LIMIT       0x610
+#define MSR_PKG_ENERGY_STATUS          0x611
+#define MSR_PKG_PERF_STATUS            0x13
+#define MSR_PKG_POWER_INFO             0x614
+
+/* PP0 RAPL Domain */
+#define MSR_PP0_POWER_LIMIT            0x638
+#define MSR_PP0_ENERGY_STATUS          0x639
+#define MSR_PP0_POLICY                 0x63A
+#define MSR_PP0_PERF_STATUS            0x63B
+
+/* PP1 RAPL Domain, may reflect to uncore devices */
+#define MSR_PP1_POWER_LIMIT            0x640
+#define MSR_PP1_ENERGY_STATUS          0x641
+#define MSR_PP1_POLICY                 0x642
+
+/* DRAM RAPL Domain */
+#define MSR_DRAM_POWER_LIMIT           0x618
+#define MSR_DRAM_ENERGY_STATUS         0x619
+#define MSR_DRAM_PERF_STATUS           0x61B
+#define MSR_DRAM_POWER_INFO            0x61C
+
+/* RAPL UNIT BITMASK */
+#define POWER_UNIT_OFFSET              0
+#define POWER_UNIT_MASK                0x0F
+
+#define ENERGY_UNIT_OFFSET             0x08
+#define ENERGY_UNIT_MASK               0x1F00
+
+#define TIME_UNIT_OFFSET               0x10
+#define TIME_UNIT_MASK                 0xF000
+
+#define SIGNATURE_MASK                 0xFFFF0
+
+/* AMD MSR DEFINES */
+#define AMD_MSR_PWR_UNIT 	       0xC0010299
+#define AMD_MSR_CORE_ENERGY 	       0xC001029A
+#define AMD_MSR_PACKAGE_ENERGY         0xC001029B
+
+#define AMD_TIME_UNIT_MASK             0xF0000
+#define AMD_ENERGY_UNIT_MASK           0x1F00
+#define AMD_POWER_UNIT_MASK            0xF
+
+// CPU signature codes, useful for filtering uncompatible measures
+#define IVYBRIDGE_E                    0x306F0
+#define SANDYBRIDGE_E                  0x206D0
+#define COFFEE_LAKE                    0x906E0
+#define SKYLAKE_SERVER                 0x50650
+#define BROADWELL_E                    0x406F0
+
+/* msr-safe batch device */
+#define MSR_BATCH_DEVICE               "/dev/cpu/msr_batch"
+#define X86_IOC_MSR_BATCH              _IOWR('c', 0xA2, struct msr_batch_array_t)
+
+
+MsrBackend::MsrBackend(bool per_core) {
+
+	core_pool = NULL;
+	socket_pool = NULL;
+	batch_fd = -1;
+	vendor = get_vendor();
+	n_sockets = count_sockets();
+	smt = get_smt();
+	n_logical_cores = get_n_logical_cores();
+	pp1_supported = detect_pp1();
+
+	for (int i=0; i<n_sockets; i++){
+		open_msr(i, first_lcoreid[i]);
+	}
+	if (per_core && vendor != 1) {
+		printf("Per-core energy is only available on AMD, disabling per-core mode\n");
+		per_core = false;
+	}
+	if (per_core) {
+		open_cores();
+	}
+
+	// energy status registers sampled on every tick
+	for (int d=0; d<RAPL_DOMAINS; d++) {
+		if (!has_domain(d)) {
+			continue;
+		}
+		domains.push_back(d);
+		if (vendor == 1) {
+			domain_msr.push_back(AMD_MSR_PACKAGE_ENERGY);
+		} else {
+			const uint32_t msrs[RAPL_DOMAINS] = {MSR_PKG_ENERGY_STATUS, MSR_PP0_ENERGY_STATUS,
+			                                     MSR_PP1_ENERGY_STATUS, MSR_DRAM_ENERGY_STATUS};
+			domain_msr.push_back(msrs[d]);
+		}
+	}
+	open_batch();
+	if (batch_fd < 0 && n_sockets > 1) {
+		// one reader per socket so the IPIs to each package overlap
+		socket_pool = new MsrPool(fd, n_sockets);
+		socket_out.assign(n_sockets * domain_msr.size(), 0);
+	}
+
+	/* Read MSR_RAPL_POWER_UNIT Register */
+	uint64_t raw_value = 0;
+	printf("trying vendor units %u\n", vendor);
+	if (vendor == 0){
+		raw_value = read_msr(0, MSR_RAPL_POWER_UNIT);
+	} else if (vendor == 1){
+		raw_value = read_msr(0, AMD_MSR_PWR_UNIT);
+	}
+	power_units = pow(0.5,	(double) (raw_value & 0xf));
+	energy_unit = pow(0.5,	(double) ((raw_value >> 8) & 0x1f));
+	time_units = pow(0.5,	(double) ((raw_value >> 16) & 0xf));
+
+	/* Read MSR_PKG_POWER_INFO Register */
+	if (vendor==0){
+		raw_value = read_msr(0, MSR_PKG_POWER_INFO);
+		thermal_spec_power = power_units * ((double)(raw_value & 0x7fff));
+		minimum_power = power_units * ((double)((raw_value >> 16) & 0x7fff));
+		maximum_power = power_units * ((double)((raw_value >> 32) & 0x7fff));
+		time_window = time_units * ((double)((raw_value >> 48) & 0x7fff));
+	} else if (vendor == 1){
+		thermal_spec_power = 0; 
+		minimum_power = 0;
+		maximum_power = 0;
+		time_window = 0;
+	
+	}
+}
+
+// Stop the reader pools before closing the descriptors their workers read
+MsrBackend::~MsrBackend() {
+	delete socket_pool;
+	delete core_pool;
+	for (size_t i=0; i<fd.size(); i++) {
+		if (fd[i] >= 0) {
+			close(fd[i]);
+		}
+	}
+	for (size_t i=0; i<core_fd.size(); i++) {
+		close(core_fd[i]);
+	}
+	if (batch_fd >= 0) {
+		close(batch_fd);
+	}
+}
+
+// msr module loaded and /dev/cpu/0/msr readable by us
+bool MsrBackend::available() {
+	int f = open("/dev/cpu/0/msr", O_RDONLY);
+	if (f < 0) {
+		return false;
+	}
+	uint64_t data;
+	bool ok = pread(f, &data, sizeof(data), MSR_RAPL_POWER_UNIT) == sizeof(data) ||
+	          pread(f, &data, sizeof(data), AMD_MSR_PWR_UNIT) == sizeof(data);
+	close(f);
+	return ok;
+}
+
+const char *MsrBackend::name() {
+	return "msr";
+}
+
+int MsrBackend::get_n_sockets() {
+	return n_sockets;
+}
+
+bool MsrBackend::has_domain(int domain) {
+	if (vendor == 1) {
+		return domain == RAPL_PKG;
+	}
+	switch (domain) {
+		case RAPL_PKG: return true;
+		case RAPL_PP0: return true;
+		case RAPL_PP1: return pp1_supported;
+		case RAPL_DRAM: return !pp1_supported;
+	}
+	return false;
+}
+
+void MsrBackend::read(int socket, uint64_t *raw) {
+	uint32_t max_int = ~((uint32_t) 0);
+
+	memset(raw, 0, sizeof(uint64_t) * RAPL_DOMAINS);
+	if (vendor==0) {
+		raw[RAPL_PKG] = read_msr(socket, MSR_PKG_ENERGY_STATUS) & max_int;
+		raw[RAPL_PP0] = read_msr(socket, MSR_PP0_ENERGY_STATUS) & max_int;
+		if (pp1_supported) {
+			raw[RAPL_PP1] = read_msr(socket, MSR_PP1_ENERGY_STATUS) & max_int;
+		} else {
+			raw[RAPL_DRAM] = read_msr(socket, MSR_DRAM_ENERGY_STATUS) & max_int;
+		}
+	} else if (vendor==1) {
+		raw[RAPL_PKG] = read_msr(socket, AMD_MSR_PACKAGE_ENERGY) & max_int;
+	}
+}
+
+/*
+Open the msr-safe batch device and prepare the operation lists. Falls back to
+the per-cpu msr devices if the module is missing or the allowlist rejects a test
+batch.
+*/
+void MsrBackend::open_batch() {
+	batch_fd = open(MSR_BATCH_DEVICE, O_RDWR);
+	if (batch_fd < 0) {
+		return;
+	}
+	msr_batch_op_t op;
+	memset(&op, 0, sizeof(op));
+	op.isrdmsr = 1;
+	for (int i=0; i<n_sockets; i++) {
+		op.cpu = first_lcoreid[i];
+		for (size_t k=0; k<domain_msr.size(); k++) {
+			op.msr = domain_msr[k];
+			socket_ops.push_back(op);
+		}
+	}
+	for (size_t c=0; c<core_cpus.size(); c++) {
+		op.cpu = core_cpus[c];
+		op.msr = AMD_MSR_CORE_ENERGY;
+		core_ops.push_back(op);
+	}
+	if (!read_batch(socket_ops) || (!core_ops.empty() && !read_batch(core_ops))) {
+		printf("msr-safe batch rejected, reading MSRs individually\n");
+		close(batch_fd);
+		batch_fd = -1;
+		return;
+	}
+	printf("Using msr-safe batch reads (%zu ops per sample)\n", socket_ops.size() + core_ops.size());
+}
+
+bool MsrBackend::read_batch(std::vector<msr_batch_op_t> &ops) {
+	msr_batch_array_t batch;
+	batch.numops = ops.size();
+	batch.ops = ops.data();
+	if (ioctl(batch_fd, X86_IOC_MSR_BATCH, &batch) < 0) {
+		return false;
+	}
+	for (size_t k=0; k<ops.size(); k++) {
+		if (ops[k].err != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MsrBackend::batched() {
+	return batch_fd >= 0;
+}
+
+// Every domain of every socket in one batch ioctl, or in parallel across sockets
+void MsrBackend::read_all(uint64_t *raw) {
+	uint32_t max_int = ~((uint32_t) 0);
+	size_t nd = domain_msr.size();
+
+	memset(raw, 0, sizeof(uint64_t) * RAPL_DOMAINS * n_sockets);
+	if (batch_fd >= 0) {
+		if (!read_batch(socket_ops)) {
+			perror("read_all():ioctl(X86_IOC_MSR_BATCH)");
+			exit(127);
+		}
+		for (int i=0; i<n_sockets; i++) {
+			for (size_t k=0; k<nd; k++) {
+				raw[i*RAPL_DOMAINS + domains[k]] = socket_ops[i*nd + k].msrdata & max_int;
+			}
+		}
+	} else if (socket_pool != NULL) {
+		socket_pool->read(domain_msr.data(), nd, socket_out.data());
+		for (int i=0; i<n_sockets; i++) {
+			for (size_t k=0; k<nd; k++) {
+				raw[i*RAPL_DOMAINS + domains[k]] = socket_out[i*nd + k] & max_int;
+			}
+		}
+	} else {
+		for (int i=0; i<n_sockets; i++) {
+			read(i, raw + i*RAPL_DOMAINS);
+		}
+	}
+}
+
+double MsrBackend::energy_units(int domain) {
+	return energy_unit;
+}
+
+// energy status registers are 32 bit wide
+uint64_t MsrBackend::max_count(int domain) {
+	return ~((uint32_t) 0);
+}
+
+// MSR_PKG_POWER_INFO maximum (Intel), it bounds every domain of the package
+double MsrBackend::max_power(int domain) {
+	return domain == RAPL_DRAM ? 0.0 : maximum_power;
+}
+
+/*
+MSR_PKG_RAPL_POWER_LIMIT: PL1 in power units in bits 0-14, enable bit 15 and
+clamp bit 16. PL2 and the time windows are kept as they are. Intel only, AMD
+has no writable package limit MSR.
+*/
+bool MsrBackend::get_power_limit(int socket, double *watts, uint64_t *raw) {
+	if (vendor != 0) {
+		return false;
+	}
+	*raw = read_msr(socket, MSR_PKG_RAPL_POWER_LIMIT);
+	*watts = power_units * (double)(*raw & 0x7fff);
+	return true;
+}
+
+bool MsrBackend::set_power_limit(int socket, double watts) {
+	uint64_t raw;
+	double current;
+	if (!get_power_limit(socket, &current, &raw)) {
+		return false;
+	}
+	if (raw >> 63) {
+		fprintf(stderr, "socket %d: RAPL power limit locked by the BIOS\n", socket);
+		return false;
+	}
+	uint64_t units = (uint64_t)llround(watts / power_units);
+	units = units > 0x7fff ? 0x7fff : units;
+	return write_msr(socket, MSR_PKG_RAPL_POWER_LIMIT, (raw & ~0x7fffULL) | units | (1ULL << 15) | (1ULL << 16));
+}
+
+bool MsrBackend::restore_power_limit(int socket, uint64_t raw) {
+	return vendor == 0 && write_msr(socket, MSR_PKG_RAPL_POWER_LIMIT, raw);
+}
+
+// The sampling descriptors are read-only, a limit change opens its own
+bool MsrBackend::write_msr(int socket, uint32_t msr_offset, uint64_t value) {
+	char filename[MAX_LINE];
+	snprintf(filename, sizeof(filename), "/dev/cpu/%d/msr", first_lcoreid[socket]);
+	int f = open(filename, O_WRONLY);
+	if (f < 0 || pwrite(f, &value, sizeof(value), msr_offset) != sizeof(value)) {
+		perror("write_msr()");
+		fprintf(stderr, "Trying to write %s\n", filename);
+		if (f >= 0) {
+			close(f);
+		}
+		return false;
+	}
+	close(f);
+	return true;
+}
+
+// Logical cpus per package, from sysfs rather than cpuid on whatever cpu we run on
+int MsrBackend::get_n_logical_cores(){
+	Topology *topo = get_topology();
+	int n = topo->get_n_cpus() / topo->get_n_sockets();
+	printf("Logical cores = %d\n", n);
+	return n;
+}
+
+// Threads per physical core, 1 without SMT
+int MsrBackend::get_smt(){
+	return get_topology()->get_smt();
+}
+
+int MsrBackend::get_vendor(){
+	int v = 0;
+	uint32_t eax = 0;
+	union {
+	    struct {
+		uint32_t ebx;
+		uint32_t edx;
+		uint32_t ecx;
+	    };
+	    char vendor[13];
+	} u;
+	__asm__("cpuid;"
+		:"=a"(eax), "=b"(u.ebx), "=d"(u.edx), "=c"(u.ecx) // output operands
+		:"0"(eax) // input operand
+		);
+	u.vendor[12] = '\0'; // add the null terminator
+
+	printf("vendor = %s\n", u.vendor); // print the string
+	if (strcmp(u.vendor, "AuthenticAMD") == 0) {
+	    v = 1;
+	} else {
+	    v = 0;
+	}
+
+	
+	return v;
+
+}
+
+bool MsrBackend::detect_pp1() {
+	uint32_t eax_input = 1;
+	uint32_t eax;
+	__asm__("cpuid;"
+			:"=a"(eax)               // EAX into b (output)
+			:"0"(eax_input)          // 1 into EAX (input)
+			:"%ebx","%ecx","%edx");  // clobbered registers
+	
+	printf("eax = %X\n", eax);
+
+	uint32_t cpu_signature = eax & SIGNATURE_MASK;
+    	#ifdef POWER_DEBUG
+        	printf("CPU signature: %x\n", cpu_signature); fflush(stdout);
+    	#endif
+	if (vendor == 1 || cpu_signature == SANDYBRIDGE_E || cpu_signature == IVYBRIDGE_E || cpu_signature == BROADWELL_E) {
+		#ifdef POWER_DEBUG
+			printf("PP1 measure not compatible for CPU signature: %x\n", cpu_signature); fflush(stdout);
+		#endif
+		return false;
+	}
+	return true;
+}
+
+void MsrBackend::open_msr(int socket, int cpuCore) {
+	std::stringstream filename_stream;
+	filename_stream << "/dev/cpu/" << cpuCore << "/msr";
+	fd[socket] = open(filename_stream.str().c_str(), O_RDONLY);
+	if (fd[socket] < 0) {
+		if ( errno == ENXIO) {
+			fprintf(stderr, "rdmsr: No CPU %d\n", cpuCore);
+			exit(2);
+		} else if ( errno == EIO) {
+			fprintf(stderr, "rdmsr: CPU %d doesn't support MSRs\n", cpuCore);
+			exit(3);
+		} else {
+			perror("rdmsr:open");
+			fprintf(stderr, "Trying to open %s\n",
+					filename_stream.str().c_str());
+			exit(127);
+		}
+	}
+}
+
+uint64_t MsrBackend::read_msr(int socket, uint32_t msr_offset) {
+	uint64_t data;
+	if (pread(fd[socket], &data, sizeof(data), msr_offset) != sizeof(data)) {
+		perror("read_msr():pread");
+		exit(127);
+	}
+	return data;
+}
+
+/*
+Open the msr device of one logical CPU per physical core, the first of its SMT
+siblings in the topology.
+*/
+void MsrBackend::open_cores() {
+	Topology *topo = get_topology();
+	for (int c=0; c<topo->get_n_cores(); c++) {
+		int cpu = topo->core_cpu(c);
+		std::stringstream filename_stream;
+		filename_stream << "/dev/cpu/" << cpu << "/msr";
+		int cfd = open(filename_stream.str().c_str(), O_RDONLY);
+		if (cfd < 0) {
+			perror("rdmsr:open");
+			fprintf(stderr, "Trying to open %s\n", filename_stream.str().c_str());
+			exit(127);
+		}
+		core_cpus.push_back(cpu);
+		core_fd.push_back(cfd);
+	}
+	size_t nc = core_cpus.size();
+	core_pool = new MsrPool(core_fd);
+	printf("Per-core mode: %zu physical cores (smt=%d), %d reader threads\n", nc, smt, core_pool->get_n_workers());
+}
+
+int MsrBackend::get_n_cores() {
+	return core_cpus.size();
+}
+
+int MsrBackend::core_cpu(int core) {
+	return core_cpus[core];
+}
+
+// Read the core energy MSR of every physical core through the reader pool
+void MsrBackend::read_cores(uint64_t *raw) {
+	uint32_t max_int = ~((uint32_t) 0);
+	uint32_t offset = AMD_MSR_CORE_ENERGY;
+	if (batch_fd >= 0) {
+		if (!read_batch(core_ops)) {
+			perror("read_cores():ioctl(X86_IOC_MSR_BATCH)");
+			exit(127);
+		}
+		for (size_t c=0; c<core_cpus.size(); c++) {
+			raw[c] = core_ops[c].msrdata;
+		}
+	} else {
+		core_pool->read(&offset, 1, raw);
+	}
+	for (size_t c=0; c<core_cpus.size(); c++) {
+		raw[c] &= max_int;
+	}
+}
+
+double MsrBackend::core_energy_units() {
+	return energy_unit;
+}
+
+// One msr device per socket, opened on its first online cpu
+int MsrBackend::count_sockets(){
+	Topology *topo = get_topology();
+	int count = topo->get_n_sockets();
+	first_lcoreid.resize(count);
+	for (int i=0; i<count; i++){
+		first_lcoreid[i] = topo->socket_cpu(i);
+	}
+	fd.assign(count, -1);
+
+	printf("Number of sockets: %d\n", count);
+	return count;
+}
@@ -0,0 +1,108 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "MsrPool.h"
+#include "Affinity.h"
+
+MsrPool::MsrPool(const std::vector<int> &fds, int n_workers) {
+	this->fds = fds;
+	if (n_workers <= 0) {
+		n_workers = (fds.size() + MSRPOOL_FDS_PER_WORKER - 1) / MSRPOOL_FDS_PER_WORKER;
+	}
+	if (n_workers > MSRPOOL_MAX_WORKERS) {
+		n_workers = MSRPOOL_MAX_WORKERS;
+	}
+	if (n_workers > (int)fds.size()) {
+		n_workers = fds.size();
+	}
+	if (n_workers < 1) {
+		n_workers = 1;
+	}
+	this->n_workers = n_workers;
+	offsets = NULL;
+	n_offsets = 0;
+	out = NULL;
+	stop = false;
+
+	// worker 0 is the caller of read()
+	pthread_barrier_init(&start_barrier, NULL, n_workers);
+	pthread_barrier_init(&done_barrier, NULL, n_workers);
+	workers = new pthread_t[n_workers];
+	args = new worker_arg_t[n_workers];
+	for (int i=1; i<n_workers; i++) {
+		args[i].pool = this;
+		args[i].id = i;
+		int code = pthread_create(&workers[i], NULL, worker_func, (void*)&args[i]);
+		if (code) {
+			fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+			exit(0);
+		}
+	}
+}
+
+MsrPool::~MsrPool() {
+	stop = true;
+	if (n_workers > 1) {
+		pthread_barrier_wait(&start_barrier);
+		for (int i=1; i<n_workers; i++) {
+			pthread_join(workers[i], NULL);
+		}
+	}
+	pthread_barrier_destroy(&start_barrier);
+	pthread_barrier_destroy(&done_barrier);
+	delete[] workers;
+	delete[] args;
+}
+
+void MsrPool::read_slice(int id) {
+	size_t n = fds.size();
+	size_t begin = n * id / n_workers;
+	size_t end = n * (id + 1) / n_workers;
+	for (size_t i=begin; i<end; i++) {
+		for (int k=0; k<n_offsets; k++) {
+			if (pread(fds[i], &out[i*n_offsets + k], sizeof(uint64_t), offsets[k]) != sizeof(uint64_t)) {
+				perror("MsrPool::read():pread");
+				exit(127);
+			}
+		}
+	}
+}
+
+void *MsrPool::worker_func(void *ptr) {
+	worker_arg_t *arg = (worker_arg_t*)ptr;
+	MsrPool *pool = arg->pool;
+	// the sampler waits on these reads, place them like the sampler itself
+	affinity_apply(true);
+	while (true) {
+		pthread_barrier_wait(&pool->start_barrier);
+		if (pool->stop) {
+			break;
+		}
+		pool->read_slice(arg->id);
+		pthread_barrier_wait(&pool->done_barrier);
+	}
+	pthread_exit(0);
+}
+
+void MsrPool::read(const uint32_t *offsets, int n_offsets, uint64_t *out) {
+	this->offsets = offsets;
+	this->n_offsets = n_offsets;
+	this->out = out;
+	if (n_workers == 1) {
+		read_slice(0);
+		return;
+	}
+	pthread_barrier_wait(&start_barrier);
+	read_slice(0);
+	pthread_barrier_wait(&done_barrier);
+}
+
+int MsrPool::get_n_workers() {
+	return n_workers;
+}
@@ -0,0 +1,53 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <vector>
+#include <pthread.h>
+
+#ifndef MSRPOOL_H_
+#define MSRPOOL_H_
+
+#define MSRPOOL_FDS_PER_WORKER 16
+#define MSRPOOL_MAX_WORKERS    8
+
+/*
+Reads the same set of MSRs from many /dev/cpu/N/msr descriptors in parallel.
+Every pread on an msr device is an IPI to the target CPU, so reading 128 cores
+one after the other costs 128 round trips; the pool splits the descriptors in
+slices that are read concurrently by a few worker threads. The calling thread
+reads the first slice itself.
+*/
+class MsrPool {
+
+private:
+	std::vector<int> fds;
+	const uint32_t *offsets;
+	int n_offsets;
+	uint64_t *out;
+	int n_workers;
+	bool stop;
+	pthread_t *workers;
+	pthread_barrier_t start_barrier;
+	pthread_barrier_t done_barrier;
+
+	struct worker_arg_t {
+		MsrPool *pool;
+		int id;
+	};
+	worker_arg_t *args;
+
+	void read_slice(int id);
+	static void *worker_func(void *ptr);
+
+public:
+	MsrPool(const std::vector<int> &fds, int n_workers = 0);
+	~MsrPool();
+	// out[i*n_offsets + k] = msr offsets[k] of fds[i]
+	void read(const uint32_t *offsets, int n_offsets, uint64_t *out);
+	int get_n_workers();
+};
+
+#endif /* MSRPOOL_H_ */
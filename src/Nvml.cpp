@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "Nvml.h"
+
+#define NVML_LIBRARY "libnvidia-ml.so.1"
+
+// an entry point missing from an old driver reports NVML_ERROR_FUNCTION_NOT_FOUND, like an unsupported query
+#define NVML_FORWARD(name, symbol, params, args) \
+	static nvmlReturn_t (*name##_fn) params = NULL; \
+	nvmlReturn_t pm_##name params { \
+		return name##_fn != NULL ? name##_fn args : \
+		       (nvmlLib == NULL ? NVML_ERROR_UNINITIALIZED : NVML_ERROR_FUNCTION_NOT_FOUND); \
+	}
+
+#define NVML_RESOLVE(name, symbol, params, args) \
+	name##_fn = (nvmlReturn_t (*) params)dlsym(nvmlLib, symbol);
+
+#define NVML_CLEAR(name, symbol, params, args) \
+	name##_fn = NULL;
+
+static void *nvmlLib = NULL;
+static const char *(*nvmlErrorString_fn)(nvmlReturn_t) = NULL;
+static char nvmlLoadError[256] = "not loaded";
+static pthread_once_t nvmlOnce = PTHREAD_ONCE_INIT;
+
+NVML_FUNCTIONS(NVML_FORWARD)
+
+const char *pm_nvmlErrorString(nvmlReturn_t result) {
+	return nvmlErrorString_fn != NULL ? nvmlErrorString_fn(result) : nvmlLoadError;
+}
+
+static void nvml_open() {
+	nvmlLib = dlopen(NVML_LIBRARY, RTLD_NOW | RTLD_LOCAL);
+	if (nvmlLib == NULL) {
+		snprintf(nvmlLoadError, sizeof(nvmlLoadError), "%s", dlerror());
+		return;
+	}
+	NVML_FUNCTIONS(NVML_RESOLVE)
+	nvmlErrorString_fn = (const char *(*)(nvmlReturn_t))dlsym(nvmlLib, "nvmlErrorString");
+	if (nvmlInit_fn == NULL || nvmlDeviceGetCount_fn == NULL || nvmlDeviceGetHandleByIndex_fn == NULL) {
+		snprintf(nvmlLoadError, sizeof(nvmlLoadError), "%s lacks nvmlInit_v2", NVML_LIBRARY);
+		NVML_FUNCTIONS(NVML_CLEAR)
+		nvmlErrorString_fn = NULL;
+		dlclose(nvmlLib);
+		nvmlLib = NULL;
+	}
+}
+
+bool nvml_load() {
+	pthread_once(&nvmlOnce, nvml_open);
+	return nvmlLib != NULL;
+}
+
+const char *nvml_error() {
+	return nvmlLoadError;
+}
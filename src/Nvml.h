@@ -0,0 +1,194 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+/*
+NVML is not linked: Nvml.cpp defines the entry points powermon uses and forwards
+them to libnvidia-ml.so.1, opened by nvml_load() the first time GPUs are sampled.
+The same binary starts on nodes without a driver and never pays for NVML when
+no GPU is requested. With CPU_ONLY (make cpu) there is no nvml.h at build time
+and the subset of the NVML types powermon uses is declared below.
+
+The forwarders are named pm_<entry point> and the NVML names are mapped to them
+at the end of this file, so libpowermon never defines or exports NVML's own
+symbols and an application using libnvidia-ml itself keeps calling the driver.
+*/
+
+#ifndef NVML_H_
+#define NVML_H_
+
+#ifndef CPU_ONLY
+#include <nvml.h>
+#else
+
+typedef enum {
+	NVML_SUCCESS = 0,
+	NVML_ERROR_UNINITIALIZED = 1,
+	NVML_ERROR_INVALID_ARGUMENT = 2,
+	NVML_ERROR_NOT_SUPPORTED = 3,
+	NVML_ERROR_NO_PERMISSION = 4,
+	NVML_ERROR_ALREADY_INITIALIZED = 5,
+	NVML_ERROR_NOT_FOUND = 6,
+	NVML_ERROR_INSUFFICIENT_SIZE = 7,
+	NVML_ERROR_INSUFFICIENT_POWER = 8,
+	NVML_ERROR_DRIVER_NOT_LOADED = 9,
+	NVML_ERROR_TIMEOUT = 10,
+	NVML_ERROR_IRQ_ISSUE = 11,
+	NVML_ERROR_LIBRARY_NOT_FOUND = 12,
+	NVML_ERROR_FUNCTION_NOT_FOUND = 13,
+	NVML_ERROR_CORRUPTED_INFOROM = 14,
+	NVML_ERROR_GPU_IS_LOST = 15,
+	NVML_ERROR_UNKNOWN = 999
+} nvmlReturn_t;
+
+typedef struct nvmlDevice_st *nvmlDevice_t;
+
+typedef struct {
+	char busIdLegacy[16];
+	unsigned int domain;
+	unsigned int bus;
+	unsigned int device;
+	unsigned int pciDeviceId;
+	unsigned int pciSubSystemId;
+	char busId[32];
+} nvmlPciInfo_t;
+
+typedef enum { NVML_FEATURE_DISABLED = 0, NVML_FEATURE_ENABLED = 1 } nvmlEnableState_t;
+typedef enum { NVML_COMPUTEMODE_DEFAULT = 0, NVML_COMPUTEMODE_EXCLUSIVE_THREAD = 1,
+               NVML_COMPUTEMODE_PROHIBITED = 2, NVML_COMPUTEMODE_EXCLUSIVE_PROCESS = 3 } nvmlComputeMode_t;
+typedef enum { NVML_TOTAL_POWER_SAMPLES = 0 } nvmlSamplingType_t;
+typedef enum { NVML_CLOCK_GRAPHICS = 0, NVML_CLOCK_SM = 1, NVML_CLOCK_MEM = 2, NVML_CLOCK_VIDEO = 3 } nvmlClockType_t;
+typedef enum { NVML_TEMPERATURE_GPU = 0 } nvmlTemperatureSensors_t;
+
+typedef enum {
+	NVML_VALUE_TYPE_DOUBLE = 0,
+	NVML_VALUE_TYPE_UNSIGNED_INT = 1,
+	NVML_VALUE_TYPE_UNSIGNED_LONG = 2,
+	NVML_VALUE_TYPE_UNSIGNED_LONG_LONG = 3,
+	NVML_VALUE_TYPE_SIGNED_LONG_LONG = 4
+} nvmlValueType_t;
+
+typedef union {
+	double dVal;
+	unsigned int uiVal;
+	unsigned long ulVal;
+	unsigned long long ullVal;
+	signed long long sllVal;
+} nvmlValue_t;
+
+typedef struct {
+	unsigned long long timeStamp;
+	nvmlValue_t sampleValue;
+} nvmlSample_t;
+
+typedef struct {
+	unsigned int fieldId;
+	unsigned int scopeId;
+	long long timestamp;
+	long long latencyUsec;
+	nvmlValueType_t valueType;
+	nvmlReturn_t nvmlReturn;
+	nvmlValue_t value;
+} nvmlFieldValue_t;
+
+typedef struct {
+	unsigned int gpu;
+	unsigned int memory;
+} nvmlUtilization_t;
+
+typedef struct {
+	unsigned int pid;
+	unsigned long long timeStamp;
+	unsigned int smUtil;
+	unsigned int memUtil;
+	unsigned int encUtil;
+	unsigned int decUtil;
+} nvmlProcessUtilizationSample_t;
+
+#define NVML_FI_DEV_MEMORY_TEMP                82
+#define NVML_FI_DEV_TOTAL_ENERGY_CONSUMPTION   83
+#define NVML_FI_DEV_POWER_AVERAGE              185
+#define NVML_FI_DEV_POWER_INSTANT              186
+
+#endif /* CPU_ONLY */
+
+// entry point, driver symbol, parameter list and argument list of every forwarded function
+#define NVML_FUNCTIONS(X) \
+	X(nvmlInit, "nvmlInit_v2", (void), ()) \
+	X(nvmlShutdown, "nvmlShutdown", (void), ()) \
+	X(nvmlDeviceGetCount, "nvmlDeviceGetCount_v2", (unsigned int *deviceCount), (deviceCount)) \
+	X(nvmlDeviceGetHandleByIndex, "nvmlDeviceGetHandleByIndex_v2", (unsigned int index, nvmlDevice_t *device), \
+	                              (index, device)) \
+	X(nvmlDeviceGetName, "nvmlDeviceGetName", (nvmlDevice_t device, char *name, unsigned int length), \
+	                     (device, name, length)) \
+	X(nvmlDeviceGetPciInfo, "nvmlDeviceGetPciInfo_v3", (nvmlDevice_t device, nvmlPciInfo_t *pci), (device, pci)) \
+	X(nvmlDeviceGetComputeMode, "nvmlDeviceGetComputeMode", (nvmlDevice_t device, nvmlComputeMode_t *mode), \
+	                            (device, mode)) \
+	X(nvmlDeviceGetPowerUsage, "nvmlDeviceGetPowerUsage", (nvmlDevice_t device, unsigned int *power), (device, power)) \
+	X(nvmlDeviceGetTotalEnergyConsumption, "nvmlDeviceGetTotalEnergyConsumption", \
+	                                       (nvmlDevice_t device, unsigned long long *energy), (device, energy)) \
+	X(nvmlDeviceGetSamples, "nvmlDeviceGetSamples", (nvmlDevice_t device, nvmlSamplingType_t type, \
+	                        unsigned long long lastSeenTimeStamp, nvmlValueType_t *sampleValType, \
+	                        unsigned int *sampleCount, nvmlSample_t *samples), \
+	                        (device, type, lastSeenTimeStamp, sampleValType, sampleCount, samples)) \
+	X(nvmlDeviceGetFieldValues, "nvmlDeviceGetFieldValues", (nvmlDevice_t device, int valuesCount, \
+	                            nvmlFieldValue_t *values), (device, valuesCount, values)) \
+	X(nvmlDeviceGetClockInfo, "nvmlDeviceGetClockInfo", (nvmlDevice_t device, nvmlClockType_t type, unsigned int *clock), \
+	                          (device, type, clock)) \
+	X(nvmlDeviceGetUtilizationRates, "nvmlDeviceGetUtilizationRates", \
+	                                 (nvmlDevice_t device, nvmlUtilization_t *utilization), (device, utilization)) \
+	X(nvmlDeviceGetTemperature, "nvmlDeviceGetTemperature", (nvmlDevice_t device, nvmlTemperatureSensors_t sensorType, \
+	                            unsigned int *temp), (device, sensorType, temp)) \
+	X(nvmlDeviceGetCurrentClocksThrottleReasons, "nvmlDeviceGetCurrentClocksThrottleReasons", \
+	                                             (nvmlDevice_t device, unsigned long long *clocksThrottleReasons), \
+	                                             (device, clocksThrottleReasons)) \
+	X(nvmlDeviceGetPowerManagementLimit, "nvmlDeviceGetPowerManagementLimit", \
+	                                     (nvmlDevice_t device, unsigned int *limit), (device, limit)) \
+	X(nvmlDeviceSetPowerManagementLimit, "nvmlDeviceSetPowerManagementLimit", \
+	                                     (nvmlDevice_t device, unsigned int limit), (device, limit)) \
+	X(nvmlDeviceGetPowerManagementLimitConstraints, "nvmlDeviceGetPowerManagementLimitConstraints", \
+	                                                (nvmlDevice_t device, unsigned int *minLimit, unsigned int *maxLimit), \
+	                                                (device, minLimit, maxLimit)) \
+	X(nvmlDeviceGetProcessUtilization, "nvmlDeviceGetProcessUtilization", (nvmlDevice_t device, \
+	                                   nvmlProcessUtilizationSample_t *utilization, unsigned int *processSamplesCount, \
+	                                   unsigned long long lastSeenTimeStamp), \
+	                                   (device, utilization, processSamplesCount, lastSeenTimeStamp))
+
+#define NVML_DECLARE(name, symbol, params, args) \
+	nvmlReturn_t pm_##name params;
+
+NVML_FUNCTIONS(NVML_DECLARE)
+const char *pm_nvmlErrorString(nvmlReturn_t result);
+
+// the NVML names powermon calls, after nvml.h so its versioned names are replaced too
+#undef nvmlInit
+#undef nvmlDeviceGetCount
+#undef nvmlDeviceGetHandleByIndex
+#undef nvmlDeviceGetPciInfo
+#define nvmlInit                                      pm_nvmlInit
+#define nvmlShutdown                                  pm_nvmlShutdown
+#define nvmlErrorString                               pm_nvmlErrorString
+#define nvmlDeviceGetCount                            pm_nvmlDeviceGetCount
+#define nvmlDeviceGetHandleByIndex                    pm_nvmlDeviceGetHandleByIndex
+#define nvmlDeviceGetName                             pm_nvmlDeviceGetName
+#define nvmlDeviceGetPciInfo                          pm_nvmlDeviceGetPciInfo
+#define nvmlDeviceGetComputeMode                      pm_nvmlDeviceGetComputeMode
+#define nvmlDeviceGetPowerUsage                       pm_nvmlDeviceGetPowerUsage
+#define nvmlDeviceGetTotalEnergyConsumption           pm_nvmlDeviceGetTotalEnergyConsumption
+#define nvmlDeviceGetSamples                          pm_nvmlDeviceGetSamples
+#define nvmlDeviceGetFieldValues                      pm_nvmlDeviceGetFieldValues
+#define nvmlDeviceGetClockInfo                        pm_nvmlDeviceGetClockInfo
+#define nvmlDeviceGetUtilizationRates                 pm_nvmlDeviceGetUtilizationRates
+#define nvmlDeviceGetTemperature                      pm_nvmlDeviceGetTemperature
+#define nvmlDeviceGetCurrentClocksThrottleReasons     pm_nvmlDeviceGetCurrentClocksThrottleReasons
+#define nvmlDeviceGetPowerManagementLimit             pm_nvmlDeviceGetPowerManagementLimit
+#define nvmlDeviceSetPowerManagementLimit             pm_nvmlDeviceSetPowerManagementLimit
+#define nvmlDeviceGetPowerManagementLimitConstraints  pm_nvmlDeviceGetPowerManagementLimitConstraints
+#define nvmlDeviceGetProcessUtilization               pm_nvmlDeviceGetProcessUtilization
+
+// Open libnvidia-ml and resolve the entry points, false (see nvml_error) when there is no driver
+bool nvml_load();
+const char *nvml_error();
+
+#endif /* NVML_H_ */
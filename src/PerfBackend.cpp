@@ -0,0 +1,169 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "RaplBackend.h"
+#include "Topology.h"
+
+#define PERF_POWER_ROOT "/sys/bus/event_source/devices/power"
+
+static const char *perf_events[RAPL_DOMAINS] = {"energy-pkg", "energy-cores", "energy-gpu", "energy-ram"};
+
+static bool read_line(const std::string &path, char *buf, size_t size) {
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp == NULL) {
+		return false;
+	}
+	bool ok = fgets(buf, size, fp) != NULL;
+	fclose(fp);
+	return ok;
+}
+
+static int perf_open(int type, uint64_t config, int cpu) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = type;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+}
+
+// PMU type and event config of a power event, false if the event does not exist
+static bool perf_event_config(const char *event, int *type, uint64_t *config) {
+	char buf[MAX_LINE];
+	if (!read_line(PERF_POWER_ROOT "/type", buf, sizeof(buf))) {
+		return false;
+	}
+	*type = atoi(buf);
+	if (!read_line(std::string(PERF_POWER_ROOT "/events/") + event, buf, sizeof(buf))) {
+		return false;
+	}
+	unsigned long long v;
+	if (sscanf(buf, "event=%llx", &v) != 1) {
+		return false;
+	}
+	*config = v;
+	return true;
+}
+
+PerfBackend::PerfBackend() {
+	char buf[MAX_LINE];
+	int type;
+	uint64_t config;
+
+	// the PMU lists one cpu per package in its cpumask, sockets are dense topology indices
+	Topology *topo = get_topology();
+	std::vector<int> mask;
+	if (!read_line(PERF_POWER_ROOT "/cpumask", buf, sizeof(buf))) {
+		fprintf(stderr, "perf: no power PMU (%s)\n", PERF_POWER_ROOT);
+		exit(127);
+	}
+	parse_cpu_list(buf, mask);
+	n_sockets = topo->get_n_sockets();
+	std::vector<int> cpus(n_sockets, -1);
+	for (size_t k = 0; k < mask.size(); k++) {
+		const topology_cpu_t *c = topo->find(mask[k]);
+		if (c == NULL) {
+			fprintf(stderr, "perf: cpumask cpu %d is not online\n", mask[k]);
+			exit(127);
+		}
+		cpus[c->socket] = mask[k];
+	}
+	for (int i=0; i<n_sockets; i++) {
+		if (cpus[i] < 0) {
+			fprintf(stderr, "perf: no cpumask cpu for package %d\n", topo->socket_package(i));
+			exit(127);
+		}
+	}
+	std::array<int, RAPL_DOMAINS> closed;
+	closed.fill(-1);
+	fd.assign(n_sockets, closed);
+
+	for (int d=0; d<RAPL_DOMAINS; d++) {
+		scale[d] = 0.0;
+		if (!perf_event_config(perf_events[d], &type, &config)) {
+			continue;
+		}
+		if (read_line(std::string(PERF_POWER_ROOT "/events/") + perf_events[d] + ".scale", buf, sizeof(buf))) {
+			scale[d] = strtod(buf, NULL);
+		}
+		for (int i=0; i<n_sockets; i++) {
+			fd[i][d] = perf_open(type, config, cpus[i]);
+			if (fd[i][d] < 0) {
+				perror("perf_event_open");
+				fprintf(stderr, "Trying to open %s on cpu %d\n", perf_events[d], cpus[i]);
+				exit(127);
+			}
+		}
+	}
+	if (fd[0][RAPL_PKG] < 0) {
+		fprintf(stderr, "perf: power PMU has no energy-pkg event\n");
+		exit(127);
+	}
+	printf("Number of sockets: %d\n", n_sockets);
+}
+
+PerfBackend::~PerfBackend() {
+	for (int i=0; i<n_sockets; i++) {
+		for (int d=0; d<RAPL_DOMAINS; d++) {
+			if (fd[i][d] >= 0) {
+				close(fd[i][d]);
+			}
+		}
+	}
+}
+
+bool PerfBackend::available() {
+	int type;
+	uint64_t config;
+	if (!perf_event_config("energy-pkg", &type, &config)) {
+		return false;
+	}
+	int f = perf_open(type, config, 0);
+	if (f < 0) {
+		return false;
+	}
+	close(f);
+	return true;
+}
+
+const char *PerfBackend::name() {
+	return "perf";
+}
+
+int PerfBackend::get_n_sockets() {
+	return n_sockets;
+}
+
+bool PerfBackend::has_domain(int domain) {
+	return fd[0][domain] >= 0;
+}
+
+void PerfBackend::read(int socket, uint64_t *raw) {
+	for (int d=0; d<RAPL_DOMAINS; d++) {
+		raw[d] = 0;
+		if (fd[socket][d] < 0) {
+			continue;
+		}
+		if (::read(fd[socket][d], &raw[d], sizeof(uint64_t)) != sizeof(uint64_t)) {
+			perror("perf:read");
+			exit(127);
+		}
+	}
+}
+
+double PerfBackend::energy_units(int domain) {
+	return scale[domain];
+}
+
+// 64 bit counters accumulated by the kernel
+uint64_t PerfBackend::max_count(int domain) {
+	return ~((uint64_t) 0);
+}
@@ -0,0 +1,206 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "RaplBackend.h"
+#include "Topology.h"
+
+#define POWERCAP_ROOT "/sys/class/powercap"
+
+// Read a small sysfs file into buf, false if it cannot be read
+static bool read_sysfs(const std::string &path, char *buf, size_t size) {
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp == NULL) {
+		return false;
+	}
+	bool ok = fgets(buf, size, fp) != NULL;
+	fclose(fp);
+	if (ok) {
+		buf[strcspn(buf, "\n")] = '\0';
+	}
+	return ok;
+}
+
+PowercapBackend::PowercapBackend() {
+	// zones are named after the physical_package_id, sockets are dense topology indices
+	Topology *topo = get_topology();
+	n_sockets = topo->get_n_sockets();
+	std::array<int, RAPL_DOMAINS> closed;
+	std::array<uint64_t, RAPL_DOMAINS> empty;
+	closed.fill(-1);
+	empty.fill(0);
+	fd.assign(n_sockets, closed);
+	max_range.assign(n_sockets, empty);
+	zone.resize(n_sockets);
+
+	DIR *dir = opendir(POWERCAP_ROOT);
+	if (dir == NULL) {
+		perror("powercap:opendir");
+		exit(127);
+	}
+	struct dirent *ent;
+	char buf[MAX_LINE];
+	while ((ent = readdir(dir)) != NULL) {
+		// package zones are intel-rapl:N, their subzones intel-rapl:N:M
+		std::string zname(ent->d_name);
+		if (zname.compare(0, 11, "intel-rapl:") != 0) {
+			continue;
+		}
+		std::string path = std::string(POWERCAP_ROOT) + "/" + zname;
+		if (!read_sysfs(path + "/name", buf, sizeof(buf))) {
+			continue;
+		}
+		int package, socket;
+		if (zname.find(':', 11) == std::string::npos) {
+			if (sscanf(buf, "package-%d", &package) != 1 || (socket = topo->package_socket(package)) < 0) {
+				continue;
+			}
+			open_domain(socket, RAPL_PKG, path);
+		} else {
+			// subzone, the socket is the package zone it belongs to
+			char pbuf[MAX_LINE];
+			std::string parent = zname.substr(0, zname.find(':', 11));
+			if (!read_sysfs(std::string(POWERCAP_ROOT) + "/" + parent + "/name", pbuf, sizeof(pbuf)) ||
+			    sscanf(pbuf, "package-%d", &package) != 1 || (socket = topo->package_socket(package)) < 0) {
+				continue;
+			}
+			if (strcmp(buf, "core") == 0) {
+				open_domain(socket, RAPL_PP0, path);
+			} else if (strcmp(buf, "uncore") == 0) {
+				open_domain(socket, RAPL_PP1, path);
+			} else if (strcmp(buf, "dram") == 0) {
+				open_domain(socket, RAPL_DRAM, path);
+			}
+		}
+	}
+	closedir(dir);
+
+	for (int i=0; i<n_sockets; i++) {
+		if (fd[i][RAPL_PKG] < 0) {
+			fprintf(stderr, "powercap: no intel-rapl zone for package-%d in %s\n", topo->socket_package(i), POWERCAP_ROOT);
+			exit(127);
+		}
+	}
+	printf("Number of sockets: %d\n", n_sockets);
+}
+
+void PowercapBackend::open_domain(int socket, int domain, const std::string &dir) {
+	char buf[MAX_LINE];
+	std::string path = dir + "/energy_uj";
+	int f = open(path.c_str(), O_RDONLY);
+	if (f < 0) {
+		perror("powercap:open");
+		fprintf(stderr, "Trying to open %s\n", path.c_str());
+		exit(127);
+	}
+	if (!read_sysfs(dir + "/max_energy_range_uj", buf, sizeof(buf))) {
+		fprintf(stderr, "powercap: cannot read %s/max_energy_range_uj\n", dir.c_str());
+		exit(127);
+	}
+	fd[socket][domain] = f;
+	max_range[socket][domain] = strtoull(buf, NULL, 10);
+	zone[socket][domain] = dir;
+}
+
+PowercapBackend::~PowercapBackend() {
+	for (int i=0; i<n_sockets; i++) {
+		for (int d=0; d<RAPL_DOMAINS; d++) {
+			if (fd[i][d] >= 0) {
+				close(fd[i][d]);
+			}
+		}
+	}
+}
+
+bool PowercapBackend::available() {
+	int f = open(POWERCAP_ROOT "/intel-rapl:0/energy_uj", O_RDONLY);
+	if (f < 0) {
+		return false;
+	}
+	char buf[32];
+	bool ok = pread(f, buf, sizeof(buf), 0) > 0;
+	close(f);
+	return ok;
+}
+
+const char *PowercapBackend::name() {
+	return "powercap";
+}
+
+int PowercapBackend::get_n_sockets() {
+	return n_sockets;
+}
+
+bool PowercapBackend::has_domain(int domain) {
+	return fd[0][domain] >= 0;
+}
+
+void PowercapBackend::read(int socket, uint64_t *raw) {
+	char buf[32];
+	for (int d=0; d<RAPL_DOMAINS; d++) {
+		raw[d] = 0;
+		if (fd[socket][d] < 0) {
+			continue;
+		}
+		// sysfs attributes are regenerated on every read from offset 0
+		ssize_t n = pread(fd[socket][d], buf, sizeof(buf) - 1, 0);
+		if (n <= 0) {
+			perror("powercap:pread");
+			exit(127);
+		}
+		buf[n] = '\0';
+		raw[d] = strtoull(buf, NULL, 10);
+	}
+}
+
+double PowercapBackend::energy_units(int domain) {
+	return 1e-6;
+}
+
+// counters wrap at max_energy_range_uj, the same for every socket
+uint64_t PowercapBackend::max_count(int domain) {
+	return max_range[0][domain] > 0 ? max_range[0][domain] : ~((uint64_t) 0);
+}
+
+// constraint_0 is the long term (PL1) limit of the package zone, in microwatts
+bool PowercapBackend::get_power_limit(int socket, double *watts, uint64_t *raw) {
+	char buf[MAX_LINE];
+	if (!read_sysfs(zone[socket][RAPL_PKG] + "/constraint_0_power_limit_uw", buf, sizeof(buf))) {
+		return false;
+	}
+	*raw = strtoull(buf, NULL, 10);
+	*watts = (double)*raw * 1e-6;
+	return true;
+}
+
+bool PowercapBackend::write_limit(int socket, uint64_t uw) {
+	std::string path = zone[socket][RAPL_PKG] + "/constraint_0_power_limit_uw";
+	FILE *fp = fopen(path.c_str(), "w");
+	if (fp == NULL) {
+		perror("powercap:fopen");
+		fprintf(stderr, "Trying to write %s\n", path.c_str());
+		return false;
+	}
+	bool ok = fprintf(fp, "%llu\n", (unsigned long long)uw) > 0;
+	// sysfs reports a rejected value when the buffer is flushed
+	ok = fclose(fp) == 0 && ok;
+	if (!ok) {
+		perror("powercap:write");
+	}
+	return ok;
+}
+
+bool PowercapBackend::set_power_limit(int socket, double watts) {
+	return write_limit(socket, (uint64_t)(watts * 1e6));
+}
+
+bool PowercapBackend::restore_power_limit(int socket, uint64_t raw) {
+	return write_limit(socket, raw);
+}
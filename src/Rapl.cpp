@@ -4,491 +4,417 @@
  Please refer to LICENSE for more details.
  */
 #include <cstdio>
+#include <cstdlib>
 #include <string>
-#include <sstream>
 #include <unistd.h>
-#include <fcntl.h>
-#include <cmath>
-#include <sys/time.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 
 
 #include "Rapl.h"
+#include "Affinity.h"
+#include "Topology.h"
 
-#define MSR_RAPL_POWER_UNIT            0x606
 
-/*
- * Platform specific RAPL Domains.
- * Note that PP1 RAPL Domain is supported on 062A only
- * And DRAM RAPL Domain is supported on 062D only
- */
-/* Package RAPL Domain */
-#define MSR_PKG_RAPL_POWER_LIMIT       0x610
-#define MSR_PKG_ENERGY_STATUS          0x611
-#define MSR_PKG_PERF_STATUS            0x13
-#define MSR_PKG_POWER_INFO             0x614
-
-/* PP0 RAPL Domain */
-#define MSR_PP0_POWER_LIMIT            0x638
-#define MSR_PP0_ENERGY_STATUS          0x639
-#define MSR_PP0_POLICY                 0x63A
-#define MSR_PP0_PERF_STATUS            0x63B
-
-/* PP1 RAPL Domain, may reflect to uncore devices */
-#define MSR_PP1_POWER_LIMIT            0x640
-#define MSR_PP1_ENERGY_STATUS          0x641
-#define MSR_PP1_POLICY                 0x642
-
-/* DRAM RAPL Domain */
-#define MSR_DRAM_POWER_LIMIT           0x618
-#define MSR_DRAM_ENERGY_STATUS         0x619
-#define MSR_DRAM_PERF_STATUS           0x61B
-#define MSR_DRAM_POWER_INFO            0x61C
-
-/* RAPL UNIT BITMASK */
-#define POWER_UNIT_OFFSET              0
-#define POWER_UNIT_MASK                0x0F
-
-#define ENERGY_UNIT_OFFSET             0x08
-#define ENERGY_UNIT_MASK               0x1F00
-
-#define TIME_UNIT_OFFSET               0x10
-#define TIME_UNIT_MASK                 0xF000
-
-#define SIGNATURE_MASK                 0xFFFF0
-
-/* AMD MSR DEFINES */
-#define AMD_MSR_PWR_UNIT 	       0xC0010299
-#define AMD_MSR_CORE_ENERGY 	       0xC001029A
-#define AMD_MSR_PACKAGE_ENERGY         0xC001029B
-
-#define AMD_TIME_UNIT_MASK             0xF0000
-#define AMD_ENERGY_UNIT_MASK           0x1F00
-#define AMD_POWER_UNIT_MASK            0xF
-
-// CPU signature codes, useful for filtering uncompatible measures
-#define IVYBRIDGE_E                    0x306F0
-#define SANDYBRIDGE_E                  0x206D0
-#define COFFEE_LAKE                    0x906E0
-#define SKYLAKE_SERVER                 0x50650
-#define BROADWELL_E                    0x406F0
-
-
-Rapl::Rapl() {
-
-	vendor = get_vendor();
-	n_sockets = get_n_sockets();
-	smt = get_smt();
-	n_logical_cores = get_n_logical_cores();
-	pp1_supported = detect_pp1();
+Rapl::Rapl(bool per_core, int type) {
 
-	for (int i=0; i<n_sockets; i++){
-		open_msr(i, first_lcoreid[i]);
+	pthread_mutex_init(&lock, NULL);
+	get_topology()->print(stdout);
+	backend = create_rapl_backend(type, per_core);
+	printf("RAPL backend: %s\n", backend->name());
+	n_sockets = backend->get_n_sockets();
+	for (int d=0; d<RAPL_DOMAINS; d++){
+		units[d] = backend->energy_units(d);
+		max_count[d] = backend->max_count(d);
 	}
-	/* Read MSR_RAPL_POWER_UNIT Register */
-	uint64_t raw_value;
-	printf("trying vendor units %u\n", vendor);
-	if (vendor == 0){
-		raw_value = read_msr(0, MSR_RAPL_POWER_UNIT);
-	} else if (vendor == 1){
-		raw_value = read_msr(0, AMD_MSR_PWR_UNIT);
+	raw_all.assign(n_sockets * RAPL_DOMAINS, 0);
+	n_cores = per_core ? backend->get_n_cores() : 0;
+	if (per_core && n_cores == 0) {
+		printf("The %s backend has no per-core counters, disabling per-core mode\n", backend->name());
 	}
-	power_units = pow(0.5,	(double) (raw_value & 0xf));
-	energy_units = pow(0.5,	(double) ((raw_value >> 8) & 0x1f));
-	time_units = pow(0.5,	(double) ((raw_value >> 16) & 0xf));
-
-	/* Read MSR_PKG_POWER_INFO Register */
-	if (vendor==0){
-		raw_value = read_msr(0, MSR_PKG_POWER_INFO);
-		thermal_spec_power = power_units * ((double)(raw_value & 0x7fff));
-		minimum_power = power_units * ((double)((raw_value >> 16) & 0x7fff));
-		maximum_power = power_units * ((double)((raw_value >> 32) & 0x7fff));
-		time_window = time_units * ((double)((raw_value >> 48) & 0x7fff));
-	} else if (vendor == 1){
-		thermal_spec_power = 0; 
-		minimum_power = 0;
-		maximum_power = 0;
-		time_window = 0;
-	
+	core_raw.assign(n_cores, 0);
+	core_last.assign(n_cores, 0);
+	core_prev.assign(n_cores, 0);
+	core_curr.assign(n_cores, 0);
+	core_total.assign(n_cores, 0);
+
+	// prev, current, next, running total and last raw read of every socket
+	void *block;
+	if (posix_memalign(&block, CACHE_LINE, sizeof(rapl_state_t) * 5 * n_sockets) != 0) {
+		perror("Rapl:posix_memalign");
+		exit(EXIT_FAILURE);
 	}
+	states = (rapl_state_t*)block;
+	memset(states, 0, sizeof(rapl_state_t) * 5 * n_sockets);
+	prev_state.resize(n_sockets);
+	current_state.resize(n_sockets);
+	next_state.resize(n_sockets);
+	running_total.resize(n_sockets);
+	last_raw.resize(n_sockets);
+	for (int i=0; i<n_sockets; i++){
+		prev_state[i] = &states[5*i];
+		current_state[i] = &states[5*i + 1];
+		next_state[i] = &states[5*i + 2];
+		running_total[i] = &states[5*i + 3];
+		last_raw[i] = &states[5*i + 4];
+	}
+	guard_running = false;
+	guard_ns = 0;
+	guard_reads = 0;
 	reset();
 }
 
+Rapl::~Rapl() {
+	stop_guard();
+	free(states);
+	delete backend;
+}
+
+// Start a new measurement window, reuses the preallocated state
 void Rapl::reset() {
 
+	pthread_mutex_lock(&lock);
 	for (int i=0; i<n_sockets; i++){
-		prev_state[i] = new rapl_state_t;
-		current_state[i] = new rapl_state_t;
-		next_state[i] = new rapl_state_t;
-		running_total[i] = new rapl_state_t;
-
-		// sample twice to fill current and previous
-		sample(i);
+		// anchor the raw counters, then start every total from 0
 		sample(i);
-
-		// Initialize running_total
-		running_total[i]->pkg = 0;
-		running_total[i]->pp0 = 0;
-		running_total[i]->dram = 0;
-		gettimeofday(&(running_total[i]->tsc), NULL);
+		memset(running_total[i]->e, 0, sizeof(running_total[i]->e));
+		memset(current_state[i]->e, 0, sizeof(current_state[i]->e));
+		memcpy(prev_state[i], current_state[i], sizeof(rapl_state_t));
 	}
+	start_ns = current_state[0]->ns;
+	if (n_cores > 0) {
+		sample_cores();
+		for (int c=0; c<n_cores; c++) {
+			core_total[c] = 0;
+			core_prev[c] = core_curr[c] = 0;
+		}
+		core_prev_ns = core_start_ns = core_curr_ns;
+	}
+	pthread_mutex_unlock(&lock);
 }
-int Rapl::get_n_logical_cores(){
-	uint32_t eax, ebx, ecx, edx;
-	__asm__("mov $0x0000000B, %%eax;" // set eax to 0x0000000B
-		"mov $0x01, %%ecx;" // set ecx to 0x01
-		"cpuid;" // execute cpuid
-		:"=a"(eax), "=b"(ebx), "=d"(edx), "=c"(ecx) // output operands
-		: // no input operand
-		);
-	printf("Logical cores = %u\n", ebx & 0xFF);
-	return ebx & 0xFF; // print the string
-}
-int Rapl::get_smt(){
-
-	uint32_t eax, ebx, ecx, edx;
-	if (vendor==1){
-		__asm__("mov $0x8000001E, %%eax;" // set eax to 0x0000000B
-			"cpuid;" // execute cpuid
-			:"=a"(eax), "=b"(ebx), "=d"(edx), "=c"(ecx) // output operands
-			: // no input operand
-			);
-
-		return (ebx & 0xFF00) >> 8;
-	} else {
-		printf("Get hyperthreading not yet implemented for intel. Assuming disabled\n");
-		return 0;
+
+// Sample every socket, all counters come from one batched backend read
+void Rapl::sample(){
+	pthread_mutex_lock(&lock);
+	backend->read_all(raw_all.data());
+	uint64_t ns = now_ns();
+	for (int i=0; i<n_sockets; i++){
+		update(i, &raw_all[i*RAPL_DOMAINS], ns);
+	}
+	if (n_cores > 0) {
+		sample_cores();
 	}
+	pthread_mutex_unlock(&lock);
 }
-int Rapl::get_vendor(){
-	int v = 0;
-	uint32_t eax = 0;
-	union {
-	    struct {
-		uint32_t ebx;
-		uint32_t edx;
-		uint32_t ecx;
-	    };
-	    char vendor[13];
-	} u;
-	__asm__("cpuid;"
-		:"=a"(eax), "=b"(u.ebx), "=d"(u.edx), "=c"(u.ecx) // output operands
-		:"0"(eax) // input operand
-		);
-	u.vendor[12] = '\0'; // add the null terminator
-
-	printf("vendor = %s\n", u.vendor); // print the string
-	if (strcmp(u.vendor, "AuthenticAMD") == 0) {
-	    v = 1;
-	} else {
-	    v = 0;
+
+/*
+Energy consumed since reset() in Joules, read directly from the counters without
+rotating the sampler state. Costs one counter read per domain and socket.
+*/
+void Rapl::snapshot(double *pkg, double *dram) {
+	uint64_t e_pkg = 0, e_dram = 0;
+
+	pthread_mutex_lock(&lock);
+	backend->read_all(raw_all.data());
+	uint64_t ns = now_ns();
+	for (int i=0; i<n_sockets; i++){
+		fold(i, &raw_all[i*RAPL_DOMAINS], ns);
+		e_pkg += running_total[i]->e[RAPL_PKG];
+		e_dram += running_total[i]->e[RAPL_DRAM];
 	}
+	pthread_mutex_unlock(&lock);
+	*pkg = units[RAPL_PKG] * (double)e_pkg;
+	*dram = units[RAPL_DRAM] * (double)e_dram;
+}
 
-	
-	return v;
-
-}
-
-bool Rapl::detect_pp1() {
-	uint32_t eax_input = 1;
-	uint32_t eax;
-	__asm__("cpuid;"
-			:"=a"(eax)               // EAX into b (output)
-			:"0"(eax_input)          // 1 into EAX (input)
-			:"%ebx","%ecx","%edx");  // clobbered registers
-	
-	printf("eax = %X\n", eax);
-
-	uint32_t cpu_signature = eax & SIGNATURE_MASK;
-    	#ifdef POWER_DEBUG
-        	printf("CPU signature: %x\n", cpu_signature); fflush(stdout);
-    	#endif
-	if (vendor == 1 || cpu_signature == SANDYBRIDGE_E || cpu_signature == IVYBRIDGE_E || cpu_signature == BROADWELL_E) {
-		#ifdef POWER_DEBUG
-			printf("PP1 measure not compatible for CPU signature: %x\n", cpu_signature); fflush(stdout);
-		#endif
-		return false;
+void Rapl::sample(int socket) {
+	uint64_t raw[RAPL_DOMAINS];
+	backend->read(socket, raw);
+	update(socket, raw, now_ns());
+}
+
+// Unwrap the counters read at ns into the running total, without touching the sample states
+void Rapl::fold(int socket, const uint64_t *raw, uint64_t ns) {
+	for (int d=0; d<RAPL_DOMAINS; d++){
+		running_total[socket]->e[d] += energy_delta(last_raw[socket]->e[d], raw[d], max_count[d]);
 	}
-	return true;
-}
-
-void Rapl::open_msr(int socket, int cpuCore) {
-	std::stringstream filename_stream;
-	filename_stream << "/dev/cpu/" << cpuCore << "/msr";
-	fd[socket] = open(filename_stream.str().c_str(), O_RDONLY);
-	if (fd[socket] < 0) {
-		if ( errno == ENXIO) {
-			fprintf(stderr, "rdmsr: No CPU %d\n", cpuCore);
-			exit(2);
-		} else if ( errno == EIO) {
-			fprintf(stderr, "rdmsr: CPU %d doesn't support MSRs\n", cpuCore);
-			exit(3);
-		} else {
-			perror("rdmsr:open");
-			fprintf(stderr, "Trying to open %s\n",
-					filename_stream.str().c_str());
-			exit(127);
-		}
+	memcpy(last_raw[socket]->e, raw, sizeof(last_raw[socket]->e));
+	last_raw[socket]->ns = ns;
+}
+
+/*
+The sample states hold the running total at their timestamp, not raw counters,
+so the power between two samples stays exact however many times the hardware
+counter wrapped in between, as long as something folded it in time.
+*/
+void Rapl::update(int socket, const uint64_t *raw, uint64_t ns) {
+	fold(socket, raw, ns);
+	memcpy(next_state[socket]->e, running_total[socket]->e, sizeof(next_state[socket]->e));
+	next_state[socket]->ns = ns;
+
+	// Rotate states
+	rapl_state_t *pprev_state = prev_state[socket];
+	prev_state[socket] = current_state[socket];
+	current_state[socket] = next_state[socket];
+	next_state[socket] = pprev_state;
+}
+
+void Rapl::fold_cores() {
+	backend->read_cores(core_raw.data());
+	uint64_t max = backend->core_max_count();
+	for (int c=0; c<n_cores; c++) {
+		core_total[c] += energy_delta(core_last[c], core_raw[c], max);
+		core_last[c] = core_raw[c];
 	}
 }
 
-uint64_t Rapl::read_msr(int socket, uint32_t msr_offset) {
-	uint64_t data;
-	if (pread(fd[socket], &data, sizeof(data), msr_offset) != sizeof(data)) {
-		perror("read_msr():pread");
-		exit(127);
+void Rapl::sample_cores() {
+	fold_cores();
+	core_prev_ns = core_curr_ns;
+	core_curr_ns = now_ns();
+	for (int c=0; c<n_cores; c++) {
+		core_prev[c] = core_curr[c];
+		core_curr[c] = core_total[c];
 	}
-	return data;
 }
 
-void Rapl::sample(){
+// Read every counter and fold it, called with the lock held
+void Rapl::fold_all() {
+	backend->read_all(raw_all.data());
+	uint64_t ns = now_ns();
 	for (int i=0; i<n_sockets; i++){
-		sample(i);
+		fold(i, &raw_all[i*RAPL_DOMAINS], ns);
+	}
+	if (n_cores > 0) {
+		fold_cores();
 	}
+	guard_reads++;
 }
-void Rapl::sample(int socket) {
-	uint32_t max_int = ~((uint32_t) 0);
-
-	if (vendor==0) {
-		next_state[socket]->pkg = read_msr(socket, MSR_PKG_ENERGY_STATUS) & max_int;
-		next_state[socket]->pp0 = read_msr(socket, MSR_PP0_ENERGY_STATUS) & max_int;
-		if (pp1_supported) {
-			next_state[socket]->pp1 = read_msr(socket, MSR_PP1_ENERGY_STATUS) & max_int;
-			next_state[socket]->dram = 0;
-		} else {
-			next_state[socket]->pp1 = 0;
-			next_state[socket]->dram = read_msr(socket, MSR_DRAM_ENERGY_STATUS) & max_int;
-		}
-	} else if (vendor==1) {
-		uint64_t val = read_msr(socket, AMD_MSR_PACKAGE_ENERGY) & max_int;
-		next_state[socket]->pkg = val;
-		next_state[socket]->pp0 = 0;
-		next_state[socket]->pp1 = 0;
-		next_state[socket]->dram = 0;
+
+/*
+Read the counters every period_ns in the background so none of them can wrap
+twice between two reads, whatever interval the samplers use. Pick the period
+from wrap_time(); reads share the lock with sample() and cost one read_all.
+*/
+void Rapl::start_guard(uint64_t period_ns) {
+	if (guard_running || period_ns == 0) {
+		return;
+	}
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&guard_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	guard_ns = period_ns;
+	guard_running = true;
+	int code = pthread_create(&guard, NULL, guard_func, (void*)this);
+	if (code) {
+		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+		exit(0);
 	}
+}
 
-	gettimeofday(&(next_state[socket]->tsc), NULL);
+void Rapl::stop_guard() {
+	if (!guard_running) {
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	guard_running = false;
+	pthread_cond_signal(&guard_cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(guard, NULL);
+	pthread_cond_destroy(&guard_cond);
+}
 
+unsigned long Rapl::get_guard_reads() {
+	return guard_reads;
+}
 
-	// Update running total
-	running_total[socket]->pkg += energy_delta(current_state[socket]->pkg, next_state[socket]->pkg);
-	running_total[socket]->pp0 += energy_delta(current_state[socket]->pp0, next_state[socket]->pp0);
-	running_total[socket]->pp1 += energy_delta(current_state[socket]->pp0, next_state[socket]->pp0);
-	running_total[socket]->dram += energy_delta(current_state[socket]->dram, next_state[socket]->dram);
+void *Rapl::guard_func(void *ptr) {
+	Rapl *rapl = (Rapl*)ptr;
+	struct timespec ts;
+	affinity_apply(false);
+	pthread_mutex_lock(&rapl->lock);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	while (rapl->guard_running) {
+		uint64_t next = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + rapl->guard_ns;
+		ts.tv_sec = next / 1000000000ULL;
+		ts.tv_nsec = next % 1000000000ULL;
+		// sleeps without the lock, a stop_guard() signal ends the wait early
+		while (rapl->guard_running && pthread_cond_timedwait(&rapl->guard_cond, &rapl->lock, &ts) == 0);
+		if (rapl->guard_running) {
+			rapl->fold_all();
+		}
+	}
+	pthread_mutex_unlock(&rapl->lock);
+	pthread_exit(0);
+}
 
-	// Rotate states
-	rapl_state_t *pprev_state = prev_state[socket];
-	prev_state[socket] = current_state[socket];
-	current_state[socket] = next_state[socket];
-	next_state[socket] = pprev_state;
+double Rapl::time_delta(uint64_t begin, uint64_t end) {
+	return (double)(int64_t)(end - begin) / 1e9;
 }
 
-double Rapl::time_delta(struct timeval *begin, struct timeval *end) {
-        return (end->tv_sec - begin->tv_sec)
-                + ((end->tv_usec - begin->tv_usec)/1000000.0);
+uint64_t Rapl::now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-double Rapl::power(uint64_t before, uint64_t after, double time_delta) {
+double Rapl::power(int domain, uint64_t before, uint64_t after, double time_delta) {
 	if (time_delta == 0.0f || time_delta == -0.0f) { return 0.0; }
-	double energy = energy_units * ((double) energy_delta(before,after));
+	double energy = units[domain] * ((double) energy_delta(before, after, max_count[domain]));
 	return energy / time_delta;
 }
 
-uint64_t Rapl::energy_delta(uint64_t before, uint64_t after) {
-	uint64_t max_int = ~((uint32_t) 0);
+uint64_t Rapl::energy_delta(uint64_t before, uint64_t after, uint64_t max) {
 	uint64_t eng_delta = after - before;
 
 	// Check for rollovers
 	if (before > after) {
-		eng_delta = after + (max_int - before);
+		eng_delta = after + (max - before);
 	}
 
 	return eng_delta;
 }
 
-double Rapl::pkg_current_power() {
+const char *Rapl::backend_name() {
+	return backend->name();
+}
+
+RaplBackend *Rapl::get_backend() {
+	return backend;
+}
+
+bool Rapl::has_domain(int domain) {
+	return backend->has_domain(domain);
+}
+
+double Rapl::current_power(int domain) {
 	double p = 0.0;
 	for (int i=0; i<n_sockets; i++){
-		double t = time_delta(&(prev_state[i]->tsc), &(current_state[i]->tsc));
-		double pp = power(prev_state[i]->pkg, current_state[i]->pkg, t);
-		p+=pp;
+		double t = time_delta(prev_state[i]->ns, current_state[i]->ns);
+		p += power(domain, prev_state[i]->e[domain], current_state[i]->e[domain], t);
 	}
 	return p;
 }
 
-double Rapl::pp0_current_power() {
+double Rapl::average_power(int domain) {
+	return total_energy(domain) / total_time();
+}
+
+/*
+Energy up to the last sample. The sample states hold the running total at their
+timestamp, running_total itself keeps moving under the lock (wrap guard, snapshot()).
+*/
+double Rapl::total_energy(int domain) {
 	double p = 0.0;
 	for (int i=0; i<n_sockets; i++){
-		double t = time_delta(&(prev_state[i]->tsc), &(current_state[i]->tsc));
-		p+= power(prev_state[i]->pp0, current_state[i]->pp0, t);
+		p += units[domain] * ((double) current_state[i]->e[domain]);
 	}
 	return p;
 }
 
+double Rapl::pkg_current_power() {
+	return current_power(RAPL_PKG);
+}
+
+double Rapl::pp0_current_power() {
+	return current_power(RAPL_PP0);
+}
+
 double Rapl::pp1_current_power() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		double t = time_delta(&(prev_state[i]->tsc), &(current_state[i]->tsc));
-		p += power(prev_state[i]->pp1, current_state[i]->pp1, t);
-	}
+	return current_power(RAPL_PP1);
 }
 
 double Rapl::dram_current_power() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		double t = time_delta(&(prev_state[i]->tsc), &(current_state[i]->tsc));
-		p+=power(prev_state[i]->dram, current_state[i]->dram, t);
-	}
-	return p;
+	return current_power(RAPL_DRAM);
 }
 
 double Rapl::pkg_average_power() {
-	return pkg_total_energy() / total_time();
+	return average_power(RAPL_PKG);
 }
 
 double Rapl::pp0_average_power() {
-	return pp0_total_energy() / total_time();
+	return average_power(RAPL_PP0);
 }
 
 double Rapl::pp1_average_power() {
-	return pp1_total_energy() / total_time();
+	return average_power(RAPL_PP1);
 }
 
 double Rapl::dram_average_power() {
-	return dram_total_energy() / total_time();
+	return average_power(RAPL_DRAM);
 }
 
 double Rapl::pkg_total_energy() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		p += energy_units * ((double) running_total[i]->pkg);
-	}
-	return p;
+	return total_energy(RAPL_PKG);
 }
 
 double Rapl::pp0_total_energy() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		p += energy_units * ((double) running_total[i]->pp0);
-	}
-	return p;
+	return total_energy(RAPL_PP0);
 }
 
 double Rapl::pp1_total_energy() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		p += energy_units * ((double) running_total[i]->pp1);
-	}
-	return p;
+	return total_energy(RAPL_PP1);
 }
 
 double Rapl::dram_total_energy() {
-	double p = 0.0;
-	for (int i=0; i<n_sockets; i++){
-		p += energy_units * ((double) running_total[i]->dram);
-	}
-	return p;
+	return total_energy(RAPL_DRAM);
 }
 
 double Rapl::total_time() {
-	return time_delta(&(running_total[0]->tsc), &(current_state[0]->tsc));
+	return time_delta(start_ns, current_state[0]->ns);
 }
 
 double Rapl::current_time() {
-	return time_delta(&(prev_state[0]->tsc), &(current_state[0]->tsc));
+	return time_delta(prev_state[0]->ns, current_state[0]->ns);
 }
 
-int Rapl::get_n_sockets(){
-    FILE *fp;
-    char line[MAX_LINE];
-    int cpu[MAX_CPU];
-    int i, n, id, count;
-
-    // initialize cpu array to -1
-    for (i = 0; i < MAX_CPU; i++) {
-        cpu[i] = -1;
-    }
-
-    // open the file
-    fp = fopen("/sys/devices/system/cpu/online", "r");
-    if (fp == NULL) {
-        perror("fopen");
-        exit(EXIT_FAILURE);
-    }
-
-    // read the first line
-    if (fgets(line, MAX_LINE, fp) == NULL) {
-        perror("fgets");
-        exit(EXIT_FAILURE);
-    }
-
-    // close the file
-    fclose(fp);
-
-    // parse the line and store the online cpu numbers in cpu array
-    // This assumes that cpus are listed as "0-3,4-8,3-5"
-    n = 0; // number of online cpus
-    char *token = strtok(line, ",");
-    while (token != NULL) {
-        if (strchr(token, '-') != NULL) {
-            // range of cpus
-            int start, end;
-            sscanf(token, "%d-%d", &start, &end);
-            for (i = start; i <= end; i++) {
-                cpu[n++] = i;
-            }
-        } else {
-            // single cpu
-            cpu[n++] = atoi(token);
-        }
-        token = strtok(NULL, ",");
-    }
-
-    // count the number of unique physical ids for online cpus
-    count = 0; // number of sockets
-    int curr_id = 0;
-    for (i=0; i<MAX_SOCKETS; i++){
-    	sockets[i] = -1;
-	first_lcoreid[i] = -1;
-    }
-    for (i = 0; i < n; i++) {
-        // construct the file name for each cpu
-        char filename[MAX_LINE];
-        sprintf(filename, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu[i]);
-
-        // open the file
-        fp = fopen(filename, "r");
-        if (fp == NULL) {
-            perror("fopen");
-            exit(EXIT_FAILURE);
-        }
-
-        // read the physical id
-        if (fscanf(fp, "%d", &id) != 1) {
-            perror("fscanf");
-            exit(EXIT_FAILURE);
-        }
-
-        // close the file
-        fclose(fp);
-	if (sockets[id] == -1){
-		sockets[id] = 1;
-		first_lcoreid[id] = i;
+/*
+Shortest time in seconds any sampled counter can take to wrap at the highest
+power its socket can draw. Two wraps between samples cannot be told apart from
+one, so sampling intervals must stay well below this.
+*/
+double Rapl::wrap_time() {
+	double wrap = 1e30;
+	for (int d=0; d<RAPL_DOMAINS; d++){
+		if (!backend->has_domain(d)) {
+			continue;
+		}
+		double p = backend->max_power(d) > 0.0 ? backend->max_power(d) : RAPL_WRAP_POWER;
+		double t = units[d] * (double)max_count[d] / p;
+		wrap = t < wrap ? t : wrap;
 	}
-    }
+	if (n_cores > 0) {
+		double t = backend->core_energy_units() * (double)backend->core_max_count() / RAPL_WRAP_POWER;
+		wrap = t < wrap ? t : wrap;
+	}
+	return wrap;
+}
 
+int Rapl::get_n_sockets(){
+	return n_sockets;
+}
+
+int Rapl::get_n_cores() {
+	return n_cores;
+}
 
-    count = 0;
-    for (i=0; i<MAX_SOCKETS; i++){
-	    if (sockets[i] == 1){
-	    	count++;
-	    }
-    }
+int Rapl::core_cpu(int core) {
+	return backend->core_cpu(core);
+}
 
-    // print the result
-    printf("Number of sockets: %d\n", count);
+double Rapl::core_current_power(int core) {
+	double t = time_delta(core_prev_ns, core_curr_ns);
+	if (t == 0.0) { return 0.0; }
+	return backend->core_energy_units() * (double)energy_delta(core_prev[core], core_curr[core], backend->core_max_count()) / t;
+}
 
-    return count;
+// like total_energy(), core_total is folded by the wrap guard too
+double Rapl::core_total_energy(int core) {
+	return backend->core_energy_units() * (double)core_curr[core];
+}
 
+double Rapl::core_average_power(int core) {
+	double t = time_delta(core_start_ns, core_curr_ns);
+	return t > 0.0 ? core_total_energy(core) / t : 0.0;
 }
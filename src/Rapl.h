@@ -6,58 +6,92 @@
 #include <unistd.h>
 #include <cstdint>
 #include <cstring>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+
+#include "RaplBackend.h"
 
 #ifndef RAPL_H_
 #define RAPL_H_
 
-#define MAX_LINE 256
-#define MAX_CPU 256
-#define MAX_SOCKETS 8
+#define CACHE_LINE 64
+// power assumed for the wrap time of a socket whose backend reports no maximum
+#define RAPL_WRAP_POWER 500.0
+// the wrap guard reads the counters this many times per wrap time
+#define RAPL_GUARD_FRACTION 4
 
-struct rapl_state_t {
-	uint64_t pkg;
-	uint64_t pp0;
-	uint64_t pp1;
-	uint64_t dram;
-	struct timeval tsc;
+// One counter snapshot, padded to a cache line so sockets never share lines
+struct alignas(CACHE_LINE) rapl_state_t {
+	uint64_t e[RAPL_DOMAINS];
+	// CLOCK_MONOTONIC_RAW nanoseconds, immune to NTP slewing
+	uint64_t ns;
 };
 
 class Rapl {
 
 private:
 	// Rapl configuration
-	int fd[MAX_SOCKETS];
-	int core = 0;
-	bool pp1_supported = true;
-	//vendor 0=Intel, 1=AMD
-	int vendor;
+	RaplBackend *backend;
 	int n_sockets;
-	int smt;
-	int n_logical_cores;
-	int sockets[MAX_SOCKETS];
-	int first_lcoreid[MAX_SOCKETS];
-	double power_units, energy_units, time_units;
-	double thermal_spec_power, minimum_power, maximum_power, time_window;
-
-	// Rapl state
-	rapl_state_t *current_state[MAX_SOCKETS];
-	rapl_state_t *prev_state[MAX_SOCKETS];
-	rapl_state_t *next_state[MAX_SOCKETS];
-	rapl_state_t *running_total[MAX_SOCKETS];
-
-	bool detect_pp1();
-	int get_vendor();
-	void open_msr(int socket, int core);
-	uint64_t read_msr(int socket, uint32_t msr_offset);
-	double time_delta(struct timeval *begin, struct timeval *after);
-	uint64_t energy_delta(uint64_t before, uint64_t after);
-	double power(uint64_t before, uint64_t after, double time_delta);
+	double units[RAPL_DOMAINS];
+	uint64_t max_count[RAPL_DOMAINS];
+
+	// Rapl state, all of it lives in one aligned block allocated by the constructor
+	rapl_state_t *states;
+	std::vector<rapl_state_t*> current_state;
+	std::vector<rapl_state_t*> prev_state;
+	std::vector<rapl_state_t*> next_state;
+	std::vector<rapl_state_t*> running_total;
+	// raw counters of the last read by anyone, running_total is unwrapped up to here
+	std::vector<rapl_state_t*> last_raw;
+	// timestamp of the reset() every total counts from
+	uint64_t start_ns;
+	// serializes the sampler thread, the wrap guard and snapshot() callers
+	pthread_mutex_t lock;
+	// raw counters of all sockets from one backend->read_all()
+	std::vector<uint64_t> raw_all;
+
+	// Per-core state, one entry per physical core of the backend
+	int n_cores;
+	std::vector<uint64_t> core_raw;
+	std::vector<uint64_t> core_last;
+	std::vector<uint64_t> core_prev;
+	std::vector<uint64_t> core_curr;
+	std::vector<uint64_t> core_total;
+	uint64_t core_prev_ns, core_curr_ns, core_start_ns;
+
+	// background reader that keeps the counters from wrapping twice unseen
+	pthread_t guard;
+	pthread_cond_t guard_cond;
+	bool guard_running;
+	uint64_t guard_ns;
+	unsigned long guard_reads;
+
+	void sample_cores();
+	void fold_cores();
+	void fold(int socket, const uint64_t *raw, uint64_t ns);
+	void fold_all();
+	void update(int socket, const uint64_t *raw, uint64_t ns);
+	static void *guard_func(void *ptr);
+	double time_delta(uint64_t begin, uint64_t end);
+	uint64_t energy_delta(uint64_t before, uint64_t after, uint64_t max);
+	double power(int domain, uint64_t before, uint64_t after, double time_delta);
 
 public:
-	Rapl();
+	Rapl(bool per_core = false, int backend = RAPL_BACKEND_AUTO);
+	~Rapl();
 	void reset();
 	void sample();
 	void sample(int socket);
+	void snapshot(double *pkg, double *dram);
+
+	const char *backend_name();
+	RaplBackend *get_backend();
+	bool has_domain(int domain);
+	double current_power(int domain);
+	double average_power(int domain);
+	double total_energy(int domain);
 
 	double pkg_current_power();
 	double pp0_current_power();
@@ -77,8 +111,17 @@ public:
 	double total_time();
 	double current_time();
 	int get_n_sockets();
-	int get_n_logical_cores();
-	int get_smt();
+	double wrap_time();
+	void start_guard(uint64_t period_ns);
+	void stop_guard();
+	unsigned long get_guard_reads();
+	static uint64_t now_ns();
+
+	int get_n_cores();
+	int core_cpu(int core);
+	double core_current_power(int core);
+	double core_average_power(int core);
+	double core_total_energy(int core);
 };
 
 #endif /* RAPL_H_ */
@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#include "RaplBackend.h"
+
+RaplBackend *create_rapl_backend(int type, bool per_core) {
+	switch (type) {
+		case RAPL_BACKEND_MSR: return new MsrBackend(per_core);
+		case RAPL_BACKEND_POWERCAP: return new PowercapBackend();
+		case RAPL_BACKEND_PERF: return new PerfBackend();
+	}
+	// auto: direct MSR access is the cheapest and the only one with per-core counters
+	if (MsrBackend::available()) {
+		return new MsrBackend(per_core);
+	}
+	if (PowercapBackend::available()) {
+		return new PowercapBackend();
+	}
+	if (PerfBackend::available()) {
+		return new PerfBackend();
+	}
+	fprintf(stderr, "No RAPL energy source available: load the msr module and run as root, "
+	                "or make /sys/class/powercap/intel-rapl:*/energy_uj readable, "
+	                "or lower /proc/sys/kernel/perf_event_paranoid\n");
+	exit(127);
+}
+
+int rapl_backend_type(const char *name) {
+	if (strcmp(name, "auto") == 0) return RAPL_BACKEND_AUTO;
+	if (strcmp(name, "msr") == 0) return RAPL_BACKEND_MSR;
+	if (strcmp(name, "powercap") == 0) return RAPL_BACKEND_POWERCAP;
+	if (strcmp(name, "perf") == 0) return RAPL_BACKEND_PERF;
+	return -1;
+}
+
+int parse_cpu_list(const char *list, std::vector<int> &cpus){
+    std::vector<char> line(list, list + strlen(list) + 1);
+
+    cpus.clear();
+    char *save;
+    char *token = strtok_r(line.data(), ",\n", &save);
+    while (token != NULL) {
+        if (strchr(token, '-') != NULL) {
+            // range of cpus
+            int start, end;
+            if (sscanf(token, "%d-%d", &start, &end) == 2) {
+                for (int i = start; i <= end; i++) {
+                    cpus.push_back(i);
+                }
+            }
+        } else {
+            // single cpu
+            cpus.push_back(atoi(token));
+        }
+        token = strtok_r(NULL, ",\n", &save);
+    }
+    return cpus.size();
+}
@@ -0,0 +1,226 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <unistd.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "MsrPool.h"
+
+#ifndef RAPL_BACKEND_H_
+#define RAPL_BACKEND_H_
+
+#define MAX_LINE 256
+
+// RAPL domains, index of the raw counter arrays
+#define RAPL_PKG      0
+#define RAPL_PP0      1
+#define RAPL_PP1      2
+#define RAPL_DRAM     3
+#define RAPL_DOMAINS  4
+
+// energy sources
+#define RAPL_BACKEND_AUTO      0
+#define RAPL_BACKEND_MSR       1
+#define RAPL_BACKEND_POWERCAP  2
+#define RAPL_BACKEND_PERF      3
+
+/*
+Source of the raw RAPL energy counters. Rapl keeps the sampling state and does
+the arithmetic; a backend only knows how to read counters and how to scale and
+unwrap them.
+*/
+class RaplBackend {
+
+public:
+	virtual ~RaplBackend() {}
+	virtual const char *name() = 0;
+	virtual int get_n_sockets() = 0;
+	virtual bool has_domain(int domain) = 0;
+	// raw[RAPL_DOMAINS] counters of one socket, unsupported domains read 0
+	virtual void read(int socket, uint64_t *raw) = 0;
+	// raw[socket*RAPL_DOMAINS + domain] for every socket, in as few round trips as possible
+	virtual void read_all(uint64_t *raw) {
+		for (int i=0; i<get_n_sockets(); i++) {
+			read(i, raw + i*RAPL_DOMAINS);
+		}
+	}
+	// Joules per raw count
+	virtual double energy_units(int domain) = 0;
+	// largest raw value before the counter wraps to 0
+	virtual uint64_t max_count(int domain) = 0;
+	// upper bound of the power of one socket in Watts, 0 when the backend does not know
+	virtual double max_power(int domain) { return 0.0; }
+
+	// package power limit (PL1) of one socket in Watts, raw is the register or file as read for restoring it
+	virtual bool get_power_limit(int socket, double *watts, uint64_t *raw) { return false; }
+	virtual bool set_power_limit(int socket, double watts) { return false; }
+	virtual bool restore_power_limit(int socket, uint64_t raw) { return false; }
+
+	// optional per-core counters
+	virtual int get_n_cores() { return 0; }
+	virtual int core_cpu(int core) { return -1; }
+	virtual void read_cores(uint64_t *raw) {}
+	virtual double core_energy_units() { return 0.0; }
+	virtual uint64_t core_max_count() { return ~((uint32_t) 0); }
+};
+
+// msr-safe batch interface (/dev/cpu/msr_batch), layout as in msr_safe.h
+struct msr_batch_op_t {
+	uint16_t cpu;
+	uint16_t isrdmsr;
+	int32_t err;
+	uint32_t msr;
+	uint64_t msrdata;
+	uint64_t wmask;
+};
+
+struct msr_batch_array_t {
+	uint32_t numops;
+	msr_batch_op_t *ops;
+};
+
+/*
+Model specific registers through /dev/cpu/N/msr, needs the msr module and root.
+When msr-safe is loaded every domain of every socket (and every core in per-core
+mode) is read with a single batch ioctl; otherwise the sockets are read in
+parallel by an MsrPool.
+*/
+class MsrBackend : public RaplBackend {
+
+private:
+	// msr device of each socket
+	std::vector<int> fd;
+	bool pp1_supported = true;
+	//vendor 0=Intel, 1=AMD
+	int vendor;
+	int n_sockets;
+	int smt;
+	int n_logical_cores;
+	// cpu each socket is read from, see Topology
+	std::vector<int> first_lcoreid;
+	double power_units, energy_unit, time_units;
+	double thermal_spec_power, minimum_power, maximum_power, time_window;
+
+	// per-core mode (AMD core energy MSR), one entry per physical core
+	std::vector<int> core_cpus;
+	std::vector<int> core_fd;
+	MsrPool *core_pool;
+
+	// energy status MSR of each sampled domain
+	std::vector<int> domains;
+	std::vector<uint32_t> domain_msr;
+	MsrPool *socket_pool;
+	std::vector<uint64_t> socket_out;
+
+	// msr-safe batches, -1 when not available
+	int batch_fd;
+	std::vector<msr_batch_op_t> socket_ops;
+	std::vector<msr_batch_op_t> core_ops;
+
+	bool detect_pp1();
+	int get_vendor();
+	void open_msr(int socket, int core);
+	uint64_t read_msr(int socket, uint32_t msr_offset);
+	int count_sockets();
+	void open_cores();
+	void open_batch();
+	bool read_batch(std::vector<msr_batch_op_t> &ops);
+	bool write_msr(int socket, uint32_t msr_offset, uint64_t value);
+
+public:
+	MsrBackend(bool per_core);
+	~MsrBackend();
+	static bool available();
+	const char *name();
+	int get_n_sockets();
+	bool has_domain(int domain);
+	void read(int socket, uint64_t *raw);
+	void read_all(uint64_t *raw);
+	double energy_units(int domain);
+	uint64_t max_count(int domain);
+	double max_power(int domain);
+	bool get_power_limit(int socket, double *watts, uint64_t *raw);
+	bool set_power_limit(int socket, double watts);
+	bool restore_power_limit(int socket, uint64_t raw);
+	bool batched();
+
+	int get_n_cores();
+	int core_cpu(int core);
+	void read_cores(uint64_t *raw);
+	double core_energy_units();
+
+	int get_n_logical_cores();
+	int get_smt();
+};
+
+/*
+Linux powercap sysfs interface, /sys/class/powercap/intel-rapl:*.
+Every energy_uj file is kept open and re-read with pread at offset 0, so a
+sample costs one syscall per domain. Readable without root if the
+administrator relaxes the energy_uj permissions.
+*/
+class PowercapBackend : public RaplBackend {
+
+private:
+	int n_sockets;
+	// [socket][domain], sized by the topology
+	std::vector<std::array<int, RAPL_DOMAINS> > fd;
+	std::vector<std::array<uint64_t, RAPL_DOMAINS> > max_range;
+	std::vector<std::array<std::string, RAPL_DOMAINS> > zone;
+
+	void open_domain(int socket, int domain, const std::string &dir);
+	bool write_limit(int socket, uint64_t uw);
+
+public:
+	PowercapBackend();
+	~PowercapBackend();
+	static bool available();
+	const char *name();
+	int get_n_sockets();
+	bool has_domain(int domain);
+	void read(int socket, uint64_t *raw);
+	double energy_units(int domain);
+	uint64_t max_count(int domain);
+	bool get_power_limit(int socket, double *watts, uint64_t *raw);
+	bool set_power_limit(int socket, double watts);
+	bool restore_power_limit(int socket, uint64_t raw);
+};
+
+/*
+perf_event_open with the "power" PMU (energy-pkg, energy-cores, energy-gpu,
+energy-ram). Counters are 64 bit and accumulated by the kernel, so they do not
+wrap. Needs perf_event_paranoid <= 0 or CAP_PERFMON instead of root.
+*/
+class PerfBackend : public RaplBackend {
+
+private:
+	int n_sockets;
+	std::vector<std::array<int, RAPL_DOMAINS> > fd;
+	double scale[RAPL_DOMAINS];
+
+public:
+	PerfBackend();
+	~PerfBackend();
+	static bool available();
+	const char *name();
+	int get_n_sockets();
+	bool has_domain(int domain);
+	void read(int socket, uint64_t *raw);
+	double energy_units(int domain);
+	uint64_t max_count(int domain);
+};
+
+// Backend of the given type, RAPL_BACKEND_AUTO picks the first one that works
+RaplBackend *create_rapl_backend(int type, bool per_core);
+// Parse "msr", "powercap", "perf" or "auto", -1 if unknown
+int rapl_backend_type(const char *name);
+// Parse a cpu list such as "0,2,4-7"
+int parse_cpu_list(const char *list, std::vector<int> &cpus);
+
+#endif /* RAPL_BACKEND_H_ */
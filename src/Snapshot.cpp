@@ -0,0 +1,44 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Snapshot.h"
+
+/*
+Create (or take over) the POSIX shared memory segment name and map a zeroed
+snapshot into it. Readers map the same name read-only with powermon_shm.h.
+*/
+power_snapshot_t *snapshot_create_shm(const char *name) {
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		perror("Snapshot:shm_open");
+		fprintf(stderr, "Trying to create %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+	// truncating to 0 first zeroes a segment left behind by a previous run
+	if (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(power_snapshot_t)) != 0) {
+		perror("Snapshot:ftruncate");
+		exit(EXIT_FAILURE);
+	}
+	void *addr = mmap(NULL, sizeof(power_snapshot_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		perror("Snapshot:mmap");
+		exit(EXIT_FAILURE);
+	}
+	return (power_snapshot_t*)addr;
+}
+
+// Unmap the snapshot and remove the segment, readers that still map it keep their copy
+void snapshot_destroy_shm(power_snapshot_t *snap, const char *name) {
+	munmap(snap, sizeof(power_snapshot_t));
+	shm_unlink(name);
+}
@@ -0,0 +1,97 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#define SNAPSHOT_VERSION    3
+#define SNAPSHOT_DOMAINS    4
+#define SNAPSHOT_MAX_GPUS   64
+#define SNAPSHOT_NAME_LEN   64
+#define SNAPSHOT_MAX_METRICS 12
+#define SNAPSHOT_METRIC_LEN 16
+#define SNAPSHOT_MAX_PROCS  64
+#define SNAPSHOT_PROC_NAME  16
+
+// What the node looks like, written once before the first sample
+struct snapshot_info_t {
+	uint32_t version;
+	uint32_t n_sockets;
+	uint32_t n_gpus;
+	// bit d set when RAPL domain d (pkg, pp0, pp1, dram) is measured
+	uint32_t domain_mask;
+	uint64_t interval_ns;
+	uint32_t gpu_index[SNAPSHOT_MAX_GPUS];
+	char gpu_name[SNAPSHOT_MAX_GPUS][SNAPSHOT_NAME_LEN];
+	// extra GPU metrics (-m), index into gpu_metric_table, name and unit
+	uint32_t n_metrics;
+	uint32_t metric_id[SNAPSHOT_MAX_METRICS];
+	char metric_name[SNAPSHOT_MAX_METRICS][SNAPSHOT_METRIC_LEN];
+	char metric_unit[SNAPSHOT_MAX_METRICS][SNAPSHOT_METRIC_LEN];
+};
+
+// Latest sample, rewritten on every tick under the sequence lock
+struct snapshot_values_t {
+	// CLOCK_MONOTONIC and CLOCK_REALTIME of the sample
+	uint64_t timestamp_ns;
+	int64_t realtime_ns;
+	uint64_t samples;
+	uint64_t missed;
+	double cpu_power[SNAPSHOT_DOMAINS];
+	double cpu_energy[SNAPSHOT_DOMAINS];
+	double gpu_power[SNAPSHOT_MAX_GPUS];
+	double gpu_energy[SNAPSHOT_MAX_GPUS];
+	double gpu_metric[SNAPSHOT_MAX_GPUS][SNAPSHOT_MAX_METRICS];
+	// per-process GPU energy (-j), the first SNAPSHOT_MAX_PROCS processes over all devices
+	uint32_t n_procs;
+	uint32_t proc_gpu[SNAPSHOT_MAX_PROCS];
+	uint32_t proc_pid[SNAPSHOT_MAX_PROCS];
+	char proc_name[SNAPSHOT_MAX_PROCS][SNAPSHOT_PROC_NAME];
+	double proc_energy[SNAPSHOT_MAX_PROCS];
+};
+
+/*
+Live view of the sampler, plain data so it can be placed in shared memory.
+info is written before the first publish, so seq >= 2 means it is valid.
+One writer (the sampler) and any number of readers; readers retry instead of
+blocking, so a reader never stalls the sampler and the sampler never waits.
+*/
+struct power_snapshot_t {
+	std::atomic<uint32_t> seq;
+	uint32_t pad;
+	snapshot_info_t info;
+	snapshot_values_t values;
+};
+
+// Writer side, only the sampler thread calls this
+inline void snapshot_publish(power_snapshot_t *snap, const snapshot_values_t *values) {
+	uint32_t s = snap->seq.load(std::memory_order_relaxed);
+	// odd while the values are being written
+	snap->seq.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&snap->values, values, sizeof(snapshot_values_t));
+	snap->seq.store(s + 2, std::memory_order_release);
+}
+
+// Copy a consistent set of values, retrying while the writer is in the middle of an update
+inline void snapshot_read(const power_snapshot_t *snap, snapshot_values_t *values) {
+	uint32_t s1, s2;
+	do {
+		s1 = snap->seq.load(std::memory_order_acquire);
+		memcpy(values, &snap->values, sizeof(snapshot_values_t));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		s2 = snap->seq.load(std::memory_order_relaxed);
+	} while ((s1 & 1) || s1 != s2);
+}
+
+// Snapshot in POSIX shared memory for other processes (powermon_shm.h)
+power_snapshot_t *snapshot_create_shm(const char *name);
+void snapshot_destroy_shm(power_snapshot_t *snap, const char *name);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,156 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "Stats.h"
+
+Quantile::Quantile(double p) {
+	this->p = p;
+	reset();
+}
+
+void Quantile::reset() {
+	count = 0;
+	for (int i=0; i<5; i++) {
+		q[i] = 0.0;
+		n[i] = i;
+	}
+	np[0] = 0; np[1] = 2*p; np[2] = 4*p; np[3] = 2 + 2*p; np[4] = 4;
+	dn[0] = 0; dn[1] = p/2; dn[2] = p; dn[3] = (1 + p)/2; dn[4] = 1;
+}
+
+double Quantile::parabolic(int i, int s) {
+	return q[i] + (double)s/(n[i+1] - n[i-1]) *
+		((n[i] - n[i-1] + s)*(q[i+1] - q[i])/(n[i+1] - n[i]) +
+		 (n[i+1] - n[i] - s)*(q[i] - q[i-1])/(n[i] - n[i-1]));
+}
+
+double Quantile::linear(int i, int s) {
+	return q[i] + s*(q[i+s] - q[i])/(n[i+s] - n[i]);
+}
+
+void Quantile::add(double x) {
+	// the first five samples are the initial marker heights
+	if (count < 5) {
+		q[count++] = x;
+		if (count == 5) {
+			std::sort(q, q + 5);
+		}
+		return;
+	}
+
+	int k;
+	if (x < q[0]) {
+		q[0] = x;
+		k = 0;
+	} else if (x >= q[4]) {
+		q[4] = x;
+		k = 3;
+	} else {
+		for (k=0; k<3 && x >= q[k+1]; k++);
+	}
+	for (int i=k+1; i<5; i++) {
+		n[i]++;
+	}
+	for (int i=0; i<5; i++) {
+		np[i] += dn[i];
+	}
+	count++;
+
+	// move the middle markers towards their desired positions
+	for (int i=1; i<4; i++) {
+		double d = np[i] - n[i];
+		if ((d >= 1.0 && n[i+1] - n[i] > 1) || (d <= -1.0 && n[i-1] - n[i] < -1)) {
+			int s = d >= 0.0 ? 1 : -1;
+			double qn = parabolic(i, s);
+			q[i] = (q[i-1] < qn && qn < q[i+1]) ? qn : linear(i, s);
+			n[i] += s;
+		}
+	}
+}
+
+double Quantile::value() {
+	if (count == 0) {
+		return 0.0;
+	}
+	if (count < 5) {
+		// exact quantile of the few samples seen so far
+		double sorted[5];
+		std::copy(q, q + count, sorted);
+		std::sort(sorted, sorted + count);
+		return sorted[(int)std::lround(p*(count - 1))];
+	}
+	return q[2];
+}
+
+Stats::Stats() : p50_(0.50), p95_(0.95), p99_(0.99) {
+	reset();
+}
+
+void Stats::reset() {
+	n = 0;
+	mean_ = 0.0;
+	m2 = 0.0;
+	min_ = 0.0;
+	max_ = 0.0;
+	p50_.reset();
+	p95_.reset();
+	p99_.reset();
+}
+
+void Stats::add(double x) {
+	n++;
+	double delta = x - mean_;
+	mean_ += delta/n;
+	m2 += delta*(x - mean_);
+	if (n == 1 || x < min_) {
+		min_ = x;
+	}
+	if (n == 1 || x > max_) {
+		max_ = x;
+	}
+	p50_.add(x);
+	p95_.add(x);
+	p99_.add(x);
+}
+
+uint64_t Stats::get_n() {
+	return n;
+}
+
+double Stats::mean() {
+	return mean_;
+}
+
+// sample variance, 0 with fewer than two samples
+double Stats::variance() {
+	return n > 1 ? m2/(n - 1) : 0.0;
+}
+
+double Stats::stddev() {
+	return sqrt(variance());
+}
+
+double Stats::min() {
+	return min_;
+}
+
+double Stats::max() {
+	return max_;
+}
+
+double Stats::p50() {
+	return p50_.value();
+}
+
+double Stats::p95() {
+	return p95_.value();
+}
+
+double Stats::p99() {
+	return p99_.value();
+}
@@ -0,0 +1,63 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+
+#ifndef STATS_H_
+#define STATS_H_
+
+/*
+P-square estimator of one quantile (Jain & Chlamtac, 1985). Keeps five markers
+whose heights are adjusted with a piecewise parabolic fit as samples arrive, so
+the memory and the cost per sample are constant however long the run is.
+*/
+class Quantile {
+
+private:
+	double p;
+	double q[5];
+	double np[5];
+	double dn[5];
+	int64_t n[5];
+	uint64_t count;
+
+	double parabolic(int i, int s);
+	double linear(int i, int s);
+
+public:
+	Quantile(double p = 0.5);
+	void reset();
+	void add(double x);
+	double value();
+};
+
+/*
+Online statistics of a power series: Welford mean and variance, min, max and
+P50/P95/P99 sketches. Updated by one sampler thread, read after it stopped.
+*/
+class Stats {
+
+private:
+	uint64_t n;
+	double mean_, m2, min_, max_;
+	Quantile p50_, p95_, p99_;
+
+public:
+	Stats();
+	void reset();
+	void add(double x);
+
+	uint64_t get_n();
+	double mean();
+	double variance();
+	double stddev();
+	double min();
+	double max();
+	double p50();
+	double p95();
+	double p99();
+};
+
+#endif /* STATS_H_ */
@@ -0,0 +1,235 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <csignal>
+#include <cstdlib>
+#include <vector>
+
+#include "Sweep.h"
+#include "Launcher.h"
+#include "nvmlPower.hpp"
+
+// limits found at startup
+static std::vector<uint64_t> cpuSavedRaw;
+static std::vector<double> cpuSavedWatts;
+static std::vector<unsigned int> gpuSavedMw;
+static bool sweepDirty = false;
+static volatile sig_atomic_t sweepInterrupted = 0;
+
+static void sweep_signal(int sig){
+    sweepInterrupted = 1;
+}
+
+// Put back every limit the sweep changed, safe to call more than once
+static void sweep_restore(){
+    if (!sweepDirty){
+        return;
+    }
+    sweepDirty = false;
+    RaplBackend *backend = rapl->get_backend();
+    for (size_t i = 0; i < cpuSavedRaw.size(); i++){
+        if (!backend->restore_power_limit(i, cpuSavedRaw[i])){
+            fprintf(stderr, "socket %zu: could not restore the %.1f W package limit\n", i, cpuSavedWatts[i]);
+        }
+    }
+    for (size_t d = 0; d < gpuSavedMw.size(); d++){
+        nvmlReturn_t res = nvmlDeviceSetPowerManagementLimit(gpuDevices[d], gpuSavedMw[d]);
+        if (res != NVML_SUCCESS){
+            fprintf(stderr, "GPU %u: could not restore the %.1f W limit: %s\n", gpuIndex[d], gpuSavedMw[d]/1000.0, nvmlErrorString(res));
+        }
+    }
+    printf("Restored the original power limits\n");
+}
+
+// Read the current limits and check the requested ones can be applied, exits before changing anything
+static void sweep_save(const double *cpu, int n_cpu, const double *gpu, int n_gpu){
+    RaplBackend *backend = rapl->get_backend();
+    bool cpu_caps = false, gpu_caps = false;
+    for (int i = 0; i < n_cpu; i++){
+        cpu_caps = cpu_caps || cpu[i] > SWEEP_DEFAULT;
+    }
+    for (int i = 0; i < n_gpu; i++){
+        gpu_caps = gpu_caps || gpu[i] > SWEEP_DEFAULT;
+    }
+    for (int s = 0; cpu_caps && s < backend->get_n_sockets(); s++){
+        double watts;
+        uint64_t raw;
+        if (!backend->get_power_limit(s, &watts, &raw)){
+            fprintf(stderr, "The %s backend cannot change package power limits, use -r msr (Intel) or -r powercap\n", backend->name());
+            exit(EXIT_FAILURE);
+        }
+        cpuSavedRaw.push_back(raw);
+        cpuSavedWatts.push_back(watts);
+        printf("Socket %d package limit: %.1f W\n", s, watts);
+    }
+    if (gpu_caps && gpuCount == 0){
+        fprintf(stderr, "GPU limits given but no GPU is sampled\n");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned int d = 0; gpu_caps && d < gpuCount; d++){
+        unsigned int mw, lo, hi;
+        nvmlReturn_t res = nvmlDeviceGetPowerManagementLimit(gpuDevices[d], &mw);
+        if (res != NVML_SUCCESS || (res = nvmlDeviceGetPowerManagementLimitConstraints(gpuDevices[d], &lo, &hi)) != NVML_SUCCESS){
+            fprintf(stderr, "GPU %u: cannot read its power limit: %s\n", gpuIndex[d], nvmlErrorString(res));
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n_gpu; i++){
+            if (gpu[i] > SWEEP_DEFAULT && (gpu[i]*1000.0 < lo || gpu[i]*1000.0 > hi)){
+                fprintf(stderr, "GPU %u: %.1f W is outside its %.1f-%.1f W range\n", gpuIndex[d], gpu[i], lo/1000.0, hi/1000.0);
+                exit(EXIT_FAILURE);
+            }
+        }
+        gpuSavedMw.push_back(mw);
+        printf("GPU %u power limit: %.1f W (range %.1f-%.1f W)\n", gpuIndex[d], mw/1000.0, lo/1000.0, hi/1000.0);
+    }
+}
+
+static bool sweep_apply(double cpu, double gpu){
+    RaplBackend *backend = rapl->get_backend();
+    bool ok = true;
+    sweepDirty = sweepDirty || !cpuSavedRaw.empty() || !gpuSavedMw.empty();
+    for (size_t i = 0; i < cpuSavedRaw.size(); i++){
+        ok = (cpu > SWEEP_DEFAULT ? backend->set_power_limit(i, cpu) : backend->restore_power_limit(i, cpuSavedRaw[i])) && ok;
+    }
+    for (size_t d = 0; d < gpuSavedMw.size(); d++){
+        unsigned int mw = gpu > SWEEP_DEFAULT ? (unsigned int)(gpu*1000.0) : gpuSavedMw[d];
+        nvmlReturn_t res = nvmlDeviceSetPowerManagementLimit(gpuDevices[d], mw);
+        if (res != NVML_SUCCESS){
+            fprintf(stderr, "GPU %u: cannot set a %.1f W limit: %s\n", gpuIndex[d], mw/1000.0, nvmlErrorString(res));
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static void sweep_limit(char *buf, size_t size, double watts){
+    if (watts > SWEEP_DEFAULT){
+        snprintf(buf, size, "%.1f", watts);
+    } else {
+        snprintf(buf, size, "default");
+    }
+}
+
+// First setting with measured runs, the base of slowdown and saving; -1 if none has any
+static int sweep_base(std::vector<sweep_result_t> &results){
+    for (size_t i = 0; i < results.size(); i++){
+        if (results[i].time.get_n() > 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void sweep_table(FILE *fp, std::vector<sweep_result_t> &results){
+    fprintf(fp, "\nPower cap sweep:\n");
+    fprintf(fp, "%10s %10s %5s %12s %10s %12s %12s %12s %12s %14s %10s %10s\n", "cpu(W)", "gpu(W)", "runs",
+            "time(s)", "+-", "cpu(J)", "dram(J)", "gpu(J)", "total(J)", "EDP(J*s)", "slowdown", "saving");
+    int b = sweep_base(results);
+    sweep_result_t *base = &results[b];
+    int best_e = b, best_edp = b;
+    for (size_t i = 0; i < results.size(); i++){
+        sweep_result_t *r = &results[i];
+        char c[16], g[16];
+        if (r->time.get_n() == 0){
+            continue;
+        }
+        double edp = r->total.mean()*r->time.mean();
+        sweep_limit(c, sizeof(c), r->cpu_limit);
+        sweep_limit(g, sizeof(g), r->gpu_limit);
+        fprintf(fp, "%10s %10s %5lu %12.4f %10.4f %12.2f %12.2f %12.2f %12.2f %14.2f %9.2f%% %9.2f%%%s\n", c, g,
+                (unsigned long)r->time.get_n(), r->time.mean(), r->time.stddev(), r->cpu.mean(), r->dram.mean(),
+                r->gpu.mean(), r->total.mean(), edp,
+                100.0*(r->time.mean()/base->time.mean() - 1.0), 100.0*(1.0 - r->total.mean()/base->total.mean()),
+                r->failed > 0 ? "  (failed runs)" : "");
+        if (r->total.mean() < results[best_e].total.mean()){
+            best_e = i;
+        }
+        if (edp < results[best_edp].total.mean()*results[best_edp].time.mean()){
+            best_edp = i;
+        }
+    }
+    char c[16], g[16];
+    sweep_limit(c, sizeof(c), results[best_e].cpu_limit);
+    sweep_limit(g, sizeof(g), results[best_e].gpu_limit);
+    fprintf(fp, "Lowest energy: cpu %s W, gpu %s W\n", c, g);
+    sweep_limit(c, sizeof(c), results[best_edp].cpu_limit);
+    sweep_limit(g, sizeof(g), results[best_edp].gpu_limit);
+    fprintf(fp, "Lowest EDP:    cpu %s W, gpu %s W\n", c, g);
+}
+
+int PowerSweep(const double *cpu, int n_cpu, const double *gpu, int n_gpu, int reps,
+               double ms, const char *devices, char **cmd, const char *out){
+    PowerInit(devices);
+    sweep_save(cpu, n_cpu, gpu, n_gpu);
+    atexit(sweep_restore);
+    signal(SIGINT, sweep_signal);
+    signal(SIGTERM, sweep_signal);
+
+    std::vector<sweep_result_t> results;
+    for (int i = 0; i < n_cpu; i++){
+        for (int j = 0; j < n_gpu; j++){
+            sweep_result_t r;
+            r.cpu_limit = cpu[i];
+            r.gpu_limit = gpu[j];
+            r.failed = 0;
+            results.push_back(r);
+        }
+    }
+    char name[64];
+    for (size_t k = 0; k < results.size() && !sweepInterrupted; k++){
+        sweep_result_t *r = &results[k];
+        if (!sweep_apply(r->cpu_limit, r->gpu_limit)){
+            fprintf(stderr, "Skipping setting %zu, its limits were not accepted\n", k);
+            continue;
+        }
+        for (int rep = 0; rep < reps && !sweepInterrupted; rep++){
+            double pkg0, dram0, pkg1, dram1;
+            snprintf(name, sizeof(name), "sweep-%zu-%d", k, rep);
+            // a fresh child per run, forked before the sampler thread starts
+            Launcher launcher(cmd);
+            PowerBegin(name, ms, devices);
+            rapl->snapshot(&pkg0, &dram0);
+            double gpu0 = gpuCount > 0 ? GPUEnergySnapshot() : 0.0;
+            launcher.start();
+            int status = launcher.wait();
+            rapl->snapshot(&pkg1, &dram1);
+            double gpu1 = gpuCount > 0 ? GPUEnergySnapshot() : 0.0;
+            PowerStop();
+            // the launcher puts ^C back to the default action after the run
+            signal(SIGINT, sweep_signal);
+            double time = (double)(launcher.get_exit_ns() - launcher.get_exec_ns())/NS_PER_SEC;
+            if (status == 128 + SIGINT){
+                sweepInterrupted = 1;
+                break;
+            }
+            r->failed += status != 0;
+            r->time.add(time);
+            r->cpu.add(pkg1 - pkg0);
+            r->dram.add(dram1 - dram0);
+            r->gpu.add(gpu1 - gpu0);
+            r->total.add(pkg1 - pkg0 + dram1 - dram0 + gpu1 - gpu0);
+            printf("setting %zu run %d: %.4f s, %.2f J, exit %d\n", k, rep, time, pkg1 - pkg0 + dram1 - dram0 + gpu1 - gpu0, status);
+            fflush(stdout);
+        }
+    }
+    sweep_restore();
+    if (sweepInterrupted){
+        printf("Sweep interrupted, partial results:\n");
+    }
+    if (sweep_base(results) >= 0){
+        sweep_table(stdout, results);
+        if (out != NULL){
+            FILE *fp = fopen(out, "w+");
+            if (fp == NULL){
+                perror("sweep:fopen");
+            } else {
+                sweep_table(fp, results);
+                fclose(fp);
+            }
+        }
+    }
+    GPUShutdown();
+    return sweepInterrupted ? EXIT_FAILURE : EXIT_SUCCESS;
+}
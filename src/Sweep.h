@@ -0,0 +1,40 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+
+#include "Stats.h"
+
+#ifndef SWEEP_H_
+#define SWEEP_H_
+
+#define SWEEP_MAX_LIMITS   32
+// a limit of 0 W keeps the setting found at startup
+#define SWEEP_DEFAULT      0.0
+
+// measurements of one cpu/gpu limit pair over its repetitions
+struct sweep_result_t {
+	double cpu_limit;
+	double gpu_limit;
+	int failed;
+	Stats time;
+	Stats cpu;
+	Stats dram;
+	Stats gpu;
+	Stats total;
+};
+
+/*
+Run the command reps times under every combination of CPU package limit
+(Watts per socket, RAPL PL1) and GPU limit (Watts per sampled device,
+nvmlDeviceSetPowerManagementLimit), measuring its runtime and energy with the
+unified sampler at the ms interval. The limits found at startup are restored
+afterwards, also on SIGINT/SIGTERM and exit(). Prints runtime, energy, EDP
+and the change against the first measured setting, to out as well if not NULL.
+*/
+int PowerSweep(const double *cpu, int n_cpu, const double *gpu, int n_gpu, int reps,
+               double ms, const char *devices, char **cmd, const char *out);
+
+#endif /* SWEEP_H_ */
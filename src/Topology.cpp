@@ -0,0 +1,190 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <tuple>
+
+#include "Topology.h"
+#include "RaplBackend.h"
+
+static Topology *topology = NULL;
+
+// Topology id of a cpu, fallback when the file is missing (die_id before Linux 5.2)
+static int read_id(const std::string &root, int cpu, const char *file, int fallback) {
+	int v = fallback;
+	std::string path = root + TOPOLOGY_CPU_ROOT "/cpu" + std::to_string(cpu) + "/topology/" + file;
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "%d", &v) != 1) {
+			v = fallback;
+		}
+		fclose(fp);
+	}
+	return v;
+}
+
+// First line of a sysfs cpu list, of any length
+static bool read_list(const std::string &path, std::string &line) {
+	FILE *fp = fopen(path.c_str(), "r");
+	if (fp == NULL) {
+		return false;
+	}
+	char *buf = NULL;
+	size_t size = 0;
+	bool ok = getline(&buf, &size, fp) > 0;
+	if (ok) {
+		line = buf;
+	}
+	free(buf);
+	fclose(fp);
+	return ok;
+}
+
+Topology::Topology(const std::string &root) {
+	std::vector<int> online;
+	std::string line;
+	this->root = root;
+	if (!read_list(root + TOPOLOGY_CPU_ROOT "/online", line)) {
+		perror("Topology:online");
+		exit(EXIT_FAILURE);
+	}
+	parse_cpu_list(line.c_str(), online);
+
+	std::map<int, int> package_map;
+	std::map<std::pair<int,int>, int> die_map;
+	std::map<std::tuple<int,int,int>, int> core_map;
+	for (size_t i = 0; i < online.size(); i++) {
+		topology_cpu_t c;
+		c.cpu = online[i];
+		c.package = read_id(root, c.cpu, "physical_package_id", 0);
+		c.die = read_id(root, c.cpu, "die_id", 0);
+		c.core = read_id(root, c.cpu, "core_id", c.cpu);
+		c.node = -1;
+		c.socket = -1;
+		// online lists ascend, so the first sibling seen is the lowest cpu id
+		c.thread = core_map[std::make_tuple(c.package, c.die, c.core)]++;
+		package_map[c.package] = 0;
+		die_map[std::make_pair(c.package, c.die)] = 0;
+		cpus.push_back(c);
+	}
+	for (std::map<int, int>::iterator it = package_map.begin(); it != package_map.end(); ++it) {
+		it->second = packages.size();
+		packages.push_back(it->first);
+		socket_cpus.push_back(-1);
+	}
+	n_dies = die_map.size();
+	smt = 1;
+	for (std::map<std::tuple<int,int,int>, int>::iterator it = core_map.begin(); it != core_map.end(); ++it) {
+		smt = it->second > smt ? it->second : smt;
+	}
+	for (size_t i = 0; i < cpus.size(); i++) {
+		topology_cpu_t *c = &cpus[i];
+		c->socket = package_map[c->package];
+		if (socket_cpus[c->socket] < 0) {
+			socket_cpus[c->socket] = c->cpu;
+		}
+		if (c->thread == 0) {
+			core_cpus.push_back(c->cpu);
+		}
+		if (c->cpu >= (int)index.size()) {
+			index.resize(c->cpu + 1, -1);
+		}
+		index[c->cpu] = i;
+	}
+	read_nodes();
+}
+
+// Node of every cpu from nodeN/cpulist, machines without NUMA have no node directory
+void Topology::read_nodes() {
+	std::string line;
+	std::vector<int> nodes, node_cpus;
+	n_nodes = 0;
+	if (!read_list(root + TOPOLOGY_NODE_ROOT "/online", line)) {
+		return;
+	}
+	parse_cpu_list(line.c_str(), nodes);
+	for (size_t n = 0; n < nodes.size(); n++) {
+		if (!read_list(root + TOPOLOGY_NODE_ROOT "/node" + std::to_string(nodes[n]) + "/cpulist", line)) {
+			continue;
+		}
+		parse_cpu_list(line.c_str(), node_cpus);
+		for (size_t k = 0; k < node_cpus.size(); k++) {
+			if (node_cpus[k] >= 0 && node_cpus[k] < (int)index.size() && index[node_cpus[k]] >= 0) {
+				cpus[index[node_cpus[k]]].node = nodes[n];
+			}
+		}
+		n_nodes++;
+	}
+}
+
+int Topology::get_n_cpus() {
+	return cpus.size();
+}
+
+int Topology::get_n_sockets() {
+	return packages.size();
+}
+
+int Topology::get_n_dies() {
+	return n_dies;
+}
+
+int Topology::get_n_cores() {
+	return core_cpus.size();
+}
+
+int Topology::get_n_nodes() {
+	return n_nodes;
+}
+
+int Topology::get_smt() {
+	return smt;
+}
+
+const topology_cpu_t &Topology::get_cpu(int i) {
+	return cpus[i];
+}
+
+const topology_cpu_t *Topology::find(int cpu) {
+	if (cpu < 0 || cpu >= (int)index.size() || index[cpu] < 0) {
+		return NULL;
+	}
+	return &cpus[index[cpu]];
+}
+
+int Topology::socket_cpu(int socket) {
+	return socket_cpus[socket];
+}
+
+int Topology::socket_package(int socket) {
+	return packages[socket];
+}
+
+int Topology::package_socket(int package) {
+	for (size_t i = 0; i < packages.size(); i++) {
+		if (packages[i] == package) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int Topology::core_cpu(int core) {
+	return core_cpus[core];
+}
+
+void Topology::print(FILE *fp) {
+	fprintf(fp, "Topology: %zu cpus, %zu cores (smt %d), %d dies, %zu sockets, %d NUMA nodes\n",
+	        cpus.size(), core_cpus.size(), smt, n_dies, packages.size(), n_nodes);
+}
+
+Topology *get_topology() {
+	if (topology == NULL) {
+		topology = new Topology();
+	}
+	return topology;
+}
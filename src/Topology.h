@@ -0,0 +1,83 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#define TOPOLOGY_CPU_ROOT   "/sys/devices/system/cpu"
+#define TOPOLOGY_NODE_ROOT  "/sys/devices/system/node"
+
+// one online logical cpu
+struct topology_cpu_t {
+	int cpu;
+	// physical_package_id, die_id (0 on kernels without dies) and core_id from sysfs
+	int package;
+	int die;
+	int core;
+	// NUMA node, -1 when the kernel exposes none
+	int node;
+	// dense index of the package, what the RAPL backends call a socket
+	int socket;
+	// position among the SMT siblings of its core, 0 for the lowest cpu id
+	int thread;
+};
+
+/*
+Cpu topology of the machine as the kernel sees it, read once from sysfs. Every
+container is sized at runtime, so there is no limit on the number of cpus or
+packages. Sockets are numbered 0..n-1 in physical_package_id order even when
+the ids are sparse, and SMT siblings are the cpus sharing package, die and
+core ids.
+*/
+class Topology {
+
+private:
+	// prefix of the sysfs paths, empty for this machine
+	std::string root;
+	// online cpus in ascending id order
+	std::vector<topology_cpu_t> cpus;
+	// cpu id -> position in cpus, -1 for offline ids
+	std::vector<int> index;
+	// physical_package_id and first online cpu of each socket
+	std::vector<int> packages;
+	std::vector<int> socket_cpus;
+	// first thread of each physical core
+	std::vector<int> core_cpus;
+	int n_dies;
+	int n_nodes;
+	int smt;
+
+	void read_nodes();
+
+public:
+	// Cpus and nodes under root + /sys/devices/system, a copy of the tree in the tests
+	Topology(const std::string &root = "");
+	int get_n_cpus();
+	int get_n_sockets();
+	int get_n_dies();
+	int get_n_cores();
+	int get_n_nodes();
+	// threads per physical core, 1 without SMT
+	int get_smt();
+	const topology_cpu_t &get_cpu(int i);
+	// NULL if the cpu is not online
+	const topology_cpu_t *find(int cpu);
+	// cpu the RAPL counters of a socket are read from
+	int socket_cpu(int socket);
+	int socket_package(int socket);
+	// socket of a physical_package_id, -1 if no online cpu has it
+	int package_socket(int package);
+	int core_cpu(int core);
+	void print(FILE *fp);
+};
+
+// Topology of this machine, read from sysfs on first use
+Topology *get_topology();
+
+#endif /* TOPOLOGY_H_ */
@@ -0,0 +1,320 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+
+#include "Trace.h"
+#include "Affinity.h"
+
+Trace::Trace(std::string filename, int format, uint32_t kind) {
+	this->filename = filename;
+	this->format = format;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.kind = kind;
+	fp = NULL;
+	columnar = NULL;
+	ring = NULL;
+	capacity = 0;
+	head = 0;
+	tail = 0;
+	running = false;
+	dropped = 0;
+	status = NULL;
+	sink = NULL;
+	sink_arg = NULL;
+}
+
+Trace::~Trace() {
+	close();
+}
+
+void Trace::add_field(const char *name, const char *unit, char type) {
+	trace_field_t f;
+	memset(&f, 0, sizeof(f));
+	strncpy(f.name, name, TRACE_NAME_LEN - 1);
+	strncpy(f.unit, unit, TRACE_UNIT_LEN - 1);
+	f.type = type;
+	fields.push_back(f);
+}
+
+void Trace::set_info(uint32_t n_sockets, uint32_t n_devices, uint64_t interval_ns) {
+	header.n_sockets = n_sockets;
+	header.n_devices = n_devices;
+	header.interval_ns = interval_ns;
+}
+
+// Called by the writer thread with the newest record after every drain
+void Trace::set_status(void (*status)(const double *record)) {
+	this->status = status;
+}
+
+// Also hand every record to sink, from the writer thread, in order
+void Trace::set_sink(void (*sink)(const double *record, void *arg), void *arg) {
+	this->sink = sink;
+	this->sink_arg = arg;
+}
+
+// Create the file, write the header and start the writer thread
+void Trace::open(uint64_t capacity) {
+	if (format == TRACE_NONE) {
+		return;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	header.start_realtime_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	header.n_fields = fields.size();
+	header.record_size = sizeof(double) * fields.size();
+
+	fp = fopen(filename.c_str(), format == TRACE_TEXT ? "w+" : "wb");
+	if (fp == NULL) {
+		perror("Trace:fopen");
+		fprintf(stderr, "Trying to open %s\n", filename.c_str());
+		exit(127);
+	}
+	if (format == TRACE_COLUMNAR) {
+		memcpy(header.magic, COLUMNAR_MAGIC, sizeof(header.magic));
+		columnar = new ColumnarWriter(fp, fields.size());
+	}
+	if (format != TRACE_TEXT) {
+		fwrite(&header, sizeof(header), 1, fp);
+		fwrite(fields.data(), sizeof(trace_field_t), fields.size(), fp);
+		fflush(fp);
+	} else {
+		write_text_header(fp, fields.data(), fields.size());
+	}
+
+	// round up to a power of two so slots can be masked
+	this->capacity = 1;
+	while (this->capacity < capacity) {
+		this->capacity <<= 1;
+	}
+	ring = new double[this->capacity * fields.size()];
+	head = 0;
+	tail = 0;
+	running = true;
+	int code = pthread_create(&writer, NULL, writer_func, (void*)this);
+	if (code) {
+		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+		exit(0);
+	}
+}
+
+// Stop the writer after it has drained every committed record
+void Trace::close() {
+	if (fp == NULL) {
+		return;
+	}
+	running = false;
+	pthread_join(writer, NULL);
+	drain();
+	if (columnar != NULL) {
+		columnar->flush();
+		delete columnar;
+		columnar = NULL;
+	}
+	if (dropped > 0) {
+		fprintf(stderr, "%s: %lu records dropped, writer could not keep up\n", filename.c_str(), dropped);
+	}
+	fclose(fp);
+	fp = NULL;
+	delete[] ring;
+	ring = NULL;
+}
+
+// Slot for the next record, or NULL if the ring is full. Only the sampler calls this.
+double *Trace::record() {
+	if (ring == NULL) {
+		return NULL;
+	}
+	uint64_t h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= capacity) {
+		dropped++;
+		return NULL;
+	}
+	return ring + (h & (capacity - 1)) * fields.size();
+}
+
+// Publish the slot returned by record()
+void Trace::commit() {
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Trace::drain() {
+	uint64_t h = head.load(std::memory_order_acquire);
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	uint64_t n = fields.size();
+	if (h == t) {
+		return;
+	}
+	for (; t < h; t++) {
+		const double *rec = ring + (t & (capacity - 1)) * n;
+		if (format == TRACE_BINARY) {
+			fwrite(rec, sizeof(double), n, fp);
+		} else if (format == TRACE_COLUMNAR) {
+			columnar->add(rec);
+		} else {
+			write_text_record(fp, fields.data(), n, rec);
+		}
+		if (sink != NULL) {
+			sink(rec, sink_arg);
+		}
+	}
+	if (status != NULL) {
+		status(ring + ((h - 1) & (capacity - 1)) * n);
+	}
+	tail.store(h, std::memory_order_release);
+}
+
+void *Trace::writer_func(void *ptr) {
+	Trace *trace = (Trace*)ptr;
+	affinity_apply(false);
+	struct timespec ts;
+	ts.tv_sec = 0;
+	ts.tv_nsec = TRACE_DRAIN_MS * 1000000L;
+	while (trace->running.load(std::memory_order_acquire)) {
+		nanosleep(&ts, NULL);
+		trace->drain();
+	}
+	pthread_exit(0);
+}
+
+uint32_t Trace::n_fields() {
+	return fields.size();
+}
+
+int Trace::field_index(const char *name) {
+	for (size_t i = 0; i < fields.size(); i++) {
+		if (strncmp(fields[i].name, name, TRACE_NAME_LEN) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+unsigned long Trace::get_dropped() {
+	return dropped;
+}
+
+void Trace::write_text_header(FILE *fp, const trace_field_t *fields, uint32_t n) {
+	char name[TRACE_NAME_LEN + 1];
+	for (uint32_t i = 0; i < n; i++) {
+		// the first column is commented so the file loads directly in gnuplot/numpy
+		snprintf(name, sizeof(name), "%s%s", i == 0 ? "#" : "", fields[i].name);
+		fprintf(fp, i == 0 ? "%-15s" : " %-15s", name);
+	}
+	fprintf(fp, "\n");
+}
+
+void Trace::write_text_record(FILE *fp, const trace_field_t *fields, uint32_t n, const double *record) {
+	for (uint32_t i = 0; i < n; i++) {
+		if (i > 0) {
+			fputc(' ', fp);
+		}
+		if (fields[i].type == 'i') {
+			fprintf(fp, "%-15lld", (long long)record[i]);
+		} else {
+			fprintf(fp, "%-15f", record[i]);
+		}
+	}
+	fputc('\n', fp);
+}
+
+int TraceParseFormat(const char *name) {
+	if (strcmp(name, "text") == 0) {
+		return TRACE_TEXT;
+	}
+	if (strcmp(name, "bin") == 0) {
+		return TRACE_BINARY;
+	}
+	if (strcmp(name, "col") == 0) {
+		return TRACE_COLUMNAR;
+	}
+	return -1;
+}
+
+const char *TraceExtension(int format) {
+	return format == TRACE_BINARY ? ".bin" : (format == TRACE_COLUMNAR ? ".pmc" : ".dat");
+}
+
+// Decode the chunks after the header, stopping at a chunk torn by a crash
+static void dump_columnar(const char *in, FILE *fin, FILE *fout, const std::vector<trace_field_t> &fields) {
+	uint32_t n = fields.size();
+	ColumnarReader reader(fin, n);
+	std::vector<double> columns, rec(n);
+	unsigned long chunks = 0;
+	while (reader.next()) {
+		uint32_t m = reader.records();
+		columns.resize((size_t)n * m);
+		for (uint32_t k = 0; k < n; k++) {
+			if (!reader.column(k, &columns[(size_t)k * m])) {
+				fprintf(stderr, "%s: chunk %lu column %s is corrupt\n", in, chunks, fields[k].name);
+				return;
+			}
+		}
+		for (uint32_t i = 0; i < m; i++) {
+			for (uint32_t k = 0; k < n; k++) {
+				rec[k] = columns[(size_t)k * m + i];
+			}
+			Trace::write_text_record(fout, fields.data(), n, rec.data());
+		}
+		chunks++;
+	}
+	if (reader.torn()) {
+		fprintf(stderr, "%s: damaged chunk after %lu good ones ignored\n", in, chunks);
+	}
+}
+
+int TraceDump(const char *in, const char *out) {
+	FILE *fin = fopen(in, "rb");
+	if (fin == NULL) {
+		perror("dump:fopen");
+		return 1;
+	}
+	trace_header_t header;
+	if (fread(&header, sizeof(header), 1, fin) != 1 ||
+	    (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 &&
+	     memcmp(header.magic, COLUMNAR_MAGIC, sizeof(header.magic)) != 0)) {
+		fprintf(stderr, "%s is not a powermon binary trace\n", in);
+		fclose(fin);
+		return 1;
+	}
+	bool columnar = memcmp(header.magic, COLUMNAR_MAGIC, sizeof(header.magic)) == 0;
+	if (header.version != TRACE_VERSION || header.record_size != header.n_fields * sizeof(double)) {
+		fprintf(stderr, "%s: unsupported trace version %u\n", in, header.version);
+		fclose(fin);
+		return 1;
+	}
+	std::vector<trace_field_t> fields(header.n_fields);
+	if (fread(fields.data(), sizeof(trace_field_t), header.n_fields, fin) != header.n_fields) {
+		fprintf(stderr, "%s: truncated header\n", in);
+		fclose(fin);
+		return 1;
+	}
+	FILE *fout = out != NULL ? fopen(out, "w+") : stdout;
+	if (fout == NULL) {
+		perror("dump:fopen");
+		fclose(fin);
+		return 1;
+	}
+	Trace::write_text_header(fout, fields.data(), header.n_fields);
+	if (columnar) {
+		dump_columnar(in, fin, fout, fields);
+	} else {
+		std::vector<double> rec(header.n_fields);
+		while (fread(rec.data(), header.record_size, 1, fin) == 1) {
+			Trace::write_text_record(fout, fields.data(), header.n_fields, rec.data());
+		}
+	}
+	fclose(fin);
+	if (fout != stdout) {
+		fclose(fout);
+	}
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "Columnar.h"
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#define TRACE_MAGIC          "PWRMON\0\1"
+#define TRACE_VERSION        1
+#define TRACE_NAME_LEN       16
+#define TRACE_UNIT_LEN       7
+#define TRACE_RING_RECORDS   (1 << 16)
+#define TRACE_DRAIN_MS       10
+
+// output formats
+#define TRACE_TEXT           0
+#define TRACE_BINARY         1
+// no file at all, records are discarded (daemon mode)
+#define TRACE_NONE           2
+// compressed chunks, see Columnar.h
+#define TRACE_COLUMNAR       3
+
+// what a trace contains
+#define TRACE_KIND_CPU       0
+#define TRACE_KIND_GPU       1
+#define TRACE_KIND_NODE      2
+#define TRACE_KIND_GPU_SAMPLES 3
+
+/*
+Binary trace layout: one trace_header_t, n_fields trace_field_t descriptors and
+then fixed-size records of n_fields doubles, in the same column order as the
+text .dat layout.
+*/
+struct trace_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t kind;
+	uint32_t n_sockets;
+	uint32_t n_devices;
+	uint32_t n_fields;
+	uint32_t record_size;
+	uint64_t interval_ns;
+	int64_t start_realtime_ns;
+};
+
+struct trace_field_t {
+	char name[TRACE_NAME_LEN];
+	char unit[TRACE_UNIT_LEN];
+	// 'i' integer column, 'f' floating point column
+	char type;
+};
+
+/*
+Output stream of sample records. The sampler thread fills preallocated ring
+slots (record/commit) and never touches the file, a background writer thread
+drains the ring every TRACE_DRAIN_MS and formats or writes it to disk.
+If the ring is full the record is dropped and counted instead of blocking.
+*/
+class Trace {
+
+private:
+	std::string filename;
+	int format;
+	trace_header_t header;
+	std::vector<trace_field_t> fields;
+	FILE *fp;
+	ColumnarWriter *columnar;
+
+	// single producer, single consumer ring
+	double *ring;
+	uint64_t capacity;
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	std::atomic<bool> running;
+	unsigned long dropped;
+	pthread_t writer;
+
+	void (*status)(const double *record);
+	void (*sink)(const double *record, void *arg);
+	void *sink_arg;
+
+	void drain();
+	static void *writer_func(void *ptr);
+
+public:
+	Trace(std::string filename, int format, uint32_t kind);
+	~Trace();
+	void add_field(const char *name, const char *unit, char type = 'f');
+	void set_info(uint32_t n_sockets, uint32_t n_devices, uint64_t interval_ns);
+	void set_status(void (*status)(const double *record));
+	void set_sink(void (*sink)(const double *record, void *arg), void *arg);
+	void open(uint64_t capacity = TRACE_RING_RECORDS);
+	void close();
+
+	double *record();
+	void commit();
+
+	uint32_t n_fields();
+	// position of a column, -1 if there is none with that name
+	int field_index(const char *name);
+	unsigned long get_dropped();
+
+	static void write_text_header(FILE *fp, const trace_field_t *fields, uint32_t n);
+	static void write_text_record(FILE *fp, const trace_field_t *fields, uint32_t n, const double *record);
+};
+
+// Format of a -f name (text, bin or col), -1 if unknown
+int TraceParseFormat(const char *name);
+// File extension of a format: .dat, .bin or .pmc
+const char *TraceExtension(int format);
+
+// Convert a binary or columnar trace back to the text .dat layout, out NULL writes to stdout
+int TraceDump(const char *in, const char *out);
+
+#endif /* TRACE_H_ */
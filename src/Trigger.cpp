@@ -0,0 +1,151 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "Trigger.h"
+
+Trigger::Trigger(const std::vector<trigger_threshold_t> &thresholds, double pre_ms, double post_ms) {
+	this->thresholds = thresholds;
+	this->pre_ms = pre_ms;
+	this->post_ms = post_ms;
+	trace = NULL;
+	n = 0;
+	time_column = -1;
+	slots = 0;
+	head = 0;
+	count = 0;
+	pre_n = 0;
+	post_n = 0;
+	remaining = 0;
+	was_over = false;
+	events = 0;
+	written = 0;
+}
+
+bool Trigger::parse(const char *spec, std::vector<trigger_threshold_t> &thresholds) {
+	std::string s(spec);
+	size_t pos = 0;
+	thresholds.clear();
+	while (pos <= s.size()) {
+		size_t end = s.find(',', pos);
+		if (end == std::string::npos) {
+			end = s.size();
+		}
+		std::string item = s.substr(pos, end - pos);
+		size_t eq = item.find('=');
+		if (eq == std::string::npos || eq == 0 || thresholds.size() == TRIGGER_MAX_THRESHOLDS) {
+			return false;
+		}
+		std::string name = item.substr(0, eq);
+		// "cpu" is the cpu-power column, a full column name is taken as it is
+		if (name.find('-') == std::string::npos) {
+			name += "-power";
+		}
+		char *num_end;
+		trigger_threshold_t t;
+		memset(&t, 0, sizeof(t));
+		t.watts = strtod(item.c_str() + eq + 1, &num_end);
+		if (*num_end != '\0' || num_end == item.c_str() + eq + 1 || t.watts <= 0.0 || name.size() >= TRACE_NAME_LEN) {
+			return false;
+		}
+		strncpy(t.column, name.c_str(), TRACE_NAME_LEN - 1);
+		t.index = -1;
+		thresholds.push_back(t);
+		pos = end + 1;
+	}
+	return !thresholds.empty();
+}
+
+// Preallocate the ring for the pre window at the sampling interval
+bool Trigger::init(Trace *trace, uint64_t interval_ns) {
+	this->trace = trace;
+	trace->add_field("event", "", 'i');
+	n = trace->n_fields();
+	for (size_t t = 0; t < thresholds.size(); t++) {
+		thresholds[t].index = trace->field_index(thresholds[t].column);
+		if (thresholds[t].index < 0) {
+			fprintf(stderr, "Trigger: no %s column in the trace\n", thresholds[t].column);
+			return false;
+		}
+	}
+	time_column = trace->field_index("time");
+	pre_n = (uint64_t)ceil(pre_ms * 1000000.0 / interval_ns);
+	post_n = (uint64_t)ceil(post_ms * 1000000.0 / interval_ns);
+	pre_n = pre_n > TRIGGER_MAX_RECORDS ? TRIGGER_MAX_RECORDS : pre_n;
+	post_n = post_n > TRIGGER_MAX_RECORDS ? TRIGGER_MAX_RECORDS : post_n;
+	slots = pre_n + 1;
+	ring.assign(slots * n, 0.0);
+	log.reserve(TRIGGER_MAX_EVENTS);
+	return true;
+}
+
+// the whole pre window is committed at once, the writer drains the rest as it comes
+uint64_t Trigger::capacity() {
+	return 2 * slots > TRACE_RING_RECORDS ? 2 * slots : TRACE_RING_RECORDS;
+}
+
+double *Trigger::record() {
+	return ring.data() + (head % slots) * n;
+}
+
+void Trigger::emit(const double *rec) {
+	double *r = trace->record();
+	if (r == NULL) {
+		return;
+	}
+	memcpy(r, rec, sizeof(double) * (n - 1));
+	r[n - 1] = events;
+	trace->commit();
+	written++;
+}
+
+void Trigger::commit() {
+	const double *rec = record();
+	head++;
+	count = count < slots ? count + 1 : slots;
+	int fired = -1;
+	for (size_t t = 0; t < thresholds.size() && fired < 0; t++) {
+		if (rec[thresholds[t].index] >= thresholds[t].watts) {
+			fired = t;
+		}
+	}
+	if (remaining > 0) {
+		emit(rec);
+		// an excursion that goes on keeps the capture open
+		remaining = fired >= 0 ? post_n : remaining - 1;
+		if (remaining == 0) {
+			count = 0;
+		}
+	} else if (fired >= 0 && !was_over) {
+		events++;
+		if (log.size() < TRIGGER_MAX_EVENTS) {
+			trigger_event_t e = {time_column >= 0 ? rec[time_column] : 0.0, fired, rec[thresholds[fired].index]};
+			log.push_back(e);
+		}
+		for (uint64_t k = head - count; k < head; k++) {
+			emit(ring.data() + (k % slots) * n);
+		}
+		count = 0;
+		remaining = post_n;
+	}
+	was_over = fired >= 0;
+}
+
+void Trigger::summary(FILE *fp) {
+	fprintf(fp, "Trigger:              %lu events, %lu records written (pre %.3f ms, post %.3f ms, %.1f KB ring)\n",
+	        events, written, pre_ms, post_ms, ring.size() * sizeof(double) / 1024.0);
+	for (size_t k = 0; k < log.size(); k++) {
+		const trigger_threshold_t *t = &thresholds[log[k].threshold];
+		fprintf(fp, "  event %zu at %.6f s: %s %.3f W >= %.3f W\n", k + 1, log[k].time, t->column, log[k].value, t->watts);
+	}
+	if (events > log.size()) {
+		fprintf(fp, "  %lu more events not listed\n", events - log.size());
+	}
+	fprintf(fp, "\n");
+}
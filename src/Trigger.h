@@ -0,0 +1,83 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include "Trace.h"
+
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#define TRIGGER_MAX_THRESHOLDS 16
+// events kept for the summary, later ones are only counted
+#define TRIGGER_MAX_EVENTS     64
+// bound of the pre and post windows in records, what keeps the memory fixed
+#define TRIGGER_MAX_RECORDS    (1 << 20)
+
+// column >= watts fires the trigger
+struct trigger_threshold_t {
+	char column[TRACE_NAME_LEN];
+	double watts;
+	int index;
+};
+
+struct trigger_event_t {
+	double time;
+	int threshold;
+	double value;
+};
+
+/*
+Threshold-triggered capture in front of a Trace. The sampler writes every
+record into a fixed ring holding the last pre window; nothing reaches the trace
+while every thresholded column stays under its limit, so the steady state cost
+is a record copy and a few compares. When a column crosses its threshold the
+pre window is handed to the trace, followed by every record until the post
+window has passed with all columns back under their limits. The trace gets an
+extra event column numbering the captures.
+*/
+class Trigger {
+
+private:
+	std::vector<trigger_threshold_t> thresholds;
+	double pre_ms, post_ms;
+	Trace *trace;
+	// fields per record, the last one is the event column
+	uint32_t n;
+	int time_column;
+	// pre window plus the current record
+	std::vector<double> ring;
+	uint64_t slots;
+	uint64_t head;
+	uint64_t count;
+	uint64_t pre_n, post_n;
+	uint64_t remaining;
+	bool was_over;
+	unsigned long events;
+	unsigned long written;
+	std::vector<trigger_event_t> log;
+
+	void emit(const double *rec);
+
+public:
+	Trigger(const std::vector<trigger_threshold_t> &thresholds, double pre_ms, double post_ms);
+	// Add the event column and find the thresholded ones, call after the other fields; false on an unknown column
+	bool init(Trace *trace, uint64_t interval_ns);
+	// trace ring records a capture needs, for Trace::open
+	uint64_t capacity();
+
+	// Slot for the next record and its publication, like Trace::record/commit. Only the sampler calls these.
+	double *record();
+	void commit();
+
+	void summary(FILE *fp);
+
+	// Parse "total=1500,cpu=300,gpu0=400": Watts per power column (name-power), false on a malformed list
+	static bool parse(const char *spec, std::vector<trigger_threshold_t> &thresholds);
+};
+
+#endif /* TRIGGER_H_ */
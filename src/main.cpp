@@ -0,0 +1,579 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <csignal>
+#include "nvmlPower.hpp"
+#include "Exporter.h"
+#include "Bench.h"
+#include "Analyze.h"
+#include "Sweep.h"
+#include "Collector.h"
+
+
+void usage(){
+    fprintf(stderr, "\nrun as ./powermon [-u] [-g gpu-list] [-m metrics] [-j] [-b gpu-dt] [-f text|bin|col] [-c] [-r backend] [-o summary] [-i secs] [-T thresholds [-w pre:post]] dt\n"
+                    "       ./powermon [options] [dt] -- command [args]\n"
+                    "       ./powermon -d port [options] [dt]\n"
+                    "       ./powermon --bench [-g gpu-list] [-r backend] [dt ...]\n"
+                    "       ./powermon dump trace.bin|trace.pmc [out.dat]\n"
+                    "       ./powermon collect [-f text|bin|col] port [dt]\n"
+                    "       ./powermon sweep [-g gpu-list] [-r backend] [-L cpu-watts,...] [-G gpu-watts,...] [-n reps] [-f fmt] [-o out] [dt] -- command [args]\n"
+                    "       ./powermon analyze [-r dt] [-g grid.dat] [-w width] [-t start:end[:name]] [-R regions] [-c cols] [-o out] trace ...\n"
+                    "dt: sample interval, in milliseconds unless suffixed with us, ms or s (e.g. 250us, 0.5ms)\n"
+                    "-g gpu-list: comma separated NVML device indices to sample (default: all), none skips NVML\n"
+                    "-m metrics: extra per-GPU columns, comma separated or all: sm-clock, mem-clock, util,\n"
+                    "            mem-util, temp, throttle, mem-temp, power-avg, power-now, pcap-time, thrm-time\n"
+                    "-j: split the energy of every GPU between its processes by SM utilization (shared GPUs, MPS)\n"
+                    "-b gpu-dt: buffered GPU capture, drain the driver power samples every gpu-dt\n"
+                    "-f format: text .dat files (default), compact binary .bin traces or compressed columnar .pmc\n"
+                    "-c: per-core energy (AMD), one coreN-power column per physical core\n"
+                    "-r backend: RAPL energy source, auto (default), msr, powercap or perf\n"
+                    "-i secs: sample the idle node for secs seconds first and report dynamic energy\n"
+                    "-o summary: also write the end of run summary to this file\n"
+                    "-u: unified mode, one thread samples CPU and GPU into power-node.dat\n"
+                    "-s name: publish every sample to the POSIX shared memory snapshot name (e.g. /powermon)\n"
+                    "-a max-dt: adaptive sampling, dt while power changes and backing off up to max-dt when stable\n"
+                    "-A pct: relative power change that counts as a change for -a (default 5)\n"
+                    "-p cpu-list: pin the sampler and writer threads to these housekeeping cpus (e.g. 0 or 2,3)\n"
+                    "-P prio: run the sampler threads with SCHED_FIFO priority prio (1-99)\n"
+                    "-C host:port: stream the unified records to an aggregator (powermon collect, or rank 0 under mpirun/srun)\n"
+                    "-T thresholds: trigger mode, e.g. total=1500 or cpu=300,gpu0=400 (Watts per power column);\n"
+                    "               samples stay in memory and only the windows around a crossing are written\n"
+                    "-w pre:post: time kept before and after a trigger crossing (default 100ms:100ms)\n"
+                    "-d port: daemon mode, serve Prometheus metrics on http://host:port/metrics until SIGTERM\n"
+                    "analyze: energy of every power column per window, trapezoidal over the samples;\n"
+                    "  -r resamples onto a common dt grid (power-grid.dat or -g), -w adds fixed windows,\n"
+                    "  -t a window in seconds, -R the regions file of a powermon_init run\n"
+                    "sweep: run the command under every CPU package (-L, per socket) and GPU (-G) power limit pair,\n"
+                    "  n times each (default 3), and report runtime, energy and EDP; default keeps a limit as found\n"
+                    "--bench: measure powermon's own overhead over a sweep of intervals (default 10ms to 100us)\n"
+                    "-- command: run the command and measure exactly its lifetime, dt defaults to 100 ms\n\n");
+    exit(EXIT_FAILURE);
+}
+
+// parse an interval such as "10", "0.25ms", "250us" or "1s" into milliseconds
+double parse_interval(const char *str){
+    char *end;
+    double v = strtod(str, &end);
+    if(end == str || v <= 0.0){
+        usage();
+    }
+    if(*end == '\0' || strcmp(end, "ms") == 0){
+        return v;
+    } else if(strcmp(end, "us") == 0){
+        return v/1000.0;
+    } else if(strcmp(end, "s") == 0){
+        return v*1000.0;
+    }
+    usage();
+    return 0.0;
+}
+
+// Exit status and startup overhead of the wrapped command, after the energy summary
+void WrapperSummary(Launcher *launcher, char **cmd, int status, uint64_t launch_ns){
+    double startup = (double)(launcher->get_exec_ns() - launch_ns)/NS_PER_SEC;
+    double runtime = (double)(launcher->get_exit_ns() - launcher->get_exec_ns())/NS_PER_SEC;
+    FILE *fp = NULL;
+    if(!summaryFilename.empty()){
+        fp = fopen(summaryFilename.c_str(), "a");
+    }
+    FILE *out[2] = {stdout, fp};
+    for(int k = 0; k < 2; k++){
+        if(out[k] == NULL){
+            continue;
+        }
+        fprintf(out[k], "Command:             ");
+        for(char **a = cmd; *a != NULL; a++){
+            fprintf(out[k], " %s", *a);
+        }
+        fprintf(out[k], "\nExit status:          %i\n", status);
+        fprintf(out[k], "Command runtime:      %f secs\n", runtime);
+        fprintf(out[k], "Startup overhead:     %f secs (RAPL init %f secs, NVML init %f secs, calibration %f secs)\n",
+                startup, cpuInitTime, gpuInitTime, calibrationTime);
+    }
+    if(fp != NULL){
+        fclose(fp);
+    }
+}
+
+/*
+Sample the node until SIGINT or SIGTERM and serve the latest values over HTTP.
+No trace is written, so a permanent daemon does not fill the disk.
+*/
+int Daemon(int port, double ms, const char *gpus, const char *shm){
+    sigset_t set;
+    int sig;
+    // block the signals before any thread starts so only sigwait sees them
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    power_snapshot_t *snap = shm != NULL ? snapshot_create_shm(shm) : new power_snapshot_t();
+    PowerSetSnapshot(snap);
+    PowerSetFormat(TRACE_NONE);
+    PowerBegin("node", ms, gpus);
+    Exporter exporter(port, snap);
+    exporter.start();
+    sigwait(&set, &sig);
+    exporter.stop();
+    PowerEnd();
+    PowerSetSnapshot(NULL);
+    if(shm != NULL){
+        snapshot_destroy_shm(snap, shm);
+    } else {
+        delete snap;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+Standalone aggregator: receive the records of every node started with -C and
+write the cluster traces binned every dt, until all nodes are done or SIGINT.
+*/
+int Collect(int argc, char **argv){
+    int format = TRACE_TEXT;
+    int opt;
+    while((opt = getopt(argc, argv, "f:")) != -1){
+        if(opt != 'f' || (format = TraceParseFormat(optarg)) < 0){
+            usage();
+        }
+    }
+    if(argc - optind < 1 || argc - optind > 2 || atoi(argv[optind]) <= 0 || atoi(argv[optind]) > 65535){
+        usage();
+    }
+    double ms = argc - optind == 2 ? parse_interval(argv[optind + 1]) : 100.0;
+    sigset_t set;
+    struct timespec timeout = {0, 100*1000*1000};
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    Aggregator agg(atoi(argv[optind]), (uint64_t)(ms*1000000.0), format);
+    agg.start();
+    while(!agg.done() && sigtimedwait(&set, NULL, &timeout) < 0){
+    }
+    agg.finish(0.0);
+    agg.summary(stdout);
+    return EXIT_SUCCESS;
+}
+
+/*
+Offline analysis of traces left by earlier runs: one streaming pass over every
+file given, summaries per window on stdout (or -o) and optionally the signals
+resampled onto a common grid.
+*/
+int Analyze(int argc, char **argv){
+    Analyzer analyzer;
+    double dt = 0.0;
+    const char *grid = NULL;
+    const char *out = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "r:g:w:t:R:c:o:")) != -1){
+        switch(opt){
+            case 'r': dt = parse_interval(optarg)/1000.0; break;
+            case 'g': grid = optarg; break;
+            case 'w': analyzer.set_width(parse_interval(optarg)/1000.0); break;
+            case 't': {
+                char name[256] = "";
+                double start, end;
+                if(sscanf(optarg, "%lf:%lf:%255s", &start, &end, name) < 2 || end <= start){
+                    usage();
+                }
+                analyzer.add_window(name[0] != '\0' ? name : optarg, start, end);
+                break;
+            }
+            case 'R':
+                if(!analyzer.load_regions(optarg)){
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'c': analyzer.set_columns(optarg); break;
+            case 'o': out = optarg; break;
+            default: usage();
+        }
+    }
+    if(optind == argc){
+        usage();
+    }
+    for(int i = optind; i < argc; i++){
+        if(!analyzer.add_trace(argv[i])){
+            return EXIT_FAILURE;
+        }
+    }
+    FILE *fgrid = NULL;
+    if(dt > 0.0 || grid != NULL){
+        fgrid = fopen(grid != NULL ? grid : "power-grid.dat", "w+");
+        if(fgrid == NULL){
+            perror("analyze:fopen");
+            return EXIT_FAILURE;
+        }
+        dt = dt > 0.0 ? dt : 0.1;
+    }
+    analyzer.run(dt, fgrid);
+    if(fgrid != NULL){
+        fclose(fgrid);
+    }
+    FILE *fout = out != NULL ? fopen(out, "w+") : stdout;
+    if(fout == NULL){
+        perror("analyze:fopen");
+        return EXIT_FAILURE;
+    }
+    analyzer.summary(fout);
+    if(fout != stdout){
+        fclose(fout);
+    }
+    return EXIT_SUCCESS;
+}
+
+// Parse a comma separated list of Watts for sweep, "default" keeps the current limit
+int parse_limits(const char *str, double *limits){
+    int n = 0;
+    std::string s(str);
+    size_t pos = 0;
+    while(pos <= s.size()){
+        size_t end = s.find(',', pos);
+        if(end == std::string::npos){
+            end = s.size();
+        }
+        std::string item = s.substr(pos, end - pos);
+        char *stop;
+        double w = item == "default" ? SWEEP_DEFAULT : strtod(item.c_str(), &stop);
+        if(n == SWEEP_MAX_LIMITS || (item != "default" && (item.empty() || *stop != '\0' || w <= 0.0))){
+            usage();
+        }
+        limits[n++] = w;
+        pos = end + 1;
+    }
+    return n;
+}
+
+/*
+Power cap sweep: the wrapped command is run under every limit pair, with the
+unified sampler (no traces unless -f) measuring each run.
+*/
+int Sweep(int argc, char **argv){
+    double cpu[SWEEP_MAX_LIMITS] = {SWEEP_DEFAULT}, gpu[SWEEP_MAX_LIMITS] = {SWEEP_DEFAULT};
+    int n_cpu = 1, n_gpu = 1, reps = 3;
+    const char *gpus = NULL;
+    const char *out = NULL;
+    char **cmd = NULL;
+    int format = TRACE_NONE;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--") == 0){
+            cmd = argv + i + 1;
+            argc = i;
+            break;
+        }
+    }
+    int opt;
+    while((opt = getopt(argc, argv, "g:r:L:G:n:o:f:")) != -1){
+        switch(opt){
+            case 'g': gpus = optarg; break;
+            case 'r':
+                if(rapl_backend_type(optarg) < 0){
+                    usage();
+                }
+                PowerSetRaplBackend(rapl_backend_type(optarg));
+                break;
+            case 'L': n_cpu = parse_limits(optarg, cpu); break;
+            case 'G': n_gpu = parse_limits(optarg, gpu); break;
+            case 'n':
+                reps = atoi(optarg);
+                if(reps <= 0){
+                    usage();
+                }
+                break;
+            case 'o': out = optarg; break;
+            case 'f':
+                if((format = TraceParseFormat(optarg)) < 0){
+                    usage();
+                }
+                break;
+            default: usage();
+        }
+    }
+    if(cmd == NULL || cmd[0] == NULL || argc - optind > 1){
+        usage();
+    }
+    PowerSetFormat(format);
+    double ms = argc - optind == 1 ? parse_interval(argv[optind]) : 100.0;
+    return PowerSweep(cpu, n_cpu, gpu, n_gpu, reps, ms, gpus, cmd, out);
+}
+
+// Split "host:port" of -C, exits through usage on a malformed address
+void parse_collector(const char *str, std::string &host, int &port){
+    const char *colon = strrchr(str, ':');
+    if(colon == NULL || colon == str){
+        usage();
+    }
+    host = std::string(str, colon - str);
+    port = atoi(colon + 1);
+    if(port <= 0 || port > 65535){
+        usage();
+    }
+}
+
+int main(int argc, char **argv){
+    uint64_t launch_ns = Deadline::now_ns();
+    if(argc > 1 && strcmp(argv[1], "dump") == 0){
+        if(argc != 3 && argc != 4){
+            usage();
+        }
+        return TraceDump(argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    if(argc > 1 && strcmp(argv[1], "collect") == 0){
+        argv[1] = argv[0];
+        return Collect(argc - 1, argv + 1);
+    }
+    if(argc > 1 && strcmp(argv[1], "sweep") == 0){
+        argv[1] = argv[0];
+        return Sweep(argc - 1, argv + 1);
+    }
+    if(argc > 1 && strcmp(argv[1], "analyze") == 0){
+        argv[1] = argv[0];
+        return Analyze(argc - 1, argv + 1);
+    }
+    // --bench is the first argument, the rest is parsed as usual
+    bool bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
+    if(bench){
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    const char *gpus = NULL;
+    bool unified = false;
+    double gpu_ms = 0.0;
+    const char *summary = NULL;
+    double calibrate = 0.0;
+    int port = 0;
+    const char *shm = NULL;
+    const char *pin = NULL;
+    const char *collector = NULL;
+    bool metrics = false;
+    bool processes = false;
+    const char *trigger = NULL;
+    double trigger_pre = 100.0, trigger_post = 100.0;
+    int format = TRACE_TEXT;
+    double adaptive_ms = 0.0, adaptive_pct = 5.0;
+    // everything after "--" is the wrapped command, getopt only sees what is before it
+    char **cmd = NULL;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--") == 0){
+            if(i + 1 == argc){
+                usage();
+            }
+            cmd = argv + i + 1;
+            argc = i;
+            break;
+        }
+    }
+    int opt;
+    while((opt = getopt(argc, argv, "g:m:jub:f:cr:o:i:d:s:p:P:a:A:C:T:w:")) != -1){
+        switch(opt){
+            case 'g': gpus = optarg; break;
+            case 'm':
+                if(!PowerSetGpuMetrics(optarg)){
+                    usage();
+                }
+                metrics = true;
+                break;
+            case 'j': PowerSetGpuProcesses(true); processes = true; break;
+            case 'u': unified = true; break;
+            case 'c': PowerSetPerCore(true); break;
+            case 'r':
+                if(rapl_backend_type(optarg) < 0){
+                    usage();
+                }
+                PowerSetRaplBackend(rapl_backend_type(optarg));
+                break;
+            case 'o': summary = optarg; break;
+            case 'p': pin = optarg; break;
+            case 'a': adaptive_ms = parse_interval(optarg); break;
+            case 'A':
+                adaptive_pct = atof(optarg);
+                if(adaptive_pct <= 0.0){
+                    usage();
+                }
+                break;
+            case 'P':
+                if(atoi(optarg) < 1 || atoi(optarg) > 99){
+                    usage();
+                }
+                affinity_set_fifo(atoi(optarg));
+                break;
+            case 's': shm = optarg; unified = true; break;
+            case 'C': collector = optarg; unified = true; break;
+            case 'T': trigger = optarg; unified = true; break;
+            case 'w': {
+                // pre[:post], post defaults to pre
+                std::string w(optarg);
+                size_t colon = w.find(':');
+                trigger_pre = parse_interval(w.substr(0, colon).c_str());
+                trigger_post = colon == std::string::npos ? trigger_pre : parse_interval(w.substr(colon + 1).c_str());
+                break;
+            }
+            case 'd':
+                port = atoi(optarg);
+                if(port <= 0 || port > 65535){
+                    usage();
+                }
+                break;
+            case 'i':
+                calibrate = atof(optarg);
+                if(calibrate <= 0.0){
+                    usage();
+                }
+                break;
+            case 'b': gpu_ms = parse_interval(optarg); break;
+            case 'f':
+                if((format = TraceParseFormat(optarg)) < 0){
+                    usage();
+                }
+                PowerSetFormat(format);
+                break;
+            default: usage();
+        }
+    }
+    std::vector<int> cpus;
+    if(pin != NULL){
+        if(parse_cpu_list(pin, cpus) == 0){
+            usage();
+        }
+    } else if(cmd != NULL){
+        // keep out of the command's way: a socket 0 cpu it will not run on
+        int cpu = affinity_pick_housekeeping();
+        if(cpu >= 0){
+            cpus.push_back(cpu);
+        }
+    }
+    affinity_set_cpus(cpus);
+    if(bench){
+        double sweep[BENCH_MAX_INTERVALS] = {10.0, 5.0, 2.0, 1.0, 0.5, 0.25, 0.1};
+        int n = 7;
+        if(argc - optind > 0){
+            n = 0;
+            for(int i = optind; i < argc && n < BENCH_MAX_INTERVALS; i++){
+                sweep[n++] = parse_interval(argv[i]);
+            }
+        }
+        return PowerBench(sweep, n, gpus);
+    }
+    if(argc - optind > 1 || (argc - optind == 0 && cmd == NULL && port == 0)){
+        usage();
+    }
+    if((port > 0 || shm != NULL || collector != NULL || metrics || processes) && gpu_ms > 0.0){
+        usage();
+    }
+    if(port > 0 && (cmd != NULL || collector != NULL)){
+        usage();
+    }
+    // a trigger captures fixed windows of one fixed-rate trace
+    if(trigger != NULL && (port > 0 || collector != NULL || adaptive_ms > 0.0 || gpu_ms > 0.0 ||
+                           !PowerSetTrigger(trigger, trigger_pre, trigger_post))){
+        usage();
+    }
+    double ms = argc - optind == 1 ? parse_interval(argv[optind]) : 100.0;
+    std::string collect_host;
+    int collect_port = 0;
+    int local_rank = -1, rank = -1;
+    if(collector != NULL){
+        parse_collector(collector, collect_host, collect_port);
+        rank = collect_mpi_rank(&local_rank);
+        // one sampler per node: the other ranks of the node just run the command
+        if(local_rank > 0 && cmd != NULL){
+            execvp(cmd[0], cmd);
+            perror("execvp");
+            exit(127);
+        }
+    }
+    if(summary != NULL){
+        PowerSetSummaryFile(summary);
+    }
+    if(adaptive_ms > 0.0){
+        if(adaptive_ms <= ms){
+            usage();
+        }
+        PowerSetAdaptive(adaptive_ms, adaptive_pct/100.0);
+    }
+    // fork before NVML and RAPL are initialised, the child waits for start()
+    Launcher *launcher = cmd != NULL ? new Launcher(cmd) : NULL;
+    // NVML and RAPL open concurrently once, calibration and Begin reuse them
+    PowerInit(gpus);
+    if(calibrate > 0.0){
+        PowerCalibrate(calibrate, ms, gpus);
+    }
+    if(port > 0){
+        return Daemon(port, ms, gpus, shm);
+    }
+    // only the unified sampler publishes, -s implies -u
+    power_snapshot_t *snap = shm != NULL ? snapshot_create_shm(shm) : NULL;
+    PowerSetSnapshot(snap);
+    // rank 0 aggregates the cluster, it listens before its own sampler connects
+    Aggregator *aggregator = NULL;
+    CollectorClient *client = NULL;
+    if(collector != NULL){
+        if(rank == 0){
+            aggregator = new Aggregator(collect_port, (uint64_t)(ms*1000000.0), format);
+            aggregator->start();
+        }
+        char node[COLLECT_NAME_LEN];
+        gethostname(node, sizeof(node));
+        node[COLLECT_NAME_LEN - 1] = '\0';
+        client = new CollectorClient(collect_host.c_str(), collect_port, node, (uint64_t)(ms*1000000.0));
+        PowerSetSink(CollectorClient::sink, client);
+    }
+    // begin
+    if(launcher == NULL){
+        printf("Press enter to finalize...\n");
+    }
+    if(unified){
+        PowerBegin("node", ms, gpus);
+    } else if(gpu_ms > 0.0){
+        GPUPowerBeginBuffered("gpu", gpu_ms, gpus);
+        CPUPowerBegin("cpu", ms);
+    } else {
+        GPUPowerBegin("gpu", ms, gpus);
+        CPUPowerBegin("cpu", ms);
+    }
+
+    int status = EXIT_SUCCESS;
+    if(launcher != NULL){
+        launcher->start();
+        status = launcher->wait();
+    } else {
+        printf("enter para terminar\n"); fflush(stdout);
+        getchar();
+    }
+    // end
+    if(unified){
+        PowerEnd();
+    } else {
+        GPUPowerEnd();
+        CPUPowerEnd();
+    }
+    if(snap != NULL){
+        PowerSetSnapshot(NULL);
+        snapshot_destroy_shm(snap, shm);
+    }
+    if(client != NULL){
+        PowerSetSink(NULL, NULL);
+        delete client;
+    }
+    if(aggregator != NULL){
+        aggregator->finish(COLLECT_LINGER_SECS);
+        aggregator->summary(stdout);
+        delete aggregator;
+    }
+    if(launcher != NULL){
+        WrapperSummary(launcher, cmd, status, launch_ns);
+        delete launcher;
+    }
+    exit(status);
+}
@@ -8,9 +8,46 @@
 bool GPUpollThreadStatus = false;
 bool CPUpollThreadStatus = false;
 unsigned int deviceCount = 0;
+// true between nvmlInit and nvmlShutdown
+bool nvmlActive = false;
 char deviceNameStr[64];
+
+// Devices being sampled (all of them, or the subset given to GPUPowerBegin)
+unsigned int gpuCount = 0;
+unsigned int gpuIndex[MAX_GPUS];
+nvmlDevice_t gpuDevices[MAX_GPUS];
+char gpuNames[MAX_GPUS][64];
+
+// Volta and newer expose a hardware energy counter (mJ), older devices fall back to power*dt
+bool gpuEnergySupported[MAX_GPUS];
+unsigned long long gpuLastEnergy[MAX_GPUS];
+unsigned long long gpuStartEnergy[MAX_GPUS];
+// seconds of sampling since the counter last moved, what its next delta is spread over
+double gpuEnergyAge[MAX_GPUS];
+
+// extra metrics selected with PowerSetGpuMetrics, created by GPUInit
+std::vector<int> gpuMetricIds;
+GpuMetrics *gpuMetrics = NULL;
+
+// per-process GPU energy (PowerSetGpuProcesses), created by GPUInit and kept for the summary
+bool gpuProcessesEnabled = false;
+GpuProcesses *gpuProcesses = NULL;
+
+// threshold-triggered capture of the unified sampler (PowerSetTrigger), kept for the summary
+std::vector<trigger_threshold_t> triggerThresholds;
+double triggerPreMs = 0.0, triggerPostMs = 0.0;
+Trigger *trigger = NULL;
+
+// Driver sample buffers for the buffered GPU capture mode
+nvmlSample_t *gpuSampleBuf[MAX_GPUS];
+unsigned int gpuSampleBufSize[MAX_GPUS];
+unsigned long long gpuLastSampleTs[MAX_GPUS];
+
 std::string CPUfilename;
 std::string GPUfilename;
+int traceFormat = TRACE_TEXT;
+bool raplPerCore = false;
+int raplBackend = RAPL_BACKEND_AUTO;
 
 nvmlReturn_t nvmlResult;
 nvmlDevice_t nvmlDeviceID;
@@ -19,8 +56,34 @@ nvmlEnableState_t pmmode;
 nvmlComputeMode_t computeMode;
 Rapl *rapl;
 
-int CPU_SAMPLE_MS = 100;
-int GPU_SAMPLE_MS = 100;
+uint64_t CPU_SAMPLE_NS = 100*1000*1000;
+uint64_t GPU_SAMPLE_NS = 100*1000*1000;
+
+// adaptive sampling: the intervals above are the minimum, 0 keeps a fixed interval
+uint64_t ADAPTIVE_MAX_NS = 0;
+double adaptiveThreshold = 0.05;
+
+// deadlines missed by each sampler, reported in the summary
+unsigned long gpuMissedDeadlines = 0, gpuTicks = 0;
+unsigned long cpuMissedDeadlines = 0, cpuTicks = 0;
+
+// true when CPU and GPU are sampled by the single PowerPollingFunc thread
+bool unifiedMode = false;
+
+// optional copy of the summary, and how long the energy sources took to initialise
+std::string summaryFilename;
+double cpuInitTime = 0.0;
+double gpuInitTime = 0.0;
+
+// CPU time the sampler threads spent themselves, what powermon costs the node
+double cpuSamplerCpuTime = 0.0;
+double gpuSamplerCpuTime = 0.0;
+// wake up lateness of the sampler threads
+Stats cpuJitter, gpuJitter;
+
+// idle power measured by PowerCalibrate, empty when no calibration was run
+Stats baseCpu, baseDram, baseGpu, baseGpuDev[MAX_GPUS];
+double calibrationTime = 0.0;
 
 
 double gpuCurrentPower;
@@ -28,81 +91,428 @@ double gpuAveragePower;
 double gpuTotalEnergy;
 double gpuTotalTime;
 
+// per-device values, gpuCurrentPower/gpuTotalEnergy above are the node totals
+double gpuDevCurrentPower[MAX_GPUS];
+double gpuDevAveragePower[MAX_GPUS];
+double gpuDevTotalEnergy[MAX_GPUS];
+
+// live view for the exporter and shared memory readers, written by the unified sampler
+power_snapshot_t *liveSnapshot = NULL;
+
+// optional consumer of every unified record (Collector), and when that sampler started
+void (*recordSink)(const double *record, void *arg) = NULL;
+void *recordSinkArg = NULL;
+uint64_t samplerStartNs = 0;
+
+// application work counter (powermon_add_work) and the work done while the sampler ran
+extern "C" { unsigned long long powermon_work = 0; }
+bool workEnabled = false;
+unsigned long long workTotal = 0;
+
+// power distribution of every domain over the measurement, constant memory
+Stats cpuPowerStats, dramPowerStats, gpuPowerStats, gpuDevPowerStats[MAX_GPUS];
+
 pthread_t GPUpowerPollThread;
 pthread_t CPUpowerPollThread;
 
 /*
-Poll the GPU using nvml APIs.
+Start the RAPL wrap guard when the slowest sampling interval (adaptive maximum
+included) is longer than a safe fraction of the counter wrap time, so long
+output intervals keep exact totals.
 */
-void *GPUpowerPollingFunc(void *ptr){
+void RaplGuard(uint64_t interval_ns){
+    uint64_t slowest = ADAPTIVE_MAX_NS > interval_ns ? ADAPTIVE_MAX_NS : interval_ns;
+    uint64_t guard_ns = (uint64_t)(rapl->wrap_time()/RAPL_GUARD_FRACTION*NS_PER_SEC);
+    if (slowest > guard_ns){
+        printf("RAPL counters can wrap in %.3f secs, reading them every %.3f secs in the background\n",
+                rapl->wrap_time(), guard_ns/1e9);
+        rapl->start_guard(guard_ns);
+    }
+}
 
+// CPU time of the calling thread in seconds
+double ThreadCpuTime(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/*
+Read every sampled GPU once and account dt seconds of energy.
+Devices with a hardware energy counter use the counter delta for both energy and
+power, the others integrate the instantaneous power reading.
+Returns the node power (sum over the sampled devices) in Watts.
+*/
+double GPUSample(double dt){
 	unsigned int powerLevel = 0;
-	FILE *fp = fopen(GPUfilename.c_str(), "w+");
+    unsigned long long energy = 0;
+    double power = 0.0;
+    double denergy;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        if (gpuEnergySupported[d] &&
+            nvmlDeviceGetTotalEnergyConsumption(gpuDevices[d], &energy) == NVML_SUCCESS){
+            // counter is in mJ, a decrease means the driver reset it
+            denergy = energy >= gpuLastEnergy[d] ? (energy - gpuLastEnergy[d])/1000.0 : 0.0;
+            gpuLastEnergy[d] = energy;
+            // the counter only updates every few ms: keep the last power while it holds still,
+            // then spread the delta over all the ticks since it last moved
+            gpuEnergyAge[d] += dt;
+            if (gpuEnergyAge[d] > 0.0 && denergy > 0.0){
+                gpuDevCurrentPower[d] = denergy/gpuEnergyAge[d];
+                gpuEnergyAge[d] = 0.0;
+            }
+        } else {
+            // Get the power usage in milliWatts.
+            nvmlResult = nvmlDeviceGetPowerUsage(gpuDevices[d], &powerLevel);
+            if (NVML_SUCCESS != nvmlResult){
+                // keep the last reading rather than reporting a false zero
+                powerLevel = (unsigned int)(gpuDevCurrentPower[d]*1000.0);
+            }
+            gpuDevCurrentPower[d] = (double)powerLevel/1000.0;
+            denergy = gpuDevCurrentPower[d]*dt;
+        }
+        gpuDevTotalEnergy[d] += denergy;
+        gpuTotalEnergy += denergy;
+        power += gpuDevCurrentPower[d];
+        gpuDevPowerStats[d].add(gpuDevCurrentPower[d]);
+    }
+    gpuCurrentPower = power;
+    if (gpuCount > 0){
+        gpuPowerStats.add(power);
+    }
+    return power;
+}
+
+/*
+Node GPU energy in Joules since GPUInit, for region boundaries. Devices with an
+energy counter are read directly, the others return the sampler's integral.
+Does not modify the sampler state so it is safe to call from any thread.
+*/
+double GPUEnergySnapshot(){
+    unsigned long long energy;
+    double total = 0.0;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        if (gpuEnergySupported[d] &&
+            nvmlDeviceGetTotalEnergyConsumption(gpuDevices[d], &energy) == NVML_SUCCESS){
+            total += energy >= gpuStartEnergy[d] ? (energy - gpuStartEnergy[d])/1000.0 : 0.0;
+        } else {
+            total += gpuDevTotalEnergy[d];
+        }
+    }
+    return total;
+}
+
+// Store the averages of a finished GPU measurement for the summary
+void GPUSampleFinish(double acctime){
+    gpuTotalTime = acctime;
+    gpuAveragePower = acctime > 0.0 ? gpuTotalEnergy/acctime : 0.0;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        gpuDevAveragePower[d] = acctime > 0.0 ? gpuDevTotalEnergy[d]/acctime : 0.0;
+    }
+}
+
+// One column per device and extra metric, after the power columns
+void GPUMetricFields(Trace *trace){
+    char colname[32];
+    if (gpuMetrics == NULL){
+        return;
+    }
+    for (unsigned int d = 0; d < gpuCount; d++){
+        for (int k = 0; k < gpuMetrics->count(); k++){
+            snprintf(colname, sizeof(colname), "gpu%u-%s", gpuIndex[d], gpuMetrics->metric(k)->name);
+            trace->add_field(colname, gpuMetrics->metric(k)->unit, gpuMetrics->metric(k)->type);
+        }
+    }
+}
+
+// Write the values of the last GPUMetrics sample, returns the number of columns
+int GPUMetricRecord(double *r){
+    int n = 0;
+    if (gpuMetrics == NULL){
+        return 0;
+    }
+    for (unsigned int d = 0; d < gpuCount; d++){
+        for (int k = 0; k < gpuMetrics->count(); k++){
+            r[n++] = gpuMetrics->value(d, k);
+        }
+    }
+    return n;
+}
+
+/*
+Poll the GPUs using nvml APIs.
+*/
+void *GPUpowerPollingFunc(void *ptr){
+    affinity_apply(true);
+
     int timestep = 0;
-    struct timeval t1, t2;
-	gettimeofday(&t1, NULL);
+    Deadline deadline(GPU_SAMPLE_NS);
+    Adaptive adaptive(GPU_SAMPLE_NS, ADAPTIVE_MAX_NS, adaptiveThreshold);
+    uint64_t t1 = Deadline::now_ns(), t2;
     double dt = 0.0;
     double acctime = 0.0;
-    double accenergy = 0.0;
     double power = 0.0;
-    // column names
-	fprintf(fp, "%-15s %-15s %-15s %-15s %-15s %-15s\n", "#timestep", "power", "acc-energy", "avg-power", "dt", "acc-time");
-    
+    char colname[32];
+    // columns, node totals first and then one power/energy pair per device
+    Trace trace(GPUfilename, traceFormat, TRACE_KIND_GPU);
+    trace.add_field("timestep", "", 'i');
+    trace.add_field("power", "W");
+    trace.add_field("acc-energy", "J");
+    trace.add_field("avg-power", "W");
+    trace.add_field("dt", "s");
+    trace.add_field("acc-time", "s");
+    for (unsigned int d = 0; d < gpuCount; d++){
+        snprintf(colname, sizeof(colname), "gpu%u-power", gpuIndex[d]);
+        trace.add_field(colname, "W");
+        snprintf(colname, sizeof(colname), "gpu%u-energy", gpuIndex[d]);
+        trace.add_field(colname, "J");
+    }
+    GPUMetricFields(&trace);
+    trace.set_info(0, gpuCount, GPU_SAMPLE_NS);
+    trace.open();
 
+    deadline.start();
 	while(GPUpollThreadStatus){
         timestep++;
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
-		usleep(1000 * GPU_SAMPLE_MS);
-	    gettimeofday(&t2, NULL);
-        dt = (t2.tv_sec - t1.tv_sec) + ((t2.tv_usec - t1.tv_usec)/1000000.0);
+        t2 = deadline.wait();
+        dt = (double)(t2 - t1)/NS_PER_SEC;
         acctime += dt;
-		// Get the power management mode of the GPU.
-		//nvmlResult = nvmlDeviceGetPowerManagementMode(nvmlDeviceID, &pmmode);
-
-		// The following function may be utilized to handle errors as needed.
-		//getNVMLError(nvmlResult);
-
-		// Check if power management mode is enabled.
-		//if (pmmode == NVML_FEATURE_ENABLED){
-			// Get the power usage in milliWatts.
-		nvmlResult = nvmlDeviceGetPowerUsage(nvmlDeviceID, &powerLevel);
-		//}
-        power = (double)powerLevel/1000.0;
-        gpuCurrentPower = power;
-        accenergy += power*dt;
+        power = GPUSample(dt);
+        if (gpuMetrics != NULL){
+            gpuMetrics->sample(dt);
+        }
+        if (gpuProcesses != NULL){
+            gpuProcesses->sample(gpuDevTotalEnergy);
+        }
 		// The output file stores power in Watts.
-        fprintf(fp,"%-15i %-15f %-15f %-15f %-15f %-15f\n", 
-                timestep, power, accenergy, accenergy/acctime, dt, acctime);
+        double *r = trace.record();
+        if (r != NULL){
+            r[0] = timestep; r[1] = power; r[2] = gpuTotalEnergy;
+            r[3] = gpuTotalEnergy/acctime; r[4] = dt; r[5] = acctime;
+            for (unsigned int d = 0; d < gpuCount; d++){
+                r[6 + 2*d] = gpuDevCurrentPower[d];
+                r[7 + 2*d] = gpuDevTotalEnergy[d];
+            }
+            GPUMetricRecord(r + 6 + 2*gpuCount);
+            trace.commit();
+        }
+        if (ADAPTIVE_MAX_NS > 0){
+            deadline.set_period(adaptive.update(power));
+        }
         t1 = t2;
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
 	}
-	fclose(fp);
-    gpuAveragePower = accenergy/acctime;
-    gpuTotalEnergy = accenergy;
-    gpuTotalTime = acctime;
+	trace.close();
+    GPUSampleFinish(acctime);
+    gpuTicks = deadline.get_ticks();
+    gpuMissedDeadlines = deadline.get_missed();
+    gpuSamplerCpuTime = ThreadCpuTime();
+    gpuJitter = deadline.get_jitter();
 	pthread_exit(0);
 }
 
+// Convert an NVML sample value to double according to its reported type
+double nvmlValueToDouble(nvmlValueType_t type, nvmlValue_t value){
+    switch (type){
+        case NVML_VALUE_TYPE_DOUBLE: return value.dVal;
+        case NVML_VALUE_TYPE_UNSIGNED_INT: return (double)value.uiVal;
+        case NVML_VALUE_TYPE_UNSIGNED_LONG: return (double)value.ulVal;
+        case NVML_VALUE_TYPE_UNSIGNED_LONG_LONG: return (double)value.ullVal;
+        case NVML_VALUE_TYPE_SIGNED_LONG_LONG: return (double)value.sllVal;
+        default: return 0.0;
+    }
+}
 
 /*
-Start power measurement by spawning a pthread that polls the GPU.
-Function needs to be modified as per usage to handle errors as seen fit.
+Drain the driver power sample ring of every GPU, writing each sample newer than
+the last seen timestamp. Devices without an energy counter integrate energy from
+these samples, which are much denser than the wake up interval.
+Returns the number of samples written.
 */
-void GPUPowerBegin(const char *alg, int ms){
-    GPU_SAMPLE_MS = ms;
-	int i;
-	// Initialize nvml.
-	nvmlResult = nvmlInit();
-	if (NVML_SUCCESS != nvmlResult){
-		printf("NVML Init fail: %s\n", nvmlErrorString(nvmlResult));
-		exit(0);
+unsigned int GPUDrainSamples(Trace *trace, unsigned long long t0, unsigned long long *n){
+    nvmlValueType_t type;
+    unsigned int count, written = 0;
+    unsigned long long energy;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        count = gpuSampleBufSize[d];
+        nvmlResult = nvmlDeviceGetSamples(gpuDevices[d], NVML_TOTAL_POWER_SAMPLES, gpuLastSampleTs[d],
+                                          &type, &count, gpuSampleBuf[d]);
+        if (NVML_SUCCESS != nvmlResult){
+            // NOT_FOUND just means no new samples since the last drain
+            count = 0;
+        }
+        for (unsigned int k = 0; k < count; k++){
+            unsigned long long ts = gpuSampleBuf[d][k].timeStamp;
+            if (ts <= gpuLastSampleTs[d]){
+                continue;
+            }
+            // power samples are in mW, timestamps in us
+            double power = nvmlValueToDouble(type, gpuSampleBuf[d][k].sampleValue)/1000.0;
+            if (!gpuEnergySupported[d] && gpuLastSampleTs[d] > 0){
+                double denergy = gpuDevCurrentPower[d]*(ts - gpuLastSampleTs[d])/1000000.0;
+                gpuDevTotalEnergy[d] += denergy;
+                gpuTotalEnergy += denergy;
+            }
+            gpuDevCurrentPower[d] = power;
+            gpuDevPowerStats[d].add(power);
+            gpuLastSampleTs[d] = ts;
+            double *r = trace->record();
+            if (r != NULL){
+                r[0] = ++(*n); r[1] = gpuIndex[d]; r[2] = (ts - t0)/1000000.0; r[3] = power;
+                trace->commit();
+            }
+            written++;
+        }
+        if (gpuEnergySupported[d] &&
+            nvmlDeviceGetTotalEnergyConsumption(gpuDevices[d], &energy) == NVML_SUCCESS){
+            double denergy = energy >= gpuLastEnergy[d] ? (energy - gpuLastEnergy[d])/1000.0 : 0.0;
+            gpuLastEnergy[d] = energy;
+            gpuDevTotalEnergy[d] += denergy;
+            gpuTotalEnergy += denergy;
+        }
+    }
+    gpuCurrentPower = 0.0;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        gpuCurrentPower += gpuDevCurrentPower[d];
+    }
+    if (gpuCount > 0){
+        gpuPowerStats.add(gpuCurrentPower);
+    }
+    return written;
+}
+
+/*
+Buffered GPU capture: wake every interval and write every sample the driver
+recorded since the previous wake up.
+*/
+void *GPUbufferPollingFunc(void *ptr){
+    affinity_apply(true);
+    Trace trace(GPUfilename, traceFormat, TRACE_KIND_GPU_SAMPLES);
+    Deadline deadline(GPU_SAMPLE_NS);
+    uint64_t t0 = Deadline::now_ns();
+    struct timeval tv;
+    unsigned long long samples = 0;
+    nvmlValueType_t type;
+
+    // allocate each driver ring once, and skip the samples older than now
+	gettimeofday(&tv, NULL);
+    unsigned long long wall0 = (unsigned long long)tv.tv_sec*1000000ULL + tv.tv_usec;
+    for (unsigned int d = 0; d < gpuCount; d++){
+        gpuSampleBufSize[d] = 0;
+        nvmlResult = nvmlDeviceGetSamples(gpuDevices[d], NVML_TOTAL_POWER_SAMPLES, 0, &type, &gpuSampleBufSize[d], NULL);
+        if (NVML_SUCCESS != nvmlResult || gpuSampleBufSize[d] == 0){
+            printf("GPU %u does not provide power samples: %s\n", gpuIndex[d], nvmlErrorString(nvmlResult));
+            gpuSampleBufSize[d] = 0;
+        }
+        gpuSampleBuf[d] = new nvmlSample_t[gpuSampleBufSize[d] > 0 ? gpuSampleBufSize[d] : 1];
+        gpuLastSampleTs[d] = wall0;
+    }
+    trace.add_field("sample", "", 'i');
+    trace.add_field("gpu", "", 'i');
+    trace.add_field("time", "s");
+    trace.add_field("power", "W");
+    trace.set_info(0, gpuCount, GPU_SAMPLE_NS);
+    trace.open();
+
+    deadline.start();
+	while(GPUpollThreadStatus){
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
+        deadline.wait();
+        GPUDrainSamples(&trace, wall0, &samples);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
 	}
+    // pick up what the driver recorded since the last wake up
+    GPUDrainSamples(&trace, wall0, &samples);
+	trace.close();
+    GPUSampleFinish((double)(Deadline::now_ns() - t0)/NS_PER_SEC);
+    gpuTicks = deadline.get_ticks();
+    gpuMissedDeadlines = deadline.get_missed();
+    for (unsigned int d = 0; d < gpuCount; d++){
+        delete[] gpuSampleBuf[d];
+    }
+    printf("GPU buffered capture wrote %llu driver samples\n", samples);
+    gpuSamplerCpuTime = ThreadCpuTime();
+    gpuJitter = deadline.get_jitter();
+	pthread_exit(0);
+}
 
-	// Count the number of GPUs available.
-	nvmlResult = nvmlDeviceGetCount(&deviceCount);
-	if (NVML_SUCCESS != nvmlResult){
-		printf("Failed to query device count: %s\n", nvmlErrorString(nvmlResult));
-		exit(0);
+/*
+Parse a comma separated list of device indices (e.g. "0,2,3") into gpuIndex.
+A NULL or empty list selects every device, "none" no device at all.
+*/
+static void GPUSelectDevices(const char *devices){
+    gpuCount = 0;
+    if (devices != NULL && strcmp(devices, "none") == 0){
+        return;
+    }
+    if (devices == NULL || devices[0] == '\0'){
+        for (unsigned int i = 0; i < deviceCount && i < MAX_GPUS; i++){
+            gpuIndex[gpuCount++] = i;
+        }
+        return;
+    }
+    std::string list(devices);
+    size_t pos = 0;
+    while (pos <= list.size()){
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos){
+            comma = list.size();
+        }
+        std::string token = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (token.empty()){
+            continue;
+        }
+        char *end;
+        long idx = strtol(token.c_str(), &end, 10);
+        if (*end != '\0' || idx < 0 || (unsigned int)idx >= deviceCount){
+            printf("Invalid GPU index '%s' (found %u devices)\n", token.c_str(), deviceCount);
+            exit(0);
+        }
+        if (gpuCount == MAX_GPUS){
+            printf("Too many GPUs selected, max is %d\n", MAX_GPUS);
+            exit(0);
+        }
+        gpuIndex[gpuCount++] = (unsigned int)idx;
+    }
+}
+
+
+/*
+Initialize NVML and get a handle for each selected device.
+Function needs to be modified as per usage to handle errors as seen fit.
+*/
+void GPUInit(const char *devices){
+	unsigned int i;
+	uint64_t t0 = Deadline::now_ns();
+	bool opened = false;
+	// NVML is only loaded when GPUs are sampled: -g none and nodes without a driver skip it
+	if (devices != NULL && strcmp(devices, "none") == 0){
+		deviceCount = 0;
+	} else if (!nvmlActive && !nvml_load()){
+		if (devices != NULL){
+			printf("Cannot sample GPUs %s, NVML not available: %s\n", devices, nvml_error());
+			exit(0);
+		}
+		printf("NVML not available (%s), sampling the CPU only\n", nvml_error());
+		deviceCount = 0;
+	} else if (!nvmlActive){
+		// Initialize nvml.
+		nvmlResult = nvmlInit();
+		if (NVML_SUCCESS != nvmlResult){
+			printf("NVML Init fail: %s\n", nvmlErrorString(nvmlResult));
+			exit(0);
+		}
+		nvmlActive = true;
+		opened = true;
+
+		// Count the number of GPUs available.
+		nvmlResult = nvmlDeviceGetCount(&deviceCount);
+		if (NVML_SUCCESS != nvmlResult){
+			printf("Failed to query device count: %s\n", nvmlErrorString(nvmlResult));
+			exit(0);
+		}
 	}
 
 	for (i = 0; i < deviceCount; i++){
@@ -135,12 +545,76 @@ void GPUPowerBegin(const char *alg, int ms){
 		}
 	}
 
-	// This statement assumes that the first indexed GPU will be used.
-	// If there are multiple GPUs that can be used by the system, this needs to be done with care.
-	// Test thoroughly and ensure the correct device ID is being used.
-	nvmlResult = nvmlDeviceGetHandleByIndex(0, &nvmlDeviceID);
+	// Keep a handle for every selected device, the polling thread samples all of them.
+	GPUSelectDevices(devices);
+	for (i = 0; i < gpuCount; i++){
+		nvmlResult = nvmlDeviceGetHandleByIndex(gpuIndex[i], &gpuDevices[i]);
+		if (NVML_SUCCESS != nvmlResult){
+			printf("Failed to get handle for device %u: %s\n", gpuIndex[i], nvmlErrorString(nvmlResult));
+			exit(0);
+		}
+		nvmlDeviceGetName(gpuDevices[i], gpuNames[i], sizeof(gpuNames[i]));
+		gpuDevCurrentPower[i] = 0.0;
+		gpuDevTotalEnergy[i] = 0.0;
+		// Probe the energy counter, supported from Volta on
+		gpuEnergySupported[i] = nvmlDeviceGetTotalEnergyConsumption(gpuDevices[i], &gpuLastEnergy[i]) == NVML_SUCCESS;
+		gpuStartEnergy[i] = gpuLastEnergy[i];
+		gpuEnergyAge[i] = 0.0;
+		unsigned int powerLevel = 0;
+		if (NVML_SUCCESS == nvmlDeviceGetPowerUsage(gpuDevices[i], &powerLevel)){
+			gpuDevCurrentPower[i] = (double)powerLevel/1000.0;
+		}
+		printf("Sampling GPU %u: %s (%s)\n", gpuIndex[i], gpuNames[i],
+			gpuEnergySupported[i] ? "energy counter" : "integrated power");
+	}
+	gpuCurrentPower = 0.0;
+	gpuTotalEnergy = 0.0;
+	gpuPowerStats.reset();
+	for (i = 0; i < gpuCount; i++){
+		gpuDevPowerStats[i].reset();
+	}
+	delete gpuMetrics;
+	gpuMetrics = NULL;
+	if (!gpuMetricIds.empty()){
+		gpuMetrics = new GpuMetrics(gpuMetricIds);
+		gpuMetrics->init(gpuDevices, gpuCount, gpuIndex);
+	}
+	delete gpuProcesses;
+	gpuProcesses = NULL;
+	if (gpuProcessesEnabled && gpuCount > 0){
+		gpuProcesses = new GpuProcesses();
+		gpuProcesses->init(gpuDevices, gpuCount, gpuIndex);
+	}
+	// a later GPUInit reuses the open NVML session, only the first one is startup cost
+	if (opened){
+		gpuInitTime = (double)(Deadline::now_ns() - t0)/NS_PER_SEC;
+	}
+}
+
+// Shut down NVML once sampling has stopped
+void GPUShutdown(){
+	delete gpuMetrics;
+	gpuMetrics = NULL;
+	if (!nvmlActive){
+		return;
+	}
+	nvmlActive = false;
+	nvmlResult = nvmlShutdown();
+	if (NVML_SUCCESS != nvmlResult)
+	{
+		printf("Failed to shut down NVML: %s\n", nvmlErrorString(nvmlResult));
+		exit(0);
+	}
+}
+
+/*
+Start power measurement by spawning a pthread that polls the GPU.
+*/
+void GPUPowerBegin(const char *alg, double ms, const char *devices){
+    GPU_SAMPLE_NS = (uint64_t)(ms*1000000.0);
+	GPUInit(devices);
 	GPUpollThreadStatus = true;
-    GPUfilename = std::string("power-") + std::string(alg) + std::string(".dat");
+    GPUfilename = TraceFilename(alg);
 	const char *message = "GPU-power";
 	int iret = pthread_create(&GPUpowerPollThread, NULL, GPUpowerPollingFunc, (void*) message);
 	if (iret){
@@ -150,6 +624,23 @@ void GPUPowerBegin(const char *alg, int ms){
 	usleep(1000*COOLDOWN_MS);
 }
 
+/*
+Start buffered GPU capture, the polling thread only wakes every ms milliseconds
+(a few hundred is a good value) and drains the driver sample buffers.
+*/
+void GPUPowerBeginBuffered(const char *alg, double ms, const char *devices){
+    GPU_SAMPLE_NS = (uint64_t)(ms*1000000.0);
+	GPUInit(devices);
+	GPUpollThreadStatus = true;
+    GPUfilename = TraceFilename(alg);
+	int iret = pthread_create(&GPUpowerPollThread, NULL, GPUbufferPollingFunc, NULL);
+	if (iret){
+		fprintf(stderr,"Error - pthread_create() return code: %d\n",iret);
+		exit(0);
+	}
+	usleep(1000*COOLDOWN_MS);
+}
+
 /*
 End power measurement. This ends the polling thread.
 */
@@ -157,13 +648,7 @@ void GPUPowerEnd(){
 	usleep(1000*COOLDOWN_MS);
 	GPUpollThreadStatus = false;
 	pthread_join(GPUpowerPollThread, NULL);
-
-	nvmlResult = nvmlShutdown();
-	if (NVML_SUCCESS != nvmlResult)
-	{
-		printf("Failed to shut down NVML: %s\n", nvmlErrorString(nvmlResult));
-		exit(0);
-	}
+	GPUShutdown();
 }
 
 /*
@@ -208,12 +693,105 @@ int getNVMLError(nvmlReturn_t resultToCheck)
 }
 
 
+// Helper thread body of PowerInit, NVML then opens next to RAPL
+static void *GPUInitThread(void *devices){
+    GPUInit((const char*)devices);
+    return NULL;
+}
+
+/*
+Initialise NVML on a helper thread while RAPL opens its counters, so startup
+costs the slower of the two instead of their sum.
+*/
+void PowerInit(const char *devices){
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, GPUInitThread, (void*)devices) != 0){
+        GPUInit(devices);
+        RaplInit();
+        return;
+    }
+    RaplInit();
+    pthread_join(thread, NULL);
+}
+
+// Create the RAPL reader, or restart the one left by PowerCalibrate
+void RaplInit(){
+    cpuPowerStats.reset();
+    dramPowerStats.reset();
+    if (rapl != NULL){
+        rapl->reset();
+        return;
+    }
+    uint64_t t0 = Deadline::now_ns();
+    rapl = new Rapl(raplPerCore, raplBackend);
+    cpuInitTime = (double)(Deadline::now_ns() - t0)/NS_PER_SEC;
+}
+
+// Add the current package and DRAM power to their statistics
+void CPUStatsAdd(){
+    cpuPowerStats.add(rapl->pkg_current_power());
+    dramPowerStats.add(rapl->dram_current_power());
+}
+
+/*
+Half width of the 95% interval of the dynamic energy over secs seconds, from the
+standard error of the baseline mean. The counters themselves are exact enough
+that the baseline dominates the error.
+*/
+double baseline_error(Stats *b, double secs){
+    if (b->get_n() < 2){
+        return 0.0;
+    }
+    return 1.96*b->stddev()/sqrt((double)b->get_n())*secs;
+}
+
+/*
+Sample the idle node for secs seconds at the ms interval before the workload
+starts and keep the mean power of every domain. The summary then reports the
+dynamic energy, total minus baseline*time, next to the raw figures.
+*/
+void PowerCalibrate(double secs, double ms, const char *devices){
+    uint64_t t0 = Deadline::now_ns();
+    PowerInit(devices);
+    baseCpu.reset();
+    baseDram.reset();
+    baseGpu.reset();
+    for (unsigned int d = 0; d < MAX_GPUS; d++){
+        baseGpuDev[d].reset();
+    }
+    printf("Calibrating idle power for %.1f secs...\n", secs); fflush(stdout);
+
+    Deadline deadline((uint64_t)(ms*1000000.0));
+    uint64_t ticks = (uint64_t)(secs*1000.0/ms);
+    uint64_t t1 = Deadline::now_ns(), t2;
+    deadline.start();
+    for (uint64_t i = 0; i < ticks; i++){
+        t2 = deadline.wait();
+        rapl->sample();
+        double gpu = GPUSample((double)(t2 - t1)/NS_PER_SEC);
+        t1 = t2;
+        baseCpu.add(rapl->pkg_current_power());
+        baseDram.add(rapl->dram_current_power());
+        if (gpuCount > 0){
+            baseGpu.add(gpu);
+        }
+        for (unsigned int d = 0; d < gpuCount; d++){
+            baseGpuDev[d].add(gpuDevCurrentPower[d]);
+        }
+    }
+    // NVML and RAPL stay open for the Begin that follows
+    calibrationTime = (double)(Deadline::now_ns() - t0)/NS_PER_SEC;
+    printf("Idle baseline: CPU %f W, DRAM %f W, GPU %f W (%lu samples)\n",
+            baseCpu.mean(), baseDram.mean(), baseGpu.mean(), (unsigned long)baseCpu.get_n());
+}
+
 // Begin measuring CPU power
-void CPUPowerBegin(const char *alg, int ms){
-    CPU_SAMPLE_MS = ms;
+void CPUPowerBegin(const char *alg, double ms){
+    CPU_SAMPLE_NS = (uint64_t)(ms*1000000.0);
     CPUpollThreadStatus = true;
-    CPUfilename = std::string("power-") + std::string(alg) + std::string(".dat");
-    rapl = new Rapl();
+    CPUfilename = TraceFilename(alg);
+    RaplInit();
+    RaplGuard(CPU_SAMPLE_NS);
 	int code = pthread_create(&CPUpowerPollThread, NULL, CPUpowerPollingFunc, (void*)NULL);
 	if (code){
 		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
@@ -224,48 +802,505 @@ void CPUPowerBegin(const char *alg, int ms){
 
 // Stop measuring CPU power
 void CPUPowerEnd(){
-    double ckWh = 3600000.0;
 	usleep(1000*COOLDOWN_MS);
 	CPUpollThreadStatus = false;
 	pthread_join(CPUpowerPollThread, 0);
-    //printf("\n\tTotal Energy: %f J\n\tAverage Power: %f W\n\tTime: %f\n\n", rapl->pkg_total_energy(), rapl->pkg_average_power(), rapl->total_time());
-    printf("\n\nSummary:\nCPU Avg. Power:       %f W\n", rapl->pkg_average_power());
-    printf("CPU Total Energy:     %f J = %f kWh\n", rapl->pkg_total_energy(), rapl->pkg_total_energy()/ckWh);
-    printf("CPU Total Time:       %f secs\n", rapl->total_time());
-    printf("\n");
-    printf("DRAM Avg. Power:      %f W\n", rapl->dram_average_power());
-    printf("DRAM Total Energy:    %f J = %f kWh\n", rapl->dram_total_energy(), rapl->dram_total_energy()/ckWh);
-    printf("\n");
-    printf("GPU Avg. Power:       %f W\n", gpuAveragePower);
-    printf("GPU Total Energy:     %f J = %f kWh\n", gpuTotalEnergy, gpuTotalEnergy/ckWh);
-    printf("GPU Total Time:       %f secs\n", gpuTotalTime);
+    rapl->stop_guard();
+    PowerSummary();
+}
+
+// Print the energy summary of the finished measurement to stdout and the summary file
+void PowerSummary(){
+    PowerSummaryTo(stdout);
+    if (!summaryFilename.empty()){
+        FILE *fp = fopen(summaryFilename.c_str(), "w+");
+        if (fp == NULL){
+            perror("summary:fopen");
+            return;
+        }
+        PowerSummaryTo(fp);
+        fclose(fp);
+    }
+}
+
+void PowerSummaryTo(FILE *fp){
+    double ckWh = 3600000.0;
+    //fprintf(fp, "\n\tTotal Energy: %f J\n\tAverage Power: %f W\n\tTime: %f\n\n", rapl->pkg_total_energy(), rapl->pkg_average_power(), rapl->total_time());
+    fprintf(fp, "%sSummary (RAPL via %s):\nCPU Avg. Power:       %f W\n", fp == stdout ? "\n\n" : "", rapl->backend_name(), rapl->pkg_average_power());
+    fprintf(fp, "CPU Total Energy:     %f J = %f kWh\n", rapl->pkg_total_energy(), rapl->pkg_total_energy()/ckWh);
+    fprintf(fp, "CPU Total Time:       %f secs\n", rapl->total_time());
+    fprintf(fp, "\n");
+    fprintf(fp, "DRAM Avg. Power:      %f W\n", rapl->dram_average_power());
+    fprintf(fp, "DRAM Total Energy:    %f J = %f kWh\n", rapl->dram_total_energy(), rapl->dram_total_energy()/ckWh);
+    fprintf(fp, "\n");
+    if (rapl->get_n_cores() > 0){
+        fprintf(fp, "Per-core (cpu: avg. power W / energy J):\n");
+        for (int c = 0; c < rapl->get_n_cores(); c++){
+            fprintf(fp, "  %4d: %10.4f W %14.4f J%s", rapl->core_cpu(c), rapl->core_average_power(c),
+                    rapl->core_total_energy(c), (c % 2 == 1) ? "\n" : "   ");
+        }
+        fprintf(fp, rapl->get_n_cores() % 2 == 1 ? "\n\n" : "\n");
+    }
+    for (unsigned int d = 0; d < gpuCount; d++){
+        fprintf(fp, "GPU%-2u Avg. Power:     %f W   (%s, %s)\n", gpuIndex[d], gpuDevAveragePower[d], gpuNames[d],
+                gpuEnergySupported[d] ? "energy counter" : "integrated power");
+        fprintf(fp, "GPU%-2u Total Energy:   %f J = %f kWh\n", gpuIndex[d], gpuDevTotalEnergy[d], gpuDevTotalEnergy[d]/ckWh);
+    }
+    if (gpuCount > 1){
+        fprintf(fp, "\n");
+    }
+    fprintf(fp, "GPU Avg. Power:       %f W   (%u devices)\n", gpuAveragePower, gpuCount);
+    fprintf(fp, "GPU Total Energy:     %f J = %f kWh\n", gpuTotalEnergy, gpuTotalEnergy/ckWh);
+    fprintf(fp, "GPU Total Time:       %f secs\n", gpuTotalTime);
+    fprintf(fp, "\n");
+    if (gpuProcesses != NULL){
+        gpuProcesses->summary(fp);
+    }
+    if (trigger != NULL){
+        trigger->summary(fp);
+    }
+    double systemEnergy = rapl->pkg_total_energy() + rapl->dram_total_energy() + gpuTotalEnergy;
+    fprintf(fp, "System Total Energy:  %f J = %f kWh   (CPU + DRAM + GPU)\n", systemEnergy, systemEnergy/ckWh);
+    fprintf(fp, "\n");
+    if (workEnabled && workTotal > 0){
+        fprintf(fp, "Work:                 %llu ops, %f ops/s\n", workTotal, rapl->total_time() > 0.0 ? workTotal/rapl->total_time() : 0.0);
+        fprintf(fp, "Energy per op:        CPU %e J, DRAM %e J, GPU %e J, total %e J\n", rapl->pkg_total_energy()/workTotal,
+                rapl->dram_total_energy()/workTotal, gpuTotalEnergy/workTotal, systemEnergy/workTotal);
+        fprintf(fp, "Efficiency:           %f ops/W (ops per J of CPU + DRAM + GPU)\n", systemEnergy > 0.0 ? workTotal/systemEnergy : 0.0);
+        fprintf(fp, "\n");
+    }
+    PowerSummaryStats(fp);
+    if (baseCpu.get_n() > 0){
+        PowerSummaryDynamic(fp);
+    }
+    if (unifiedMode){
+        fprintf(fp, "Missed deadlines:     %lu of %lu (interval %.3f ms)\n",
+                cpuMissedDeadlines, cpuTicks, CPU_SAMPLE_NS/1000000.0);
+    } else {
+        fprintf(fp, "Missed deadlines:     CPU %lu of %lu, GPU %lu of %lu (interval %.3f ms)\n",
+                cpuMissedDeadlines, cpuTicks, gpuMissedDeadlines, gpuTicks, CPU_SAMPLE_NS/1000000.0);
+    }
+    fprintf(fp, "Init time:            RAPL %.6f secs, NVML %.6f secs\n", cpuInitTime, gpuInitTime);
+    if (rapl->get_guard_reads() > 0){
+        fprintf(fp, "RAPL wrap guard:      %lu background reads (counters wrap in %.3f secs)\n",
+                rapl->get_guard_reads(), rapl->wrap_time());
+    }
+    fprintf(fp, "Sampler placement:    %s\n", affinity_describe());
+    fprintf(fp, "Wake-up jitter:       CPU mean %.2f us p99 %.2f us max %.2f us", cpuJitter.mean(), cpuJitter.p99(), cpuJitter.max());
+    if (!unifiedMode && gpuJitter.get_n() > 0){
+        fprintf(fp, ", GPU mean %.2f us p99 %.2f us max %.2f us", gpuJitter.mean(), gpuJitter.p99(), gpuJitter.max());
+    }
+    fprintf(fp, "\n");
+    fprintf(fp, "Sampler CPU time:     %.6f secs (%s), GPU sampler %.6f secs\n", cpuSamplerCpuTime,
+            unifiedMode ? "unified sampler" : "CPU sampler", gpuSamplerCpuTime);
+}
+
+
+
+// One row of the power statistics table
+static void PowerSummaryStatsRow(FILE *fp, const char *name, Stats *st){
+    fprintf(fp, "  %-8s %10.3f %9.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, st->mean(), st->stddev(),
+            st->min(), st->p50(), st->p95(), st->p99(), st->max());
 }
 
+// Distribution of the sampled power of every domain, shows the spikes the averages hide
+void PowerSummaryStats(FILE *fp){
+    char name[16];
+    fprintf(fp, "Power statistics (W):     mean        sd        min        p50        p95        p99        max\n");
+    if (cpuPowerStats.get_n() > 0){
+        PowerSummaryStatsRow(fp, "CPU", &cpuPowerStats);
+        PowerSummaryStatsRow(fp, "DRAM", &dramPowerStats);
+    }
+    for (unsigned int d = 0; d < gpuCount && gpuCount > 1; d++){
+        snprintf(name, sizeof(name), "GPU%u", gpuIndex[d]);
+        PowerSummaryStatsRow(fp, name, &gpuDevPowerStats[d]);
+    }
+    if (gpuPowerStats.get_n() > 0){
+        PowerSummaryStatsRow(fp, "GPU", &gpuPowerStats);
+    }
+    fprintf(fp, "\n");
+}
+
+// Dynamic energy above the idle baseline, with the 95% interval of the baseline
+void PowerSummaryDynamic(FILE *fp){
+    double t = rapl->total_time();
+    fprintf(fp, "Idle baseline:        CPU %f W, DRAM %f W, GPU %f W   (%lu samples)\n",
+            baseCpu.mean(), baseDram.mean(), baseGpu.mean(), (unsigned long)baseCpu.get_n());
+    double cpu = rapl->pkg_total_energy() - baseCpu.mean()*t;
+    double cpuErr = baseline_error(&baseCpu, t);
+    double dram = rapl->dram_total_energy() - baseDram.mean()*t;
+    double dramErr = baseline_error(&baseDram, t);
+    fprintf(fp, "CPU Dynamic Energy:   %f J +- %f J\n", cpu, cpuErr);
+    fprintf(fp, "DRAM Dynamic Energy:  %f J +- %f J\n", dram, dramErr);
+    for (unsigned int d = 0; d < gpuCount && gpuCount > 1; d++){
+        fprintf(fp, "GPU%-2u Dynamic Energy: %f J +- %f J\n", gpuIndex[d],
+                gpuDevTotalEnergy[d] - baseGpuDev[d].mean()*gpuTotalTime, baseline_error(&baseGpuDev[d], gpuTotalTime));
+    }
+    double gpu = gpuTotalEnergy - baseGpu.mean()*gpuTotalTime;
+    double gpuErr = baseline_error(&baseGpu, gpuTotalTime);
+    fprintf(fp, "GPU Dynamic Energy:   %f J +- %f J\n", gpu, gpuErr);
+    // the domains are calibrated separately, add their errors in quadrature
+    fprintf(fp, "System Dynamic Energy: %f J +- %f J\n", cpu + dram + gpu,
+            sqrt(cpuErr*cpuErr + dramErr*dramErr + gpuErr*gpuErr));
+    fprintf(fp, "\n");
+}
 
+// Status line for the terminal, printed by the writer thread instead of the sampler
+void CPUStatus(const double *r){
+    printf("\r [CPU = %-10.5f (W)  DRAM = %-10.5f (W)]   [GPU = %-10.5f (W)]", r[1], r[6], gpuCurrentPower);
+    fflush(stdout);
+}
 
 // CPU power measure thread
 void* CPUpowerPollingFunc(void *ptr){
+    affinity_apply(true);
     int timestep = 0;
-    double dt = 0.0, acctime = 0.0, accenergy = 0.0, power = 0.0;
-	FILE *fp = fopen(CPUfilename.c_str(), "w+");
-	//fprintf(fp, "%-15s %-15s %-15s %-15s %-15s %-15s\n", "#timestep", "power", "acc-energy", "avg-power", "dt", "acc-time");
+    Deadline deadline(CPU_SAMPLE_NS);
+    Adaptive adaptive(CPU_SAMPLE_NS, ADAPTIVE_MAX_NS, adaptiveThreshold);
+    Trace trace(CPUfilename, traceFormat, TRACE_KIND_CPU);
+    trace.add_field("timestep", "", 'i');
+    trace.add_field("power", "W");
+    trace.add_field("acc-energy", "J");
+    trace.add_field("avg-power", "W");
+    trace.add_field("dt", "s");
+    trace.add_field("acc-time", "s");
+    trace.add_field("dram-power", "W");
+    trace.add_field("dram-energy", "J");
+    int ncores = rapl->get_n_cores();
+    char colname[32];
+    for (int c = 0; c < ncores; c++){
+        snprintf(colname, sizeof(colname), "core%d-power", rapl->core_cpu(c));
+        trace.add_field(colname, "W");
+    }
+    trace.set_info(rapl->get_n_sockets(), 0, CPU_SAMPLE_NS);
+    trace.set_status(CPUStatus);
+    trace.open();
 	while(CPUpollThreadStatus){
         timestep++;
 		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
-		usleep(1000 * CPU_SAMPLE_MS);
+        deadline.wait();
 
         // sample values
 		rapl->sample();
+        CPUStatsAdd();
 
 		// Write current value of CPU PKG
-        fprintf(fp, "%-15i %-15f %-15f %-15f %-15f %-15f\n", timestep, rapl->pkg_current_power(), rapl->pkg_total_energy(), rapl->pkg_average_power(), rapl->current_time(), rapl->total_time());
-        printf("\r [CPU = %-10.5f (W)  DRAM = %-10.5f (W)]   [GPU = %-10.5f (W)]",
-                rapl->pkg_current_power(), 
-                rapl->dram_current_power(), 
-                gpuCurrentPower);
-        fflush(stdout);
+        double *r = trace.record();
+        if (r != NULL){
+            r[0] = timestep; r[1] = rapl->pkg_current_power(); r[2] = rapl->pkg_total_energy();
+            r[3] = rapl->pkg_average_power(); r[4] = rapl->current_time(); r[5] = rapl->total_time();
+            r[6] = rapl->dram_current_power(); r[7] = rapl->dram_total_energy();
+            for (int c = 0; c < ncores; c++){
+                r[8 + c] = rapl->core_current_power(c);
+            }
+            trace.commit();
+        }
+        if (ADAPTIVE_MAX_NS > 0){
+            deadline.set_period(adaptive.update(rapl->pkg_current_power() + rapl->dram_current_power()));
+        }
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
+	}
+    trace.close();
+    cpuTicks = deadline.get_ticks();
+    cpuMissedDeadlines = deadline.get_missed();
+    cpuSamplerCpuTime = ThreadCpuTime();
+    cpuJitter = deadline.get_jitter();
+	pthread_exit(0);
+}
+
+
+// Status line of the unified sampler, printed by the writer thread
+void PowerStatus(const double *r){
+    printf("\r [CPU = %-10.5f (W)  DRAM = %-10.5f (W)]   [GPU = %-10.5f (W)]   [Total = %-10.5f (W)]",
+            r[3], r[4], r[5], r[6]);
+    fflush(stdout);
+}
+
+// Describe the sampled node in the live snapshot before the first publish
+void SnapshotInfo(power_snapshot_t *snap){
+    snapshot_info_t *info = &snap->info;
+    memset(info, 0, sizeof(*info));
+    info->version = SNAPSHOT_VERSION;
+    info->n_sockets = rapl->get_n_sockets();
+    info->n_gpus = gpuCount < SNAPSHOT_MAX_GPUS ? gpuCount : SNAPSHOT_MAX_GPUS;
+    for (int d = 0; d < RAPL_DOMAINS; d++){
+        if (rapl->has_domain(d)){
+            info->domain_mask |= 1u << d;
+        }
+    }
+    info->interval_ns = CPU_SAMPLE_NS;
+    for (unsigned int d = 0; d < info->n_gpus; d++){
+        info->gpu_index[d] = gpuIndex[d];
+        strncpy(info->gpu_name[d], gpuNames[d], SNAPSHOT_NAME_LEN - 1);
+    }
+    info->n_metrics = gpuMetrics != NULL ? gpuMetrics->count() : 0;
+    for (unsigned int k = 0; k < info->n_metrics; k++){
+        info->metric_id[k] = gpuMetrics->metric(k) - gpu_metric_table;
+        strncpy(info->metric_name[k], gpuMetrics->metric(k)->name, SNAPSHOT_METRIC_LEN - 1);
+        strncpy(info->metric_unit[k], gpuMetrics->metric(k)->unit, SNAPSHOT_METRIC_LEN - 1);
+    }
+}
+
+// Publish the newest sample, O(domains) and no system calls besides the clock
+void SnapshotPublish(power_snapshot_t *snap, uint64_t samples, uint64_t missed){
+    snapshot_values_t v;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    v.timestamp_ns = Deadline::now_ns();
+    v.realtime_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    v.samples = samples;
+    v.missed = missed;
+    for (int d = 0; d < RAPL_DOMAINS; d++){
+        v.cpu_power[d] = rapl->current_power(d);
+        v.cpu_energy[d] = rapl->total_energy(d);
+    }
+    for (unsigned int d = 0; d < snap->info.n_gpus; d++){
+        v.gpu_power[d] = gpuDevCurrentPower[d];
+        v.gpu_energy[d] = gpuDevTotalEnergy[d];
+        for (unsigned int k = 0; k < snap->info.n_metrics; k++){
+            v.gpu_metric[d][k] = gpuMetrics->value(d, k);
+        }
+    }
+    v.n_procs = 0;
+    for (unsigned int d = 0; gpuProcesses != NULL && d < snap->info.n_gpus; d++){
+        for (unsigned int k = 0; k < gpuProcesses->count(d) && v.n_procs < SNAPSHOT_MAX_PROCS; k++){
+            const gpu_process_t *p = gpuProcesses->process(d, k);
+            v.proc_gpu[v.n_procs] = d;
+            v.proc_pid[v.n_procs] = p->pid;
+            memcpy(v.proc_name[v.n_procs], p->name, SNAPSHOT_PROC_NAME);
+            v.proc_energy[v.n_procs] = p->energy;
+            v.n_procs++;
+        }
+    }
+    snapshot_publish(snap, &v);
+}
+
+/*
+Unified sampler: a single thread reads RAPL and every sampled GPU back to back
+against the same timestamp and writes one combined record per tick.
+*/
+void* PowerPollingFunc(void *ptr){
+    affinity_apply(true);
+    int timestep = 0;
+    Deadline deadline(CPU_SAMPLE_NS);
+    Adaptive adaptive(CPU_SAMPLE_NS, ADAPTIVE_MAX_NS, adaptiveThreshold);
+    uint64_t t0, t1, t2;
+    double dt = 0.0, acctime = 0.0;
+    double cpu, dram, gpu;
+    char colname[32];
+    Trace trace(CPUfilename, traceFormat, TRACE_KIND_NODE);
+    trace.add_field("timestep", "", 'i');
+    trace.add_field("time", "s");
+    trace.add_field("dt", "s");
+    trace.add_field("cpu-power", "W");
+    trace.add_field("dram-power", "W");
+    trace.add_field("gpu-power", "W");
+    trace.add_field("total-power", "W");
+    trace.add_field("cpu-energy", "J");
+    trace.add_field("dram-energy", "J");
+    trace.add_field("gpu-energy", "J");
+    trace.add_field("total-energy", "J");
+    for (unsigned int d = 0; d < gpuCount; d++){
+        snprintf(colname, sizeof(colname), "gpu%u-power", gpuIndex[d]);
+        trace.add_field(colname, "W");
+    }
+    int ncores = rapl->get_n_cores();
+    for (int c = 0; c < ncores; c++){
+        snprintf(colname, sizeof(colname), "core%d-power", rapl->core_cpu(c));
+        trace.add_field(colname, "W");
+    }
+    GPUMetricFields(&trace);
+    if (workEnabled){
+        const char *domains[4] = {"cpu", "dram", "gpu", "total"};
+        trace.add_field("work", "", 'i');
+        trace.add_field("ops/s", "1/s");
+        for (int k = 0; k < 4; k++){
+            snprintf(colname, sizeof(colname), "%s-ops/W", domains[k]);
+            trace.add_field(colname, "1/J");
+        }
+        for (int k = 0; k < 4; k++){
+            snprintf(colname, sizeof(colname), "%s-J/op", domains[k]);
+            trace.add_field(colname, "J");
+        }
+    }
+    delete trigger;
+    trigger = NULL;
+    if (!triggerThresholds.empty()){
+        trigger = new Trigger(triggerThresholds, triggerPreMs, triggerPostMs);
+        if (!trigger->init(&trace, CPU_SAMPLE_NS)){
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace.set_info(rapl->get_n_sockets(), gpuCount, CPU_SAMPLE_NS);
+    trace.set_status(PowerStatus);
+    trace.set_sink(recordSink, recordSinkArg);
+    trace.open(trigger != NULL ? trigger->capacity() : TRACE_RING_RECORDS);
+    if (liveSnapshot != NULL){
+        SnapshotInfo(liveSnapshot);
+    }
+
+    unsigned long long work0 = __atomic_load_n(&powermon_work, __ATOMIC_RELAXED), work, lastWork = work0;
+    deadline.start();
+    t0 = t1 = Deadline::now_ns();
+    samplerStartNs = t0;
+	while(CPUpollThreadStatus){
+        timestep++;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, 0);
+        t2 = deadline.wait();
+        dt = (double)(t2 - t1)/NS_PER_SEC;
+        acctime = (double)(t2 - t0)/NS_PER_SEC;
+
+        // sample all domains back to back, they share the t2 timestamp
+		rapl->sample();
+        CPUStatsAdd();
+        gpu = GPUSample(dt);
+        if (gpuMetrics != NULL){
+            gpuMetrics->sample(dt);
+        }
+        if (gpuProcesses != NULL){
+            gpuProcesses->sample(gpuDevTotalEnergy);
+        }
+        cpu = rapl->pkg_current_power();
+        dram = rapl->dram_current_power();
+
+        // in trigger mode every record goes to the pre-trigger ring, the trace only gets the captures
+        double *r = trigger != NULL ? trigger->record() : trace.record();
+        if (r != NULL){
+            r[0] = timestep; r[1] = acctime; r[2] = dt;
+            r[3] = cpu; r[4] = dram; r[5] = gpu; r[6] = cpu + dram + gpu;
+            r[7] = rapl->pkg_total_energy(); r[8] = rapl->dram_total_energy(); r[9] = gpuTotalEnergy;
+            r[10] = r[7] + r[8] + r[9];
+            for (unsigned int d = 0; d < gpuCount; d++){
+                r[11 + d] = gpuDevCurrentPower[d];
+            }
+            for (int c = 0; c < ncores; c++){
+                r[11 + gpuCount + c] = rapl->core_current_power(c);
+            }
+            int n = 11 + gpuCount + ncores;
+            n += GPUMetricRecord(r + n);
+            if (workEnabled){
+                // ops/W now from this tick, J/op over the whole run
+                work = __atomic_load_n(&powermon_work, __ATOMIC_RELAXED);
+                double rate = dt > 0.0 ? (work - lastWork)/dt : 0.0;
+                double power[4] = {cpu, dram, gpu, r[6]};
+                double energy[4] = {r[7], r[8], r[9], r[10]};
+                r[n] = work - work0; r[n + 1] = rate;
+                for (int k = 0; k < 4; k++){
+                    r[n + 2 + k] = power[k] > 0.0 ? rate/power[k] : 0.0;
+                    r[n + 6 + k] = work > work0 ? energy[k]/(work - work0) : 0.0;
+                }
+                lastWork = work;
+            }
+            if (trigger != NULL){
+                trigger->commit();
+            } else {
+                trace.commit();
+            }
+        }
+        if (liveSnapshot != NULL){
+            SnapshotPublish(liveSnapshot, timestep, deadline.get_missed());
+        }
+        if (ADAPTIVE_MAX_NS > 0){
+            deadline.set_period(adaptive.update(cpu + dram + gpu));
+        }
+        t1 = t2;
 		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
 	}
-    fclose(fp);
+    trace.close();
+    GPUSampleFinish(acctime);
+    workTotal = __atomic_load_n(&powermon_work, __ATOMIC_RELAXED) - work0;
+    cpuTicks = deadline.get_ticks();
+    cpuMissedDeadlines = deadline.get_missed();
+    cpuSamplerCpuTime = ThreadCpuTime();
+    cpuJitter = deadline.get_jitter();
 	pthread_exit(0);
 }
+
+// Begin measuring CPU and GPU power from one sampler thread
+void PowerBegin(const char *alg, double ms, const char *devices){
+    CPU_SAMPLE_NS = GPU_SAMPLE_NS = (uint64_t)(ms*1000000.0);
+    unifiedMode = true;
+    PowerInit(devices);
+    RaplGuard(CPU_SAMPLE_NS);
+    CPUfilename = TraceFilename(alg);
+    CPUpollThreadStatus = true;
+	int code = pthread_create(&CPUpowerPollThread, NULL, PowerPollingFunc, (void*)NULL);
+	if (code){
+		fprintf(stderr,"Error - pthread_create() return code: %d\n", code);
+		exit(0);
+	}
+	usleep(1000*COOLDOWN_MS);
+}
+
+// Stop the unified sampler and print the summary
+void PowerEnd(){
+    PowerStop();
+	GPUShutdown();
+    PowerSummary();
+}
+
+// Stop the unified sampler only, NVML stays open for the next PowerBegin (sweep runs)
+void PowerStop(){
+	usleep(1000*COOLDOWN_MS);
+	CPUpollThreadStatus = false;
+	pthread_join(CPUpowerPollThread, 0);
+    rapl->stop_guard();
+}
+
+// Select the output format of the traces, TRACE_TEXT (.dat), TRACE_BINARY (.bin) or TRACE_COLUMNAR (.pmc)
+void PowerSetFormat(int format){
+    traceFormat = format;
+}
+
+// Adapt the interval between the Begin interval and max_ms, threshold is a relative power change
+void PowerSetAdaptive(double max_ms, double threshold){
+    ADAPTIVE_MAX_NS = (uint64_t)(max_ms*1000000.0);
+    adaptiveThreshold = threshold;
+}
+
+void PowerSetSnapshot(power_snapshot_t *snap){
+    liveSnapshot = snap;
+}
+
+void PowerSetSink(void (*sink)(const double *record, void *arg), void *arg){
+    recordSink = sink;
+    recordSinkArg = arg;
+}
+
+void PowerSetWork(bool enable){
+    workEnabled = enable;
+}
+
+bool PowerSetGpuMetrics(const char *list){
+    return GpuMetrics::parse(list, gpuMetricIds);
+}
+
+bool PowerSetTrigger(const char *spec, double pre_ms, double post_ms){
+    triggerPreMs = pre_ms;
+    triggerPostMs = post_ms;
+    return Trigger::parse(spec, triggerThresholds);
+}
+
+void PowerSetGpuProcesses(bool enable){
+    gpuProcessesEnabled = enable;
+}
+
+// Output file name of a trace for the current format
+std::string TraceFilename(const char *alg){
+    return std::string("power-") + std::string(alg) + std::string(TraceExtension(traceFormat));
+}
+
+// Read per-core energy (AMD only) in addition to the package counters
+void PowerSetPerCore(bool enable){
+    raplPerCore = enable;
+}
+
+// Energy source of the CPU counters, RAPL_BACKEND_AUTO picks msr, powercap or perf
+void PowerSetRaplBackend(int backend){
+    raplBackend = backend;
+}
+
+// Also write the end of run summary to this file
+void PowerSetSummaryFile(const char *filename){
+    summaryFilename = filename != NULL ? filename : "";
+}
@@ -13,28 +13,119 @@ Header file including necessary nvml headers.
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
-#include <nvml.h>
 #include <pthread.h>
-#include <cuda_runtime.h>
 #include <time.h>
 #include <unistd.h>
 #include <string>
+#include <cmath>
+#include "Nvml.h"
 #include "Rapl.h"
+#include "Deadline.h"
+#include "Trace.h"
+#include "Launcher.h"
+#include "Stats.h"
+#include "Snapshot.h"
+#include "Affinity.h"
+#include "Adaptive.h"
+#include "GpuMetrics.h"
+#include "GpuProcesses.h"
+#include "Trigger.h"
 
 #define COOLDOWN_MS  1
+#define MAX_GPUS     64
 
 
 // GPU power measure functions
-void GPUPowerBegin(const char *alg, int ms);
+// ms: sample interval in milliseconds, fractions allow sub-millisecond sampling
+// devices: comma separated list of NVML indices to sample, NULL samples all GPUs
+void GPUPowerBegin(const char *alg, double ms, const char *devices = NULL);
 void GPUPowerEnd();
+// buffered capture, drains the NVML power sample ring every ms milliseconds
+void GPUPowerBeginBuffered(const char *alg, double ms, const char *devices = NULL);
 
 // CPU power measure functions
-void CPUPowerBegin(const char *alg, int ms);
+void CPUPowerBegin(const char *alg, double ms);
 void CPUPowerEnd();
 
+// Unified measure functions, one thread samples CPU and GPU with shared timestamps
+void PowerBegin(const char *alg, double ms, const char *devices = NULL);
+void PowerEnd();
+void PowerStop();
+void PowerSummary();
+void PowerSummaryTo(FILE *fp);
+void PowerSummaryDynamic(FILE *fp);
+void PowerSummaryStats(FILE *fp);
+// Idle calibration, run before the Begin functions; the summary then adds dynamic energy
+void PowerCalibrate(double secs, double ms, const char *devices = NULL);
+double baseline_error(Stats *b, double secs);
+// Write the summary to a file as well as stdout
+void PowerSetSummaryFile(const char *filename);
+
+// Adaptive sampling between the Begin interval and max_ms, see Adaptive
+void PowerSetAdaptive(double max_ms, double threshold);
+
+// Publish every sample of the unified sampler into snap (seqlock), NULL disables
+void PowerSetSnapshot(power_snapshot_t *snap);
+// Hand every unified sampler record to sink from the trace writer thread, NULL disables
+void PowerSetSink(void (*sink)(const double *record, void *arg), void *arg);
+
+// Extra GPU metrics (GpuMetrics names, comma separated or "all") for the GPU and unified samplers; false on an unknown name
+bool PowerSetGpuMetrics(const char *list);
+// Split the energy of every GPU between its processes by SM utilization, for the GPU and unified samplers
+void PowerSetGpuProcesses(bool enable);
+
+// Threshold-triggered capture for the unified sampler: only pre_ms before and post_ms after a crossing of spec
+// (Trigger::parse) reach the trace; false on a malformed spec
+bool PowerSetTrigger(const char *spec, double pre_ms, double post_ms);
+
+// Work and efficiency columns from the powermon_add_work counter in the unified trace
+void PowerSetWork(bool enable);
+
+// Output format of the traces, TRACE_TEXT (default), TRACE_BINARY, TRACE_COLUMNAR or TRACE_NONE
+void PowerSetFormat(int format);
+std::string TraceFilename(const char *alg);
+// Per-core energy columns and summary (AMD), call before CPUPowerBegin/PowerBegin
+void PowerSetPerCore(bool enable);
+// RAPL energy source (RAPL_BACKEND_*), call before CPUPowerBegin/PowerBegin
+void PowerSetRaplBackend(int backend);
+
+// GPU helpers shared by the GPU and unified samplers
+// NVML and RAPL initialised concurrently, the later Begin/Init calls reuse them
+void PowerInit(const char *devices);
+void GPUInit(const char *devices);
+void GPUShutdown();
+void RaplInit();
+double ThreadCpuTime();
+void RaplGuard(uint64_t interval_ns);
+void CPUStatsAdd();
+double GPUSample(double dt);
+void GPUMetricFields(Trace *trace);
+int GPUMetricRecord(double *r);
+void GPUSampleFinish(double acctime);
+double GPUEnergySnapshot();
+unsigned int GPUDrainSamples(Trace *trace, unsigned long long t0, unsigned long long *n);
+double nvmlValueToDouble(nvmlValueType_t type, nvmlValue_t value);
+
+// Globals shared with the library API (powermon.cpp)
+extern Rapl *rapl;
+extern unsigned int gpuCount;
+extern unsigned int gpuIndex[MAX_GPUS];
+extern nvmlDevice_t gpuDevices[MAX_GPUS];
+extern GpuMetrics *gpuMetrics;
+extern double calibrationTime;
+extern double cpuInitTime;
+extern double gpuInitTime;
+extern double cpuSamplerCpuTime;
+extern double gpuSamplerCpuTime;
+extern std::string summaryFilename;
+extern uint64_t samplerStartNs;
+extern "C" unsigned long long powermon_work;
+
 // pthread functions
 void *GPUpowerPollingFunc(void *ptr);
 void *CPUpowerPollingFunc(void *ptr);
+void *GPUbufferPollingFunc(void *ptr);
+void *PowerPollingFunc(void *ptr);
 int getNVMLError(nvmlReturn_t resultToCheck);
 
 #endif
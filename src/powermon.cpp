@@ -0,0 +1,183 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include "nvmlPower.hpp"
+#include "powermon.h"
+
+struct region_t {
+	const char *key;
+	char name[POWERMON_REGION_NAME];
+	unsigned long count;
+	double time;
+	double pkg;
+	double dram;
+	double gpu;
+	unsigned long long work;
+};
+
+// energy counters at the moment a region was opened
+struct region_frame_t {
+	int region;
+	uint64_t t0;
+	double pkg;
+	double dram;
+	double gpu;
+	unsigned long long work;
+};
+
+// one closed region instance, for powermon analyze
+struct region_span_t {
+	int region;
+	uint64_t t0;
+	uint64_t t1;
+};
+
+// library state, static so nothing of it is exported to the application
+static region_t regions[POWERMON_MAX_REGIONS];
+static std::vector<region_span_t> regionSpans;
+static unsigned long regionSpansDropped = 0;
+static std::string powermonName;
+static int nRegions = 0;
+static pthread_mutex_t regionLock = PTHREAD_MUTEX_INITIALIZER;
+static bool powermonActive = false;
+
+static thread_local region_frame_t regionStack[POWERMON_MAX_REGION_DEPTH];
+static thread_local int regionDepth = 0;
+
+/*
+Index of a region in the table, creating it on first use.
+Comparing the pointer first keeps the scan to one load per entry for string
+literals. A pointer hit is still confirmed by name: a reused buffer (snprintf
+of "layer%d") keeps its address while its contents change, and such names go
+on to the strncmp scan.
+*/
+static int region_lookup(const char *name){
+	int n = __atomic_load_n(&nRegions, __ATOMIC_ACQUIRE);
+	for (int i = 0; i < n; i++){
+		if (regions[i].key == name && strncmp(regions[i].name, name, POWERMON_REGION_NAME - 1) == 0){
+			return i;
+		}
+	}
+	pthread_mutex_lock(&regionLock);
+	int r = -1;
+	for (int i = 0; i < nRegions; i++){
+		if (strncmp(regions[i].name, name, POWERMON_REGION_NAME - 1) == 0){
+			r = i;
+			break;
+		}
+	}
+	if (r < 0 && nRegions < POWERMON_MAX_REGIONS){
+		r = nRegions;
+		memset(&regions[r], 0, sizeof(region_t));
+		strncpy(regions[r].name, name, POWERMON_REGION_NAME - 1);
+		regions[r].key = name;
+		// publish the entry only once it is complete
+		__atomic_store_n(&nRegions, nRegions + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&regionLock);
+	return r;
+}
+
+// Read every energy counter once
+static void region_snapshot(region_frame_t *f){
+	rapl->snapshot(&f->pkg, &f->dram);
+	f->gpu = gpuCount > 0 ? GPUEnergySnapshot() : 0.0;
+	f->work = __atomic_load_n(&powermon_work, __ATOMIC_RELAXED);
+	f->t0 = Deadline::now_ns();
+}
+
+// Region instances in seconds since the sampler started, the time column of the trace
+static void regions_write(){
+	std::string filename = std::string("power-") + powermonName + "-regions.dat";
+	FILE *fp = fopen(filename.c_str(), "w+");
+	if (fp == NULL){
+		perror("powermon:fopen");
+		return;
+	}
+	fprintf(fp, "#name start end\n");
+	for (size_t i = 0; i < regionSpans.size(); i++){
+		region_span_t *sp = &regionSpans[i];
+		fprintf(fp, "%s %.9f %.9f\n", regions[sp->region].name,
+		        ((double)sp->t0 - (double)samplerStartNs)/NS_PER_SEC, ((double)sp->t1 - (double)samplerStartNs)/NS_PER_SEC);
+	}
+	fclose(fp);
+	if (regionSpansDropped > 0){
+		fprintf(stderr, "powermon: %lu region instances past %d not written to %s\n",
+		        regionSpansDropped, POWERMON_MAX_SPANS, filename.c_str());
+	}
+}
+
+void powermon_init(const char *name, double ms, const char *gpus){
+	PowerSetWork(true);
+	powermonName = name;
+	PowerBegin(name, ms, gpus);
+	powermonActive = true;
+}
+
+void powermon_region_begin(const char *name){
+	if (!powermonActive){
+		return;
+	}
+	if (regionDepth == POWERMON_MAX_REGION_DEPTH){
+		fprintf(stderr, "powermon: regions nested deeper than %d, ignoring '%s'\n", POWERMON_MAX_REGION_DEPTH, name);
+		regionDepth++;
+		return;
+	}
+	region_frame_t *f = &regionStack[regionDepth++];
+	f->region = region_lookup(name);
+	region_snapshot(f);
+}
+
+void powermon_region_end(){
+	if (!powermonActive || regionDepth == 0){
+		return;
+	}
+	if (--regionDepth >= POWERMON_MAX_REGION_DEPTH){
+		return;
+	}
+	region_frame_t *f = &regionStack[regionDepth];
+	if (f->region < 0){
+		return;
+	}
+	region_frame_t now;
+	region_snapshot(&now);
+	pthread_mutex_lock(&regionLock);
+	region_t *r = &regions[f->region];
+	r->count++;
+	r->time += (double)(now.t0 - f->t0)/NS_PER_SEC;
+	r->pkg += now.pkg - f->pkg;
+	r->dram += now.dram - f->dram;
+	r->gpu += now.gpu - f->gpu;
+	r->work += now.work - f->work;
+	if (regionSpans.size() < POWERMON_MAX_SPANS){
+		region_span_t sp = {f->region, f->t0, now.t0};
+		regionSpans.push_back(sp);
+	} else {
+		regionSpansDropped++;
+	}
+	pthread_mutex_unlock(&regionLock);
+}
+
+void powermon_finalize(){
+	if (!powermonActive){
+		return;
+	}
+	powermonActive = false;
+	PowerEnd();
+	if (nRegions == 0){
+		return;
+	}
+	printf("\nRegions:\n");
+	printf("%-24s %10s %12s %14s %14s %14s %14s %12s %16s %14s\n", "name", "count", "time(s)",
+	       "cpu(J)", "dram(J)", "gpu(J)", "total(J)", "avg-power(W)", "work", "J/op");
+	for (int i = 0; i < nRegions; i++){
+		region_t *r = &regions[i];
+		double total = r->pkg + r->dram + r->gpu;
+		printf("%-24s %10lu %12.6f %14.6f %14.6f %14.6f %14.6f %12.4f %16llu %14.6e\n", r->name, r->count, r->time,
+		       r->pkg, r->dram, r->gpu, total, r->time > 0.0 ? total/r->time : 0.0,
+		       r->work, r->work > 0 ? total/r->work : 0.0);
+	}
+	regions_write();
+}
@@ -0,0 +1,66 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+/*
+Public API of libpowermon.
+
+    powermon_init("myapp", 10.0, NULL);
+    for (...) {
+        powermon_region_begin("load");
+        ...
+        powermon_region_end();
+        powermon_region_begin("compute");
+        ...
+        powermon_add_work(flops);
+        powermon_region_end();
+    }
+    powermon_finalize();
+
+powermon_init starts the unified sampler (power-<name>.dat trace), regions
+snapshot the RAPL and GPU energy counters at their boundaries and
+powermon_finalize prints the usual summary followed by per-region energy,
+and writes every region instance to power-<name>-regions.dat on the trace
+time axis for powermon analyze -R.
+Regions may be nested and are tracked per calling thread. Work counted with
+powermon_add_work adds ops/W and J/op columns to the trace, and work and J/op
+to the summary and to every region.
+*/
+
+#ifndef POWERMON_H_
+#define POWERMON_H_
+
+#define POWERMON_MAX_REGIONS       64
+#define POWERMON_MAX_REGION_DEPTH  16
+#define POWERMON_REGION_NAME       32
+// region instances kept for the regions file, later ones are only counted
+#define POWERMON_MAX_SPANS         (1 << 20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start sampling every ms milliseconds, gpus is a comma separated NVML index list or NULL for all
+void powermon_init(const char *name, double ms, const char *gpus);
+// Stop sampling and print the summary and region table
+void powermon_finalize();
+
+// Open a named region, name should be a string literal or otherwise outlive the run
+void powermon_region_begin(const char *name);
+// Close the innermost open region of the calling thread
+void powermon_region_end();
+
+// Application work counter, read by the sampler every tick
+extern unsigned long long powermon_work;
+
+// Count n units of work (flops, samples, ...) from any thread, a single relaxed atomic add
+static inline void powermon_add_work(unsigned long long n){
+    __atomic_fetch_add(&powermon_work, n, __ATOMIC_RELAXED);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POWERMON_H_ */
@@ -0,0 +1,58 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+/*
+Header-only reader of the live snapshot published by powermon -s name.
+
+    const power_snapshot_t *snap = powermon_shm_open("/powermon");
+    snapshot_values_t v;
+    while (...) {
+        snapshot_read(snap, &v);     // a few loads, no system calls
+        use(v.cpu_power[0], v.gpu_power[0]);
+    }
+    powermon_shm_close(snap);
+
+Only powermon touches the hardware; any number of readers can map the segment.
+Copy this file together with Snapshot.h, nothing needs to be linked besides -lrt
+on old glibc.
+*/
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Snapshot.h"
+
+#ifndef POWERMON_SHM_H_
+#define POWERMON_SHM_H_
+
+#define POWERMON_SHM_DEFAULT "/powermon"
+
+// Map the snapshot read-only, NULL if it does not exist or has another layout
+inline const power_snapshot_t *powermon_shm_open(const char *name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(power_snapshot_t)) {
+		close(fd);
+		return NULL;
+	}
+	void *addr = mmap(NULL, sizeof(power_snapshot_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return addr == MAP_FAILED ? NULL : (const power_snapshot_t*)addr;
+}
+
+// True once the first sample was published, info is only valid from then on
+inline bool powermon_shm_ready(const power_snapshot_t *snap) {
+	return snap->seq.load(std::memory_order_acquire) >= 2 && snap->info.version == SNAPSHOT_VERSION;
+}
+
+inline void powermon_shm_close(const power_snapshot_t *snap) {
+	munmap((void*)snap, sizeof(power_snapshot_t));
+}
+
+#endif /* POWERMON_SHM_H_ */
@@ -0,0 +1,38 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cmath>
+#include <cstdio>
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+/*
+Minimal checks for the unit tests: a failed check is reported with its line and
+the test goes on, check_result() is the exit status of the test binary.
+*/
+static int check_failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		check_failures++; \
+	} \
+} while (0)
+
+#define CHECK_NEAR(a, b, tol) do { \
+	double a_ = (a), b_ = (b); \
+	if (!(fabs(a_ - b_) <= (tol))) { \
+		fprintf(stderr, "%s:%d: %s = %.9g, expected %.9g +- %g\n", __FILE__, __LINE__, #a, a_, b_, (double)(tol)); \
+		check_failures++; \
+	} \
+} while (0)
+
+static inline int check_result(const char *name) {
+	printf("%s: %s (%d failed)\n", name, check_failures == 0 ? "ok" : "FAILED", check_failures);
+	return check_failures == 0 ? 0 : 1;
+}
+
+#endif /* CHECK_H_ */
@@ -0,0 +1,68 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include "Adaptive.h"
+#include "check.h"
+
+#define US 1000ULL
+
+static void test_backoff() {
+	Adaptive a(100 * US, 1600 * US, 0.05);
+	CHECK(a.period() == 100 * US);
+	// the first tick has nothing to compare with
+	CHECK(a.update(100.0) == 100 * US);
+	// stable power doubles the period every tick up to the maximum
+	CHECK(a.update(101.0) == 200 * US);
+	CHECK(a.update(100.5) == 400 * US);
+	CHECK(a.update(100.0) == 800 * US);
+	CHECK(a.update(100.0) == 1600 * US);
+	CHECK(a.update(100.0) == 1600 * US);
+	CHECK(a.period() == 1600 * US);
+	// a burst goes straight back to the minimum
+	CHECK(a.update(150.0) == 100 * US);
+	CHECK(a.update(150.0) == 200 * US);
+	// a drop is a burst as well
+	CHECK(a.update(100.0) == 100 * US);
+}
+
+static void test_threshold() {
+	Adaptive a(1000 * US, 8000 * US, 0.10);
+	a.update(200.0);
+	// 9% stays under the threshold, 11% does not
+	CHECK(a.update(218.0) == 2000 * US);
+	CHECK(a.update(242.0) == 1000 * US);
+}
+
+static void test_idle_floor() {
+	// near 0 W changes are relative to 1 W, so a few mW of noise does not burst
+	Adaptive a(100 * US, 400 * US, 0.05);
+	a.update(0.0);
+	CHECK(a.update(0.02) == 200 * US);
+	CHECK(a.update(0.0) == 400 * US);
+	CHECK(a.update(0.5) == 100 * US);
+}
+
+static void test_bounds() {
+	// a maximum under the minimum is clamped, the period never moves
+	Adaptive a(500 * US, 100 * US, 0.05);
+	CHECK(a.update(10.0) == 500 * US);
+	CHECK(a.update(10.0) == 500 * US);
+	CHECK(a.update(20.0) == 500 * US);
+
+	// a maximum that is not a power of two multiple of the minimum is still reached
+	Adaptive b(300 * US, 1000 * US, 0.05);
+	b.update(10.0);
+	CHECK(b.update(10.0) == 600 * US);
+	CHECK(b.update(10.0) == 1000 * US);
+	CHECK(b.update(10.0) == 1000 * US);
+}
+
+int main() {
+	test_backoff();
+	test_threshold();
+	test_idle_floor();
+	test_bounds();
+	return check_result("adaptive");
+}
@@ -0,0 +1,225 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Analyze.h"
+#include "Trace.h"
+#include "check.h"
+
+struct row_t {
+	std::string window;
+	std::string signal;
+	double time;
+	double energy;
+};
+
+static std::string dir;
+
+static std::string write_file(const char *name, const char *text) {
+	std::string path = dir + "/" + name;
+	FILE *fp = fopen(path.c_str(), "w");
+	fputs(text, fp);
+	fclose(fp);
+	return path;
+}
+
+// Summary lines of a finished analysis
+static std::vector<row_t> rows(Analyzer &a) {
+	std::vector<row_t> out;
+	FILE *fp = tmpfile();
+	a.summary(fp);
+	rewind(fp);
+	char line[512], window[128], signal[128];
+	double start, end, time, energy, power;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] != '#' &&
+		    sscanf(line, "%127s %lf %lf %127s %lf %lf %lf", window, &start, &end, signal, &time, &energy, &power) == 7) {
+			row_t r = {window, signal, time, energy};
+			out.push_back(r);
+		}
+	}
+	fclose(fp);
+	return out;
+}
+
+static const row_t *find(const std::vector<row_t> &r, const char *window, const char *signal) {
+	for (size_t i = 0; i < r.size(); i++) {
+		if (r[i].window == window && r[i].signal == signal) {
+			return &r[i];
+		}
+	}
+	return NULL;
+}
+
+#define CHECK_ROW(r, window, signal, t, e) do { \
+	const row_t *row_ = find(r, window, signal); \
+	if (row_ == NULL) { \
+		fprintf(stderr, "%s:%d: no %s %s row\n", __FILE__, __LINE__, window, signal); \
+		check_failures++; \
+	} \
+	if (row_ != NULL) { \
+		CHECK_NEAR(row_->time, t, 1e-9); \
+		CHECK_NEAR(row_->energy, e, 1e-6); \
+	} \
+} while (0)
+
+// 100 W flat and a 10*t W ramp sampled every second from 0 to 10 s
+static std::string ramp_trace() {
+	std::string text = "#time     cpu-power gpu-power acc-energy\n";
+	char line[128];
+	for (int t = 0; t <= 10; t++) {
+		snprintf(line, sizeof(line), "%d.0 100.0 %d.0 0\n", t, 10 * t);
+		text += line;
+	}
+	return write_file("power-node.dat", text.c_str());
+}
+
+static void test_trapezoid_windows() {
+	std::string path = ramp_trace();
+	Analyzer a;
+	a.add_window("mid", 2.5, 7.25);
+	// windows past the trace only get the part it covers
+	a.add_window("tail", 8.0, 20.0);
+	CHECK(a.add_trace(path.c_str()));
+	a.run(0.0, NULL);
+	std::vector<row_t> r = rows(a);
+	CHECK_ROW(r, "all", "node.cpu-power", 10.0, 1000.0);
+	// the trapezoid of a linear signal is exact, also over the interpolated edges
+	CHECK_ROW(r, "all", "node.gpu-power", 10.0, 500.0);
+	CHECK_ROW(r, "mid", "node.cpu-power", 4.75, 475.0);
+	CHECK_ROW(r, "mid", "node.gpu-power", 4.75, 5.0 * (7.25 * 7.25 - 2.5 * 2.5));
+	CHECK_ROW(r, "tail", "node.gpu-power", 2.0, 5.0 * (100.0 - 64.0));
+	// acc-energy does not end in power and is not selected by default
+	CHECK(find(r, "all", "node.acc-energy") == NULL);
+	CHECK(r.size() == 3 * 2);
+}
+
+static void test_regions_and_width() {
+	std::string path = ramp_trace();
+	std::string regions = write_file("regions.txt", "# name start end\nkernel 1.0 2.0\nkernel 4.0 6.0\nio 0.5 1.5\n");
+	Analyzer a;
+	CHECK(a.load_regions(regions.c_str()));
+	a.set_width(4.0);
+	a.set_columns("gpu-power");
+	CHECK(a.add_trace(path.c_str()));
+	a.run(0.0, NULL);
+	std::vector<row_t> r = rows(a);
+	// the instances of a region are added together
+	CHECK_ROW(r, "kernel", "node.gpu-power", 3.0, 5.0 * (4.0 - 1.0) + 5.0 * (36.0 - 16.0));
+	CHECK_ROW(r, "io", "node.gpu-power", 1.0, 5.0 * (1.5 * 1.5 - 0.5 * 0.5));
+	CHECK_ROW(r, "w0", "node.gpu-power", 4.0, 80.0);
+	CHECK_ROW(r, "w1", "node.gpu-power", 4.0, 5.0 * (64.0 - 16.0));
+	CHECK_ROW(r, "w2", "node.gpu-power", 2.0, 5.0 * (100.0 - 64.0));
+	// only the selected column
+	CHECK(find(r, "all", "node.cpu-power") == NULL);
+}
+
+static void test_region_groups() {
+	std::string path = ramp_trace();
+	Analyzer a;
+	a.add_window("k", 1.0, 2.0);
+	a.add_window("k", 4.0, 6.0);
+	CHECK(a.add_trace(path.c_str()));
+	a.run(0.0, NULL);
+	std::vector<row_t> r = rows(a);
+	CHECK_ROW(r, "k", "node.cpu-power", 3.0, 300.0);
+	// overlapping instances are each counted in full
+	Analyzer b;
+	b.add_window("o", 1.0, 3.0);
+	b.add_window("o", 2.0, 4.0);
+	CHECK(b.add_trace(path.c_str()));
+	b.run(0.0, NULL);
+	r = rows(b);
+	CHECK_ROW(r, "o", "node.cpu-power", 4.0, 400.0);
+}
+
+static void test_split_devices() {
+	// a buffered -b trace interleaves the samples of every GPU
+	std::string path = write_file("power-gpu-samples.dat",
+		"#n gpu time power\n"
+		"1 0 0.0 50.0\n2 1 0.0 200.0\n3 0 1.0 50.0\n4 0 2.0 50.0\n5 1 2.0 100.0\n6 0 4.0 50.0\n");
+	Analyzer a;
+	CHECK(a.add_trace(path.c_str()));
+	a.run(0.0, NULL);
+	std::vector<row_t> r = rows(a);
+	CHECK_ROW(r, "all", "gpu-samples.gpu0.power", 4.0, 200.0);
+	CHECK_ROW(r, "all", "gpu-samples.gpu1.power", 2.0, 300.0);
+}
+
+static void test_grid() {
+	std::string path = ramp_trace();
+	Analyzer a;
+	a.set_columns("gpu-power");
+	CHECK(a.add_trace(path.c_str()));
+	FILE *grid = tmpfile();
+	a.run(0.25, grid);
+	rewind(grid);
+	char line[256];
+	int n = 0;
+	bool header = false, exact = true;
+	while (fgets(line, sizeof(line), grid) != NULL) {
+		double t, v;
+		if (line[0] == '#') {
+			header = strstr(line, "gpu-power") != NULL;
+		} else if (sscanf(line, "%lf %lf", &t, &v) == 2) {
+			exact = exact && fabs(v - 10.0 * t) < 1e-6;
+			n++;
+		}
+	}
+	fclose(grid);
+	CHECK(header);
+	CHECK(exact);
+	CHECK(n == 41);
+}
+
+// The same signal through the binary and columnar writers integrates to the same energy
+static void test_layouts() {
+	const int formats[] = {TRACE_TEXT, TRACE_BINARY, TRACE_COLUMNAR};
+	const char *names[] = {"power-fmt.dat", "power-fmt.bin", "power-fmt.pmc"};
+	for (int f = 0; f < 3; f++) {
+		std::string path = dir + "/" + names[f];
+		Trace trace(path, formats[f], TRACE_KIND_NODE);
+		trace.add_field("time", "s");
+		trace.add_field("cpu-power", "W");
+		trace.open();
+		for (int i = 0; i <= 1000; i++) {
+			double *rec = trace.record();
+			rec[0] = i * 0.001;
+			rec[1] = 100.0 + (i % 2) * 20.0;
+			trace.commit();
+		}
+		trace.close();
+		Analyzer a;
+		CHECK(a.add_trace(path.c_str()));
+		a.run(0.0, NULL);
+		std::vector<row_t> r = rows(a);
+		CHECK_ROW(r, "all", "fmt.cpu-power", 1.0, 110.0);
+	}
+}
+
+int main() {
+	char tmpl[] = "/tmp/powermon-analyze-XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	dir = tmpl;
+	test_trapezoid_windows();
+	test_regions_and_width();
+	test_region_groups();
+	test_split_devices();
+	test_grid();
+	test_layouts();
+	std::string cmd = "rm -rf " + dir;
+	if (system(cmd.c_str()) != 0) {
+		fprintf(stderr, "could not remove %s\n", dir.c_str());
+	}
+	return check_result("analyze");
+}
@@ -0,0 +1,215 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+#include "Columnar.h"
+#include "check.h"
+
+// Encode and decode n values, true if every value comes back with the same bits
+static bool round_trip(const double *values, uint32_t n, columnar_column_t *col) {
+	std::vector<uint8_t> buf(10 * n + 10);
+	std::vector<double> out(n);
+	uint32_t bytes = columnar_encode(values, n, col, buf.data());
+	if (bytes != col->bytes || !columnar_decode(buf.data(), col, n, out.data())) {
+		return false;
+	}
+	return memcmp(values, out.data(), n * sizeof(double)) == 0;
+}
+
+static void test_scaled() {
+	columnar_column_t col;
+	std::vector<double> v(4096);
+	// step counter: the second differences are all 0, about a byte per value
+	for (size_t i = 0; i < v.size(); i++) {
+		v[i] = i + 1;
+	}
+	CHECK(round_trip(v.data(), v.size(), &col));
+	CHECK(col.encoding == COLUMNAR_SCALED && columnar_scales[col.scale] == 1.0);
+	CHECK(col.bytes <= v.size() + 8);
+	CHECK(col.min == 1.0 && col.max == 4096.0);
+
+	// timestamps in ns with jitter
+	for (size_t i = 0; i < v.size(); i++) {
+		v[i] = (1000000 * i + (i * 37) % 11) / 1e9;
+	}
+	CHECK(round_trip(v.data(), v.size(), &col));
+	CHECK(col.encoding == COLUMNAR_SCALED && columnar_scales[col.scale] == 1e9);
+
+	// RAPL energy in 2^-14 J units, negative values included
+	for (size_t i = 0; i < v.size(); i++) {
+		v[i] = ((int64_t)(i * 1234567 % 100003) - 50000) / 16384.0;
+	}
+	CHECK(round_trip(v.data(), v.size(), &col));
+	CHECK(col.encoding == COLUMNAR_SCALED && columnar_scales[col.scale] == 16384.0);
+}
+
+static void test_xor_and_raw() {
+	columnar_column_t col;
+	std::vector<double> v(1000);
+	// a measured power, neighbours share the high bits
+	for (size_t i = 0; i < v.size(); i++) {
+		v[i] = 120.0 + sin(i * 0.01) / 3.0;
+	}
+	CHECK(round_trip(v.data(), v.size(), &col));
+	CHECK(col.encoding == COLUMNAR_XOR);
+	CHECK(col.bytes < v.size() * sizeof(double));
+
+	// noise whose XOR does not compress is stored raw
+	uint64_t state = 1;
+	for (size_t i = 0; i < v.size(); i++) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		v[i] = (double)(state >> 11) / 3.0 * ((state & 1) ? 1e-300 : 1e300);
+	}
+	CHECK(round_trip(v.data(), v.size(), &col));
+	CHECK(col.encoding == COLUMNAR_RAW && col.bytes == v.size() * sizeof(double));
+}
+
+static void test_special_values() {
+	columnar_column_t col;
+	const double v[] = {0.0, -0.0, NAN, -NAN, INFINITY, -INFINITY, 5e-324, -2.2250738585072014e-308, 1.0};
+	const uint32_t n = sizeof(v) / sizeof(v[0]);
+	CHECK(round_trip(v, n, &col));
+	CHECK(col.min == -INFINITY && col.max == INFINITY);
+
+	// -0.0 must not go through the integer path
+	const double z[] = {-0.0, 1.0, 2.0, 3.0};
+	CHECK(round_trip(z, 4, &col));
+	CHECK(col.encoding != COLUMNAR_SCALED);
+	CHECK(col.min == 0.0 && col.max == 3.0);
+
+	// a leading NaN does not poison the range, an all-NaN column has a NaN range
+	const double m[] = {NAN, 4.0, -1.0};
+	CHECK(round_trip(m, 3, &col));
+	CHECK(col.min == -1.0 && col.max == 4.0);
+	const double all[] = {NAN, NAN};
+	CHECK(round_trip(all, 2, &col));
+	CHECK(std::isnan(col.min) && std::isnan(col.max));
+
+	// one value and an empty column
+	const double one[] = {42.5};
+	CHECK(round_trip(one, 1, &col));
+	CHECK(round_trip(one, 0, &col));
+	CHECK(col.bytes == 0);
+}
+
+static void test_decode_rejects() {
+	columnar_column_t col;
+	uint8_t buf[1024];
+	double v[64], out[64];
+	for (int i = 0; i < 64; i++) {
+		v[i] = i * i;
+	}
+	columnar_encode(v, 64, &col, buf);
+	columnar_column_t bad = col;
+	bad.bytes--;
+	CHECK(!columnar_decode(buf, &bad, 64, out));
+	bad = col;
+	bad.bytes++;
+	CHECK(!columnar_decode(buf, &bad, 64, out));
+	bad = col;
+	bad.scale = columnar_n_scales;
+	CHECK(!columnar_decode(buf, &bad, 64, out));
+	bad = col;
+	bad.encoding = 7;
+	CHECK(!columnar_decode(buf, &bad, 64, out));
+	bad = col;
+	bad.encoding = COLUMNAR_RAW;
+	CHECK(!columnar_decode(buf, &bad, 64, out));
+}
+
+static void test_crc() {
+	CHECK(columnar_crc32((const uint8_t*)"123456789", 9) == 0xcbf43926u);
+	CHECK(columnar_crc32(NULL, 0) == 0);
+	// incremental over two pieces is the CRC of the whole
+	uint32_t part = columnar_crc32((const uint8_t*)"1234", 4);
+	CHECK(columnar_crc32((const uint8_t*)"56789", 5, part) == 0xcbf43926u);
+}
+
+// Chunks are read back in sequence; a clean end is not torn, every cut or flipped byte is
+static int read_chunks(FILE *fp, uint32_t n_fields, bool *torn, std::vector<double> *first) {
+	rewind(fp);
+	ColumnarReader reader(fp, n_fields);
+	int chunks = 0;
+	while (reader.next()) {
+		if (first != NULL && chunks == 0) {
+			first->resize(reader.records());
+			reader.column(0, first->data());
+		}
+		chunks++;
+	}
+	*torn = reader.torn();
+	return chunks;
+}
+
+static void test_writer_reader() {
+	char path[] = "/tmp/powermon-columnar-XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	if (fd < 0) {
+		return;
+	}
+	unlink(path);
+	FILE *fp = fdopen(fd, "w+b");
+	bool torn;
+	CHECK(read_chunks(fp, 3, &torn, NULL) == 0 && !torn);
+
+	ColumnarWriter writer(fp, 3);
+	double r[3];
+	long first_end = 0;
+	for (int i = 0; i < COLUMNAR_CHUNK_RECORDS + 100; i++) {
+		r[0] = i;
+		r[1] = i * 0.001;
+		r[2] = 100.0 + sin(i);
+		writer.add(r);
+		if (i == COLUMNAR_CHUNK_RECORDS - 1) {
+			first_end = ftell(fp);
+		}
+	}
+	writer.flush();
+	long size = ftell(fp);
+
+	std::vector<double> first;
+	CHECK(read_chunks(fp, 3, &torn, &first) == 2 && !torn);
+	CHECK(first.size() == COLUMNAR_CHUNK_RECORDS);
+	CHECK(first.size() > 10 && first[10] == 10.0);
+
+	// a reader with another field count rejects the chunks
+	CHECK(read_chunks(fp, 2, &torn, NULL) == 0 && torn);
+
+	// a flipped payload byte in the last chunk fails its CRC
+	fseek(fp, size - 5, SEEK_SET);
+	int c = fgetc(fp);
+	fseek(fp, size - 5, SEEK_SET);
+	fputc(c ^ 0x10, fp);
+	fflush(fp);
+	CHECK(read_chunks(fp, 3, &torn, NULL) == 1 && torn);
+	fseek(fp, size - 5, SEEK_SET);
+	fputc(c, fp);
+	fflush(fp);
+
+	// a crash part way through the last chunk, in its payload and in its header
+	CHECK(ftruncate(fd, size - 3) == 0);
+	CHECK(read_chunks(fp, 3, &torn, NULL) == 1 && torn);
+	CHECK(ftruncate(fd, first_end + sizeof(columnar_chunk_t) / 2) == 0);
+	CHECK(read_chunks(fp, 3, &torn, NULL) == 1 && torn);
+	CHECK(ftruncate(fd, first_end) == 0);
+	CHECK(read_chunks(fp, 3, &torn, NULL) == 1 && !torn);
+	fclose(fp);
+}
+
+int main() {
+	test_scaled();
+	test_xor_and_raw();
+	test_special_values();
+	test_decode_rejects();
+	test_crc();
+	test_writer_reader();
+	return check_result("columnar");
+}
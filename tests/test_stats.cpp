@@ -0,0 +1,114 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdint>
+
+#include "Stats.h"
+#include "check.h"
+
+// deterministic uniform values in [0,1)
+static double lcg(uint64_t *state) {
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(*state >> 11) / (double)(1ULL << 53);
+}
+
+static void test_welford() {
+	const double x[] = {2, 4, 4, 4, 5, 5, 7, 9};
+	Stats s;
+	for (int i = 0; i < 8; i++) {
+		s.add(x[i]);
+	}
+	CHECK(s.get_n() == 8);
+	CHECK_NEAR(s.mean(), 5.0, 1e-12);
+	CHECK_NEAR(s.variance(), 32.0 / 7.0, 1e-12);
+	CHECK_NEAR(s.stddev(), sqrt(32.0 / 7.0), 1e-12);
+	CHECK(s.min() == 2.0);
+	CHECK(s.max() == 9.0);
+
+	// a large offset must not cancel the variance away, the naive sum of squares does
+	Stats big;
+	const double y[] = {4, 7, 13, 16};
+	for (int i = 0; i < 4; i++) {
+		big.add(1e9 + y[i]);
+	}
+	CHECK_NEAR(big.mean(), 1e9 + 10.0, 1e-6);
+	CHECK_NEAR(big.variance(), 30.0, 1e-6);
+}
+
+static void test_small_counts() {
+	Stats s;
+	CHECK(s.get_n() == 0);
+	CHECK(s.variance() == 0.0);
+	CHECK(s.p50() == 0.0);
+	s.add(-3.0);
+	CHECK(s.variance() == 0.0);
+	CHECK(s.min() == -3.0 && s.max() == -3.0);
+	// under five samples the quantiles are exact
+	s.add(1.0);
+	s.add(2.0);
+	CHECK(s.p50() == 1.0);
+	CHECK(s.p99() == 2.0);
+
+	s.reset();
+	CHECK(s.get_n() == 0);
+	CHECK(s.mean() == 0.0);
+	s.add(10.0);
+	CHECK(s.min() == 10.0 && s.max() == 10.0 && s.p50() == 10.0);
+}
+
+static void test_psquare_uniform() {
+	Stats s;
+	uint64_t state = 42;
+	for (int i = 0; i < 200000; i++) {
+		s.add(lcg(&state));
+	}
+	CHECK_NEAR(s.mean(), 0.5, 0.005);
+	CHECK_NEAR(s.variance(), 1.0 / 12.0, 0.002);
+	CHECK_NEAR(s.p50(), 0.50, 0.01);
+	CHECK_NEAR(s.p95(), 0.95, 0.005);
+	CHECK_NEAR(s.p99(), 0.99, 0.002);
+	CHECK(s.min() >= 0.0 && s.min() < 0.001);
+	CHECK(s.max() < 1.0 && s.max() > 0.999);
+}
+
+static void test_psquare_ordered() {
+	// a ramp and a permutation of the same values reach the same quantiles
+	Quantile ramp(0.95), perm(0.95);
+	for (int i = 0; i < 10000; i++) {
+		ramp.add(i);
+		perm.add((i * 7919) % 10000);
+	}
+	CHECK_NEAR(ramp.value(), 9499.5, 50.0);
+	CHECK_NEAR(perm.value(), 9499.5, 50.0);
+
+	// a constant series has every quantile at the constant
+	Quantile flat(0.5);
+	for (int i = 0; i < 1000; i++) {
+		flat.add(42.0);
+	}
+	CHECK(flat.value() == 42.0);
+}
+
+static void test_psquare_bimodal() {
+	// idle/busy power: 90% of the samples near 50 W, 10% near 300 W
+	Stats s;
+	uint64_t state = 7;
+	for (int i = 0; i < 100000; i++) {
+		double u = lcg(&state);
+		s.add((i % 10 == 0 ? 300.0 : 50.0) + u);
+	}
+	CHECK_NEAR(s.p50(), 50.5, 0.5);
+	CHECK_NEAR(s.p99(), 300.9, 1.0);
+	CHECK_NEAR(s.mean(), 0.9 * 50.5 + 0.1 * 300.5, 0.1);
+}
+
+int main() {
+	test_welford();
+	test_small_counts();
+	test_psquare_uniform();
+	test_psquare_ordered();
+	test_psquare_bimodal();
+	return check_result("stats");
+}
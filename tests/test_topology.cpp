@@ -0,0 +1,143 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "RaplBackend.h"
+#include "Topology.h"
+#include "check.h"
+
+static void put(const std::string &path, const std::string &text) {
+	// mkdir -p of the parent directories
+	for (size_t p = path.find('/', 1); p != std::string::npos; p = path.find('/', p + 1)) {
+		mkdir(path.substr(0, p).c_str(), 0755);
+	}
+	FILE *fp = fopen(path.c_str(), "w");
+	fputs(text.c_str(), fp);
+	fclose(fp);
+}
+
+static void put_cpu(const std::string &root, int cpu, int package, int core) {
+	std::string dir = root + TOPOLOGY_CPU_ROOT "/cpu" + std::to_string(cpu) + "/topology/";
+	put(dir + "physical_package_id", std::to_string(package) + "\n");
+	put(dir + "core_id", std::to_string(core) + "\n");
+}
+
+static void test_parse_cpu_list() {
+	std::vector<int> cpus;
+	CHECK(parse_cpu_list("0,2,4-7\n", cpus) == 6);
+	CHECK(cpus.size() == 6 && cpus[0] == 0 && cpus[1] == 2 && cpus[2] == 4 && cpus[5] == 7);
+	CHECK(parse_cpu_list("3", cpus) == 1 && cpus[0] == 3);
+	CHECK(parse_cpu_list("\n", cpus) == 0);
+	CHECK(parse_cpu_list("", cpus) == 0);
+
+	// sparse lists of large machines are longer than a MAX_LINE buffer
+	std::string list;
+	for (int c = 0; c < 1000; c += 2) {
+		list += (c > 0 ? "," : "") + std::to_string(c);
+	}
+	CHECK(list.size() > MAX_LINE);
+	CHECK(parse_cpu_list(list.c_str(), cpus) == 500);
+	CHECK(cpus.size() == 500 && cpus[499] == 998);
+	CHECK(parse_cpu_list("0-383", cpus) == 384 && cpus[383] == 383);
+}
+
+/*
+Two packages with sparse ids 0 and 3, two SMT2 cores each, no die_id files
+(kernels before 5.2) and cpu 7 offline:
+    package 0: core 0 = cpus 0,4  core 1 = cpus 1,5
+    package 3: core 0 = cpus 2,6  core 2 = cpus 3,(7)
+*/
+static void test_sparse_packages(const std::string &root) {
+	put(root + TOPOLOGY_CPU_ROOT "/online", "0-6\n");
+	const int package[] = {0, 0, 3, 3, 0, 0, 3, 3};
+	const int core[] = {0, 1, 0, 2, 0, 1, 0, 2};
+	for (int c = 0; c < 8; c++) {
+		put_cpu(root, c, package[c], core[c]);
+	}
+	put(root + TOPOLOGY_NODE_ROOT "/online", "0-1\n");
+	put(root + TOPOLOGY_NODE_ROOT "/node0/cpulist", "0-1,4-5\n");
+	put(root + TOPOLOGY_NODE_ROOT "/node1/cpulist", "2-3,6-7\n");
+
+	Topology t(root);
+	CHECK(t.get_n_cpus() == 7);
+	CHECK(t.get_n_sockets() == 2);
+	CHECK(t.get_n_dies() == 2);
+	CHECK(t.get_n_cores() == 4);
+	CHECK(t.get_n_nodes() == 2);
+	CHECK(t.get_smt() == 2);
+
+	// sockets are dense in package id order
+	CHECK(t.socket_package(0) == 0 && t.socket_package(1) == 3);
+	CHECK(t.package_socket(3) == 1 && t.package_socket(0) == 0);
+	CHECK(t.package_socket(1) == -1);
+	CHECK(t.socket_cpu(0) == 0 && t.socket_cpu(1) == 2);
+
+	// the first thread of every core, in cpu order
+	CHECK(t.core_cpu(0) == 0 && t.core_cpu(1) == 1 && t.core_cpu(2) == 2 && t.core_cpu(3) == 3);
+
+	const topology_cpu_t *c = t.find(6);
+	CHECK(c != NULL);
+	if (c != NULL) {
+		CHECK(c->package == 3 && c->socket == 1 && c->core == 0 && c->thread == 1 && c->node == 1 && c->die == 0);
+	}
+	c = t.find(5);
+	CHECK(c != NULL && c->socket == 0 && c->thread == 1 && c->node == 0);
+	CHECK(t.find(3) != NULL && t.find(3)->thread == 0);
+	CHECK(t.find(7) == NULL);
+	CHECK(t.find(-1) == NULL);
+	CHECK(t.find(100) == NULL);
+	CHECK(t.get_cpu(6).cpu == 6);
+}
+
+// A single cpu machine without NUMA nodes or SMT, ids missing fall back to the cpu
+static void test_minimal(const std::string &root) {
+	put(root + TOPOLOGY_CPU_ROOT "/online", "0\n");
+	mkdir((root + TOPOLOGY_CPU_ROOT "/cpu0").c_str(), 0755);
+	Topology t(root);
+	CHECK(t.get_n_cpus() == 1);
+	CHECK(t.get_n_sockets() == 1);
+	CHECK(t.get_n_cores() == 1);
+	CHECK(t.get_n_nodes() == 0);
+	CHECK(t.get_smt() == 1);
+	CHECK(t.find(0) != NULL && t.find(0)->node == -1 && t.find(0)->package == 0);
+	CHECK(t.socket_cpu(0) == 0);
+}
+
+// Dies of one package are told apart by die_id, the cores under them by package, die and core id
+static void test_dies(const std::string &root) {
+	put(root + TOPOLOGY_CPU_ROOT "/online", "0-3\n");
+	for (int c = 0; c < 4; c++) {
+		put_cpu(root, c, 0, 0);
+		put(root + TOPOLOGY_CPU_ROOT "/cpu" + std::to_string(c) + "/topology/die_id", std::to_string(c / 2) + "\n");
+	}
+	Topology t(root);
+	CHECK(t.get_n_sockets() == 1);
+	CHECK(t.get_n_dies() == 2);
+	CHECK(t.get_n_cores() == 2);
+	CHECK(t.get_smt() == 2);
+	CHECK(t.core_cpu(0) == 0 && t.core_cpu(1) == 2);
+}
+
+int main() {
+	char tmpl[] = "/tmp/powermon-topology-XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	std::string dir = tmpl;
+	test_parse_cpu_list();
+	test_sparse_packages(dir + "/sparse");
+	test_minimal(dir + "/minimal");
+	test_dies(dir + "/dies");
+	std::string cmd = "rm -rf " + dir;
+	if (system(cmd.c_str()) != 0) {
+		fprintf(stderr, "could not remove %s\n", dir.c_str());
+	}
+	return check_result("topology");
+}
@@ -0,0 +1,166 @@
+/*
+ Copyright (c) 2021 Temporal Guild Group, Austral University of Chile, Valdivia Chile.
+ This file and all powermon software is licensed under the MIT License. 
+ Please refer to LICENSE for more details.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Trace.h"
+#include "Trigger.h"
+#include "check.h"
+
+#define MS 1000000ULL
+
+struct captured_t {
+	double time;
+	double power;
+	int event;
+};
+
+/*
+Feed power[i] at i ms through a trigger on total-power >= 1000 W, 1 ms
+interval, and read back what reached the trace.
+*/
+static std::vector<captured_t> capture(const std::vector<double> &power, double pre_ms, double post_ms,
+                                       unsigned long *events) {
+	std::vector<captured_t> out;
+	std::vector<trigger_threshold_t> th;
+	CHECK(Trigger::parse("total=1000", th));
+	char path[] = "/tmp/powermon-trigger-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return out;
+	}
+	close(fd);
+	Trace trace(path, TRACE_TEXT, TRACE_KIND_NODE);
+	trace.add_field("time", "s");
+	trace.add_field("total-power", "W");
+	Trigger trigger(th, pre_ms, post_ms);
+	CHECK(trigger.init(&trace, 1 * MS));
+	trace.open(trigger.capacity());
+	for (size_t i = 0; i < power.size(); i++) {
+		double *r = trigger.record();
+		r[0] = i * 0.001;
+		r[1] = power[i];
+		trigger.commit();
+	}
+	trace.close();
+
+	FILE *fp = tmpfile();
+	trigger.summary(fp);
+	rewind(fp);
+	char line[256];
+	*events = 0;
+	CHECK(fgets(line, sizeof(line), fp) != NULL && sscanf(line, "Trigger: %lu events", events) == 1);
+	fclose(fp);
+
+	fp = fopen(path, "r");
+	while (fp != NULL && fgets(line, sizeof(line), fp) != NULL) {
+		captured_t c;
+		if (line[0] != '#' && sscanf(line, "%lf %lf %d", &c.time, &c.power, &c.event) == 3) {
+			out.push_back(c);
+		}
+	}
+	if (fp != NULL) {
+		fclose(fp);
+	}
+	unlink(path);
+	return out;
+}
+
+// Records i..j (ms) of one event, in order
+static bool span(const std::vector<captured_t> &c, size_t at, int first, int last, int event) {
+	for (int i = first; i <= last; i++, at++) {
+		if (at >= c.size() || fabs(c[at].time - i * 0.001) > 1e-9 || c[at].event != event) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void test_windows() {
+	std::vector<double> p(30, 100.0);
+	p[10] = 1500.0;
+	// a second excursion that stays over for two ticks
+	p[15] = p[16] = 1200.0;
+	unsigned long events;
+	std::vector<captured_t> c = capture(p, 3.0, 2.0, &events);
+	CHECK(events == 2);
+	// 3 ms before the crossing, the crossing and 2 ms after it
+	CHECK(c.size() == 12);
+	CHECK(span(c, 0, 7, 12, 1));
+	CHECK(c.size() > 3 && c[3].power == 1500.0);
+	// the pre window of the second event only has what the first did not write
+	CHECK(span(c, 6, 13, 18, 2));
+}
+
+static void test_edges() {
+	unsigned long events;
+	// an excursion at the first record has no pre window
+	std::vector<double> p(10, 100.0);
+	p[0] = 2000.0;
+	std::vector<captured_t> c = capture(p, 5.0, 1.0, &events);
+	CHECK(events == 1);
+	CHECK(c.size() == 2 && span(c, 0, 0, 1, 1));
+
+	// staying over is one event, the post window starts when the power drops
+	std::vector<double> q(40, 100.0);
+	for (int i = 10; i < 25; i++) {
+		q[i] = 1000.0;
+	}
+	c = capture(q, 2.0, 3.0, &events);
+	CHECK(events == 1);
+	CHECK(c.size() == 20 && span(c, 0, 8, 27, 1));
+
+	// nothing over the threshold writes nothing
+	std::vector<double> low(100, 999.9);
+	c = capture(low, 10.0, 10.0, &events);
+	CHECK(events == 0 && c.empty());
+
+	// a wide pre window only holds what came before
+	std::vector<double> late(8, 100.0);
+	late[6] = 5000.0;
+	c = capture(late, 100.0, 0.0, &events);
+	CHECK(events == 1 && c.size() == 7 && span(c, 0, 0, 6, 1));
+}
+
+static void test_parse() {
+	std::vector<trigger_threshold_t> th;
+	CHECK(Trigger::parse("total=1500,cpu=300,gpu0-power=250.5", th));
+	CHECK(th.size() == 3);
+	if (th.size() == 3) {
+		CHECK(strcmp(th[0].column, "total-power") == 0 && th[0].watts == 1500.0);
+		CHECK(strcmp(th[1].column, "cpu-power") == 0 && th[1].watts == 300.0);
+		CHECK(strcmp(th[2].column, "gpu0-power") == 0 && th[2].watts == 250.5);
+	}
+	const char *bad[] = {"", "cpu", "=5", "cpu=", "cpu=0", "cpu=-3", "cpu=12W", "cpu=5,", ",cpu=5",
+	                     "averyveryverylongname=5"};
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		CHECK(!Trigger::parse(bad[i], th));
+	}
+	std::string many;
+	for (int i = 0; i <= TRIGGER_MAX_THRESHOLDS; i++) {
+		many += (i > 0 ? ",gpu" : "gpu") + std::to_string(i) + "=1";
+	}
+	CHECK(!Trigger::parse(many.c_str(), th));
+
+	// a threshold on a column the trace does not have
+	CHECK(Trigger::parse("dram=50", th));
+	Trace trace("/dev/null", TRACE_NONE, TRACE_KIND_NODE);
+	trace.add_field("time", "s");
+	trace.add_field("cpu-power", "W");
+	Trigger trigger(th, 1.0, 1.0);
+	CHECK(!trigger.init(&trace, 1 * MS));
+}
+
+int main() {
+	test_windows();
+	test_edges();
+	test_parse();
+	return check_result("trigger");
+}